@@ -1,575 +1,8492 @@
-#include <iostream>
-#include <string>
-#include <vector>
-#include <fstream>
-#include <map>
-#include <iomanip>
-#include <ctime>
-#include <limits>
-#include <cctype>
-
-using namespace std;
-
-// Base Soldier Class
-class Soldier {
-protected:
-    string pakNumber;
-    string name;
-    string rank;
-    
-public:
-    Soldier(string pak, string n, string r) 
-        : pakNumber(pak), name(n), rank(r) {}
-    
-    virtual void displayInfo() {
-        cout << "PAK Number: " << pakNumber << "\nName: " << name 
-             << "\nRank: " << rank << endl;
-    }
-    
-    string getPakNumber() { return pakNumber; }
-    string getRank() { return rank; }
-};
-
-// Derived Soldier Classes
-class EnlistedSoldier : public Soldier {
-public:
-    EnlistedSoldier(string pak, string n) 
-        : Soldier(pak, n, "Enlisted") {}
-};
-
-class JuniorCommissionedOfficer : public Soldier {
-public:
-    JuniorCommissionedOfficer(string pak, string n) 
-        : Soldier(pak, n, "Junior Commissioned Officer") {}
-};
-
-class CommissionedOfficer : public Soldier {
-public:
-    CommissionedOfficer(string pak, string n) 
-        : Soldier(pak, n, "Commissioned Officer") {}
-};
-
-// High Rank Officer Class
-class HighRankOfficer : public Soldier {
-private:
-    string officerRank;
-    
-public:
-    HighRankOfficer(string pak, string n, string r) 
-        : Soldier(pak, n, r), officerRank(r) {}
-    
-    void displayInfo() override {
-        cout << "PAK Number: " << pakNumber << "\nName: " << name 
-             << "\nRank: " << officerRank << endl;
-    }
-};
-
-// Battalion Class
-class Battalion {
-private:
-    string name;
-    string location;
-    int soldierCount;
-    map<string, int> inventory;
-    
-public:
-    Battalion(string n, string loc, int count) 
-        : name(n), location(loc), soldierCount(count) {}
-    
-    void addSoldiers(int count) { soldierCount += count; }
-    void addEquipment(string item, int quantity) { inventory[item] += quantity; }
-    
-    void displayInfo() {
-        cout << "\nBattalion: " << name << "\nLocation: " << location 
-             << "\nSoldier Count: " << soldierCount << "\nInventory:\n";
-        for (auto& item : inventory) {
-            cout << "- " << item.first << ": " << item.second << endl;
-        }
-    }
-    
-    string getName() { return name; }
-};
-
-// Inventory Management System
-class InventorySystem {
-private:
-    map<string, int> centralInventory;
-    map<string, int> maxQuantities;
-    vector<Battalion> battalions;
-    
-    // Pakistani military battalions
-    void initializeBattalions() {
-        battalions = {
-            Battalion("1st Northern Light Infantry", "Gilgit", 800),
-            Battalion("6th Baloch Regiment", "Quetta", 750),
-            Battalion("11th Frontier Force", "Peshawar", 900),
-            Battalion("17th Punjab Regiment", "Lahore", 850),
-            Battalion("23rd Sindh Regiment", "Karachi", 700)
-        };
-    }
-    
-    // Initialize central inventory
-    void initializeInventory() {
-        centralInventory = {
-            {"Assault Rifle", 5000},
-            {"Pistol", 3000},
-            {"Bulletproof Vest", 4000},
-            {"Helmet", 6000},
-            {"Night Vision Goggles", 1000},
-            {"Radio Set", 2000},
-            {"First Aid Kit", 8000},
-            {"Combat Boots", 10000},
-            {"Tactical Vest", 3500},
-            {"Grenade", 2000},
-            {"Machine Gun", 800},
-            {"Sniper Rifle", 500},
-            {"Rocket Launcher", 200},
-            {"Jeep", 300},
-            {"Truck", 150}
-        };
-        
-        // Store initial quantities for low inventory alerts
-        for (auto& item : centralInventory) {
-            maxQuantities[item.first] = item.second;
-        }
-    }
-    
-public:
-    InventorySystem() {
-        initializeBattalions();
-        initializeInventory();
-    }
-    
-    void displayCentralInventory() {
-        cout << "\nCENTRAL INVENTORY:\n";
-        int index = 1;
-        for (auto& item : centralInventory) {
-            cout << index++ << ". " << item.first << ": " << item.second;
-            if (item.second <= maxQuantities[item.first] / 2) {
-                cout << " (LOW STOCK!)";
-            }
-            cout << endl;
-        }
-    }
-    
-    bool requestItem(string item, int quantity, string rank) {
-        // Check rank-based quantity restrictions
-        if (rank == "Enlisted") {
-            map<string, int> maxAllowed = {
-                {"Assault Rifle", 1}, {"Pistol", 2}, {"Bulletproof Vest", 1},
-                {"Helmet", 1}, {"First Aid Kit", 3}, {"Combat Boots", 2}
-            };
-            if (quantity > maxAllowed[item]) {
-                cout << "Quantity exceeds allowed limit for your rank!\n";
-                return false;
-            }
-        }
-        else if (rank == "Junior Commissioned Officer") {
-            map<string, int> maxAllowed = {
-                {"Assault Rifle", 2}, {"Pistol", 2}, {"Bulletproof Vest", 2},
-                {"Helmet", 2}, {"First Aid Kit", 4}, {"Combat Boots", 3},
-                {"Radio Set", 1}, {"Tactical Vest", 1}
-            };
-            if (quantity > maxAllowed[item]) {
-                cout << "Quantity exceeds allowed limit for your rank!\n";
-                return false;
-            }
-        }
-        else if (rank == "Commissioned Officer") {
-            map<string, int> maxAllowed = {
-                {"Assault Rifle", 3}, {"Pistol", 3}, {"Bulletproof Vest", 3},
-                {"Helmet", 3}, {"First Aid Kit", 5}, {"Combat Boots", 4},
-                {"Radio Set", 2}, {"Tactical Vest", 2}, {"Night Vision Goggles", 1},
-                {"Machine Gun", 1}, {"Sniper Rifle", 1}
-            };
-            if (quantity > maxAllowed[item]) {
-                cout << "Quantity exceeds allowed limit for your rank!\n";
-                return false;
-            }
-        }
-        
-        if (centralInventory[item] >= quantity) {
-            centralInventory[item] -= quantity;
-            
-            // Log the transaction
-            logTransaction(item, quantity, rank);
-            
-            // Check if inventory is now at half or less
-            if (centralInventory[item] <= maxQuantities[item] / 2) {
-                cout << "ALERT: " << item << " inventory is now at half capacity!\n";
-            }
-            
-            return true;
-        }
-        return false;
-    }
-    
-    void logTransaction(string item, int quantity, string rank) {
-        ofstream logFile("inventory_log.txt", ios::app);
-        if (logFile.is_open()) {
-            time_t now = time(0);
-            char* dt = ctime(&now);
-            
-            logFile << "[" << dt << "] " << rank << " requested " << item << " x" << quantity << endl;
-            logFile.close();
-        }
-    }
-    
-    vector<Battalion>& getBattalions() { return battalions; }
-    map<string, int>& getInventory() { return centralInventory; }
-    int getMaxQuantity(string item) { return maxQuantities[item]; }
-    
-    vector<string> getAvailableItems(string rank) {
-        vector<string> available;
-        
-        if (rank == "Enlisted") {
-            available = {"Assault Rifle", "Pistol", "Bulletproof Vest", 
-                        "Helmet", "First Aid Kit", "Combat Boots"};
-        }
-        else if (rank == "Junior Commissioned Officer") {
-            available = {"Assault Rifle", "Pistol", "Bulletproof Vest", 
-                        "Helmet", "First Aid Kit", "Combat Boots", 
-                        "Radio Set", "Tactical Vest"};
-        }
-        else if (rank == "Commissioned Officer") {
-            available = {"Assault Rifle", "Pistol", "Bulletproof Vest", 
-                        "Helmet", "First Aid Kit", "Combat Boots", 
-                        "Radio Set", "Tactical Vest", "Night Vision Goggles", 
-                        "Machine Gun", "Sniper Rifle"};
-        }
-        
-        return available;
-    }
-    
-    void displayItemLimits(string rank) {
-        if (rank == "Enlisted") {
-            cout << "\nMAX ALLOWED QUANTITIES:\n";
-            cout << "1. Assault Rifle (Max: 1)\n";
-            cout << "2. Pistol (Max: 2)\n";
-            cout << "3. Bulletproof Vest (Max: 1)\n";
-            cout << "4. Helmet (Max: 1)\n";
-            cout << "5. First Aid Kit (Max: 3)\n";
-            cout << "6. Combat Boots (Max: 2)\n";
-        }
-        else if (rank == "Junior Commissioned Officer") {
-            cout << "\nMAX ALLOWED QUANTITIES:\n";
-            cout << "1. Assault Rifle (Max: 2)\n";
-            cout << "2. Pistol (Max: 2)\n";
-            cout << "3. Bulletproof Vest (Max: 2)\n";
-            cout << "4. Helmet (Max: 2)\n";
-            cout << "5. First Aid Kit (Max: 4)\n";
-            cout << "6. Combat Boots (Max: 3)\n";
-            cout << "7. Radio Set (Max: 1)\n";
-            cout << "8. Tactical Vest (Max: 1)\n";
-        }
-        else if (rank == "Commissioned Officer") {
-            cout << "\nMAX ALLOWED QUANTITIES:\n";
-            cout << "1. Assault Rifle (Max: 3)\n";
-            cout << "2. Pistol (Max: 3)\n";
-            cout << "3. Bulletproof Vest (Max: 3)\n";
-            cout << "4. Helmet (Max: 3)\n";
-            cout << "5. First Aid Kit (Max: 5)\n";
-            cout << "6. Combat Boots (Max: 4)\n";
-            cout << "7. Radio Set (Max: 2)\n";
-            cout << "8. Tactical Vest (Max: 2)\n";
-            cout << "9. Night Vision Goggles (Max: 1)\n";
-            cout << "10. Machine Gun (Max: 1)\n";
-            cout << "11. Sniper Rifle (Max: 1)\n";
-        }
-    }
-    
-    string getItemByIndex(int index) {
-        int i = 1;
-        for (auto& item : centralInventory) {
-            if (i++ == index) {
-                return item.first;
-            }
-        }
-        return "";
-    }
-};
-
-class AuthenticationSystem {
-private:
-    InventorySystem inventory;
-    
-    bool validatePakNumber(string pakNumber, string& rank) {
-        if (pakNumber.length() < 3) return false;
-        
-        if (pakNumber.substr(0, 3) == "PAK") {
-            // Check if it's all numbers after "PAK"
-            for (size_t i = 3; i < pakNumber.length(); i++) {
-                if (!isdigit(pakNumber[i])) {
-                    return false;
-                }
-            }
-            rank = "Enlisted";
-            return true;
-        }
-        else if (pakNumber.substr(0, 5) == "LCPAK") {
-            rank = "Lieutenant Colonel";
-            return true;
-        }
-        else if (pakNumber.substr(0, 4) == "CPAK") {
-            rank = "Colonel";
-            return true;
-        }
-        else if (pakNumber.substr(0, 4) == "BPAK") {
-            rank = "Brigadier";
-            return true;
-        }
-        else if (pakNumber.substr(0, 5) == "MGPAK") {
-            rank = "Major General";
-            return true;
-        }
-        else if (pakNumber.substr(0, 4) == "GPAK") {
-            rank = "General";
-            return true;
-        }
-        else if (pakNumber.substr(0, 5) == "FMPAK") {
-            rank = "Field Marshall";
-            return true;
-        }
-        return false;
-    }
-    
-    int getValidNumberInput(int maxChoice) {
-        int choice;
-        while (true) {
-            cin >> choice;
-            if (cin.fail() || choice < 0 || choice > maxChoice) {
-                cin.clear();
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                cout << "Invalid input. Please enter a number between 0 and " << maxChoice << ": ";
-            } else {
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                return choice;
-            }
-        }
-    }
-    
-    int getValidQuantityInput() {
-        int quantity;
-        while (true) {
-            cin >> quantity;
-            if (cin.fail() || quantity <= 0) {
-                cin.clear();
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                cout << "Invalid input. Please enter an accurate number: ";
-            } else {
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                return quantity;
-            }
-        }
-    }
-    
-public:
-    void soldierPortal() {
-        string pakNumber, name;
-        cout << "SOLDIER PORTAL\n";
-        cout << "Enter your PAK Number:";
-        cin >> pakNumber;
-        
-        string rank;
-        if (!validatePakNumber(pakNumber, rank)) {
-            cout << "Invalid PAK Number format!\n";
-            return;
-        }
-        
-        if (rank != "Enlisted") {
-            cout << "Please use the Officer Portal for higher ranks.\n";
-            return;
-        }
-        
-        cout << "Enter your name: ";
-        cin.ignore();
-        getline(cin, name);
-        
-        Soldier* soldier;
-        int rankChoice;
-        cout << "\nSelect your rank:\n1. Enlisted Ranks\n2. Junior Commissioned Officer\n3. Commissioned Officer\n";
-        rankChoice = getValidNumberInput(3);
-        
-        switch(rankChoice) {
-            case 1:
-                soldier = new EnlistedSoldier(pakNumber, name);
-                rank = "Enlisted";
-                break;
-            case 2:
-                soldier = new JuniorCommissionedOfficer(pakNumber, name);
-                rank = "Junior Commissioned Officer";
-                break;
-            case 3:
-                soldier = new CommissionedOfficer(pakNumber, name);
-                rank = "Commissioned Officer";
-                break;
-            default:
-                return;
-        }
-        
-        cout << "\nWelcome ";
-        soldier->displayInfo();
-        
-        // Inventory request
-        vector<string> availableItems = inventory.getAvailableItems(rank);
-        inventory.displayItemLimits(rank);
-        
-        cout << "\nAvailable Items:\n";
-        for (int i = 0; i < availableItems.size(); i++) {
-            cout << i+1 << ". " << availableItems[i] << endl;
-        }
-        
-        int itemChoice;
-        cout << "Select item to request (0 to exit): ";
-        itemChoice = getValidNumberInput(availableItems.size());
-        
-        if (itemChoice > 0 && itemChoice <= availableItems.size()) {
-            cout << "Enter quantity: ";
-            int quantity = getValidQuantityInput();
-            
-            if (inventory.requestItem(availableItems[itemChoice-1], quantity, rank)) {
-                cout << "Request successful!\n";
-            } else {
-                cout << "Request failed! Either not enough items in inventory or quantity exceeds your rank's limit.\n";
-            }
-        }
-        
-        delete soldier;
-    }
-    
-    void officerPortal() {
-        string pakNumber;
-        cout << "OFFICER COMMAND PORTAL\n";
-        cout << "Enter your PAK Number: ";
-        cin >> pakNumber;
-        
-        string rank;
-        if (!validatePakNumber(pakNumber, rank)) {
-            cout << "Invalid PAK Number!\n";
-            return;
-        }
-        
-        // Check if it's a high rank
-        if (rank == "Enlisted" || rank == "Junior Commissioned Officer" || rank == "Commissioned Officer") {
-            cout << "Access denied! This portal is for high ranking officers only.\n";
-            return;
-        }
-        
-        cout << "Welcome " << rank << "!\n";
-        
-        HighRankOfficer officer(pakNumber, "Officer Name", rank);
-        
-        int choice;
-        do {
-            cout << "\nOFFICER MENU\n";
-            cout << "1. View Central Inventory\n";
-            cout << "2. View Battalion Status\n";
-            cout << "3. Deploy Soldiers to Battalion\n";
-            cout << "4. Allocate Equipment to Battalion\n";
-            cout << "0. Exit\n";
-            cout << "Enter choice: ";
-            choice = getValidNumberInput(4);
-            
-            switch(choice) {
-                case 1:
-                    inventory.displayCentralInventory();
-                    break;
-                case 2: {
-                    cout << "\nBATTALION STATUS:\n";
-                    for (auto& bat : inventory.getBattalions()) {
-                        bat.displayInfo();
-                    }
-                    break;
-                }
-                case 3: {
-                    cout << "\nSelect battalion to deploy soldiers:\n";
-                    for (int i = 0; i < inventory.getBattalions().size(); i++) {
-                        cout << i+1 << ". " << inventory.getBattalions()[i].getName() << endl;
-                    }
-                    int batChoice;
-                    batChoice = getValidNumberInput(inventory.getBattalions().size());
-                    if (batChoice > 0) {
-                        cout << "Enter number of soldiers to deploy: ";
-                        int soldierCount = getValidQuantityInput();
-                        inventory.getBattalions()[batChoice-1].addSoldiers(soldierCount);
-                        cout << "Deployment successful!\n";
-                    }
-                    break;
-                }
-                case 4: {
-                    inventory.displayCentralInventory();
-                    
-                    cout << "Select item to allocate (0 to cancel): ";
-                    int itemChoice = getValidNumberInput(inventory.getInventory().size());
-                    if (itemChoice == 0) break;
-                    
-                    string selectedItem = inventory.getItemByIndex(itemChoice);
-                    if (selectedItem.empty()) {
-                        cout << "Invalid item selection!\n";
-                        break;
-                    }
-                    
-                    int availableQuantity = inventory.getInventory()[selectedItem];
-                    cout << "Enter quantity (Available: " << availableQuantity << "): ";
-                    int quantity = getValidQuantityInput();
-                    
-                    if (quantity > availableQuantity) {
-                        cout << "Allocation failed! Not enough items.\n";
-                        break;
-                    }
-                    
-                    // Select battalion
-                    cout << "\nSelect battalion:\n";
-                    for (int i = 0; i < inventory.getBattalions().size(); i++) {
-                        cout << i+1 << ". " << inventory.getBattalions()[i].getName() << endl;
-                    }
-                    int batChoice = getValidNumberInput(inventory.getBattalions().size());
-                    
-                    if (batChoice > 0) {
-                        inventory.getBattalions()[batChoice-1].addEquipment(selectedItem, quantity);
-                        inventory.getInventory()[selectedItem] -= quantity;
-                        cout << "Allocation successful!\n";
-                        
-                        // Check if inventory is now at half or less
-                        if (inventory.getInventory()[selectedItem] <= inventory.getMaxQuantity(selectedItem) / 2) {
-                            cout << "ALERT: " << selectedItem << " inventory is now at half capacity!\n";
-                        }
-                    }
-                    break;
-                }
-            }
-        } while (choice != 0);
-    }
-};
-
-int main() {
-    AuthenticationSystem authSystem;
-    
-    int choice;
-    do {
-        cout << "\nMILITARY ASSETS MANAGEMENT SYSTEM\n";
-        cout << "1. Soldier Portal\n";
-        cout << "2. Officer Command Portal\n";
-        cout << "0. Exit\n";
-        cout << "Enter choice: ";
-        
-        // Input validation for main menu
-        while (!(cin >> choice)) {
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-            cout << "Invalid input. Please enter 0, 1 or 2: ";
-        }
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        
-        switch(choice) {
-            case 1:
-                authSystem.soldierPortal();
-                break;
-            case 2:
-                authSystem.officerPortal();
-                break;
-        }
-    } while (choice != 0);
-    
-    return 0;
-}
+#include <iostream>
+#include <string>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <map>
+#include <set>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <random>
+#include <ctime>
+#include <limits>
+#include <cctype>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <cstring>
+#include <cmath>
+#include <charconv>
+#include <string_view>
+#include <memory_resource>
+#include <new>
+#include <cstdlib>
+#include <condition_variable>
+#include <shared_mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <signal.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+// Allocation Counting
+// Built with -DMAMS_ALLOC_CHECK, the global allocation functions are
+// replaced so each thread counts its own heap allocations; --alloc-check
+// uses the count to show that the request and login paths allocate nothing
+// once warmed up. Other builds keep the standard allocation functions.
+#ifdef MAMS_ALLOC_CHECK
+thread_local uint64_t threadAllocations = 0;
+
+void* operator new(size_t size) {
+    threadAllocations++;
+    if (void* block = malloc(size ? size : 1)) return block;
+    throw bad_alloc();
+}
+
+void* operator new(size_t size, align_val_t alignment) {
+    threadAllocations++;
+    void* block = nullptr;
+    if (posix_memalign(&block, max((size_t)alignment, sizeof(void*)), size ? size : 1) == 0) return block;
+    throw bad_alloc();
+}
+
+void* operator new[](size_t size) { return ::operator new(size); }
+void* operator new[](size_t size, align_val_t alignment) { return ::operator new(size, alignment); }
+
+// Kept out of line, so callers see a matching delete rather than a free
+[[gnu::noinline]] void operator delete(void* block) noexcept { free(block); }
+[[gnu::noinline]] void operator delete[](void* block) noexcept { free(block); }
+[[gnu::noinline]] void operator delete(void* block, size_t) noexcept { free(block); }
+[[gnu::noinline]] void operator delete[](void* block, size_t) noexcept { free(block); }
+[[gnu::noinline]] void operator delete(void* block, align_val_t) noexcept { free(block); }
+[[gnu::noinline]] void operator delete[](void* block, align_val_t) noexcept { free(block); }
+[[gnu::noinline]] void operator delete(void* block, size_t, align_val_t) noexcept { free(block); }
+[[gnu::noinline]] void operator delete[](void* block, size_t, align_val_t) noexcept { free(block); }
+#endif
+
+// Ranks
+enum class Rank : uint8_t {
+    Enlisted,
+    JuniorCommissionedOfficer,
+    CommissionedOfficer,
+    LieutenantColonel,
+    Colonel,
+    Brigadier,
+    MajorGeneral,
+    General,
+    FieldMarshall
+};
+
+constexpr int kRankCount = 9;
+constexpr int kSoldierRankCount = 3;   // ranks served by the Soldier Portal
+
+constexpr const char* kRankNames[kRankCount] = {
+    "Enlisted", "Junior Commissioned Officer", "Commissioned Officer",
+    "Lieutenant Colonel", "Colonel", "Brigadier", "Major General",
+    "General", "Field Marshall"
+};
+
+constexpr const char* rankName(Rank rank) { return kRankNames[(int)rank]; }
+constexpr bool isHighRank(Rank rank) { return (int)rank >= kSoldierRankCount; }
+
+// PAK Numbers
+// A rank prefix (none, LC, C, B, MG, G or FM), "PAK" and 1-17 digits. The
+// parser dispatches on the first letter and allocates nothing. number packs
+// the digits with their count, so PAK007 and PAK7 stay distinct; the rank is
+// the one the prefix stands for, Enlisted for plain PAK numbers.
+inline bool parsePakNumber(const char* text, size_t length, Rank& rank, uint64_t& number) {
+    if (length < 4) return false;
+    size_t prefix = 1;
+    switch (text[0]) {
+        case 'P': rank = Rank::Enlisted; prefix = 0; break;
+        case 'C': rank = Rank::Colonel; break;
+        case 'B': rank = Rank::Brigadier; break;
+        case 'G': rank = Rank::General; break;
+        case 'L': rank = Rank::LieutenantColonel; prefix = 2; break;
+        case 'M': rank = Rank::MajorGeneral; prefix = 2; break;
+        case 'F': rank = Rank::FieldMarshall; prefix = 2; break;
+        default: return false;
+    }
+    static const char kSecondLetter[kRankCount] = {0, 0, 0, 'C', 0, 0, 'G', 0, 'M'};
+    if (prefix == 2 && text[1] != kSecondLetter[(int)rank]) return false;
+    if (length < prefix + 4 || length > prefix + 20 || memcmp(text + prefix, "PAK", 3) != 0) return false;
+    uint64_t value = 0;
+    for (size_t i = prefix + 3; i < length; i++) {
+        unsigned digit = (unsigned char)text[i] - '0';
+        if (digit > 9) return false;
+        value = value * 10 + digit;
+    }
+    number = value * 32 + (length - prefix - 3);
+    return true;
+}
+
+// Standard catalog items. The catalog interns these first and in this
+// order, so their item IDs are known at compile time.
+enum StandardItem {
+    AssaultRifle, Pistol, BulletproofVest, Helmet, FirstAidKit, CombatBoots,
+    RadioSet, TacticalVest, NightVisionGoggles, MachineGun, SniperRifle,
+    Grenade, RocketLauncher, Jeep, Truck,
+    kStandardItemCount
+};
+
+constexpr const char* kStandardItemNames[kStandardItemCount] = {
+    "Assault Rifle", "Pistol", "Bulletproof Vest", "Helmet", "First Aid Kit",
+    "Combat Boots", "Radio Set", "Tactical Vest", "Night Vision Goggles",
+    "Machine Gun", "Sniper Rifle", "Grenade", "Rocket Launcher", "Jeep", "Truck"
+};
+
+// Maximum quantity per request, rank x item. Zero means not issued to that rank.
+constexpr int kEntitlements[kSoldierRankCount][kStandardItemCount] = {
+    //  AR  PI  BV  HE  FA  CB  RS  TV  NV  MG  SR  GR  RL  JP  TR
+    {   1,  2,  1,  1,  3,  2,  0,  0,  0,  0,  0,  0,  0,  0,  0 },   // Enlisted
+    {   2,  2,  2,  2,  4,  3,  1,  1,  0,  0,  0,  0,  0,  0,  0 },   // Junior Commissioned Officer
+    {   3,  3,  3,  3,  5,  4,  2,  2,  1,  1,  1,  0,  0,  0,  0 }    // Commissioned Officer
+};
+
+// High ranks draw from the central inventory without per-request limits
+constexpr int getEntitlement(Rank rank, int itemId) {
+    if (isHighRank(rank)) return numeric_limits<int>::max();
+    if (itemId < 0 || itemId >= kStandardItemCount) return 0;
+    return kEntitlements[(int)rank][itemId];
+}
+
+// Items a rank may request, derived from the entitlement matrix at compile time
+struct EntitledItems {
+    int count;
+    int items[kStandardItemCount];
+};
+
+constexpr EntitledItems buildEntitledItems(int rankIndex) {
+    EntitledItems list{0, {}};
+    for (int item = 0; rankIndex < kSoldierRankCount && item < kStandardItemCount; item++) {
+        if (kEntitlements[rankIndex][item] > 0) {
+            list.items[list.count++] = item;
+        }
+    }
+    return list;
+}
+
+constexpr EntitledItems kEntitledItems[kRankCount] = {
+    buildEntitledItems(0), buildEntitledItems(1), buildEntitledItems(2),
+    buildEntitledItems(3), buildEntitledItems(4), buildEntitledItems(5),
+    buildEntitledItems(6), buildEntitledItems(7), buildEntitledItems(8)
+};
+
+static_assert(kEntitledItems[0].count == 6 && kEntitledItems[2].count == 11,
+              "entitlement matrix out of sync with rank item lists");
+
+// Session Arena
+// Scratch memory for one login session. The session's soldier and strings
+// are carved from a fixed buffer and released together when the session
+// ends; a session that outgrows the buffer continues on the heap.
+class SessionArena {
+private:
+    alignas(max_align_t) char buffer[1024];
+    pmr::monotonic_buffer_resource memory;
+    
+public:
+    // Ends an arena object's lifetime; its memory goes with the arena
+    struct Destroy {
+        template <typename T>
+        void operator()(T* object) const { object->~T(); }
+    };
+    template <typename T>
+    using Ptr = unique_ptr<T, Destroy>;
+    
+    SessionArena() : memory(buffer, sizeof(buffer)) {}
+    SessionArena(const SessionArena&) = delete;
+    SessionArena& operator=(const SessionArena&) = delete;
+    
+    pmr::memory_resource* resource() { return &memory; }
+    
+    // Constructs a T whose strings also live in the arena
+    template <typename T, typename... Args>
+    Ptr<T> make(Args&&... args) {
+        void* block = memory.allocate(sizeof(T), alignof(T));
+        return Ptr<T>(new (block) T(forward<Args>(args)..., &memory));
+    }
+};
+
+// Base Soldier Class
+class Soldier {
+protected:
+    pmr::string pakNumber;
+    pmr::string name;
+    Rank rank;
+    
+public:
+    Soldier(string_view pak, string_view n, Rank r, pmr::memory_resource* memory = pmr::get_default_resource())
+        : pakNumber(pak, memory), name(n, memory), rank(r) {}
+    virtual ~Soldier() = default;
+    
+    virtual void displayInfo() {
+        cout << "PAK Number: " << pakNumber << "\nName: " << name 
+             << "\nRank: " << rankName(rank) << endl;
+    }
+    
+    string_view getPakNumber() const { return pakNumber; }
+    Rank getRank() const { return rank; }
+};
+
+// Derived Soldier Classes
+class EnlistedSoldier : public Soldier {
+public:
+    EnlistedSoldier(string_view pak, string_view n, pmr::memory_resource* memory = pmr::get_default_resource())
+        : Soldier(pak, n, Rank::Enlisted, memory) {}
+};
+
+class JuniorCommissionedOfficer : public Soldier {
+public:
+    JuniorCommissionedOfficer(string_view pak, string_view n, pmr::memory_resource* memory = pmr::get_default_resource())
+        : Soldier(pak, n, Rank::JuniorCommissionedOfficer, memory) {}
+};
+
+class CommissionedOfficer : public Soldier {
+public:
+    CommissionedOfficer(string_view pak, string_view n, pmr::memory_resource* memory = pmr::get_default_resource())
+        : Soldier(pak, n, Rank::CommissionedOfficer, memory) {}
+};
+
+// High Rank Officer Class
+class HighRankOfficer : public Soldier {
+private:
+    Rank officerRank;
+    
+public:
+    HighRankOfficer(string_view pak, string_view n, Rank r, pmr::memory_resource* memory = pmr::get_default_resource())
+        : Soldier(pak, n, r, memory), officerRank(r) {}
+    
+    void displayInfo() override {
+        cout << "PAK Number: " << pakNumber << "\nName: " << name 
+             << "\nRank: " << rankName(officerRank) << endl;
+    }
+};
+
+// Name Index
+// Case-insensitive lookup by name or name prefix. Keys are kept sorted, so
+// the names sharing a prefix form one contiguous range found by binary search.
+class NameIndex {
+private:
+    vector<pair<string, int>> entries;   // lowercased name, ID
+    
+    // Orders a lowercased key against text, lowercasing text as it goes
+    static int compareFolded(string_view key, string_view text) {
+        size_t n = min(key.size(), text.size());
+        for (size_t i = 0; i < n; i++) {
+            unsigned char a = key[i], b = (unsigned char)tolower((unsigned char)text[i]);
+            if (a != b) return a < b ? -1 : 1;
+        }
+        return key.size() < text.size() ? -1 : key.size() > text.size() ? 1 : 0;
+    }
+    
+public:
+    static string fold(string_view name) {
+        string key(name);
+        for (char& c : key) c = (char)tolower((unsigned char)c);
+        return key;
+    }
+    
+    void insert(string_view name, int id) {
+        pair<string, int> entry(fold(name), id);
+        entries.insert(upper_bound(entries.begin(), entries.end(), entry), move(entry));
+    }
+    
+    // Positions [first, second) of the names starting with prefix
+    pair<int, int> range(string_view prefix) const {
+        auto first = lower_bound(entries.begin(), entries.end(), prefix,
+                                 [](const pair<string, int>& e, string_view p) { return compareFolded(e.first, p) < 0; });
+        auto last = partition_point(first, entries.end(), [prefix](const pair<string, int>& e) {
+            return compareFolded(string_view(e.first).substr(0, prefix.size()), prefix) == 0;
+        });
+        return {(int)(first - entries.begin()), (int)(last - entries.begin())};
+    }
+    
+    int getId(int position) const { return entries[position].second; }
+    
+    // The ID whose name equals text, else the only one starting with it;
+    // -1 if nothing matches, -2 if the prefix is ambiguous
+    int find(string_view text) const {
+        pair<int, int> matches = range(text);
+        if (matches.first == matches.second) return -1;
+        if (matches.second - matches.first == 1 || entries[matches.first].first.size() == text.size()) {
+            return entries[matches.first].second;
+        }
+        return -2;
+    }
+};
+
+// Item Catalog
+// Interns item names once into dense integer IDs. Everything behind the
+// console/API boundary works on IDs; names are only looked up here.
+class ItemCatalog {
+private:
+    deque<string> names;                   // ID -> name, addresses stay stable as the catalog grows
+    unordered_map<string_view, int> ids;   // name -> ID, keys view into names
+    vector<int> sortedIds;                 // IDs in alphabetical order, used for menus
+    NameIndex search;                      // case-insensitive name and prefix search
+    
+public:
+    int intern(string_view name) {
+        auto it = ids.find(name);
+        if (it != ids.end()) return it->second;
+        
+        int id = (int)names.size();
+        names.emplace_back(name);
+        ids.emplace(names.back(), id);
+        sortedIds.insert(upper_bound(sortedIds.begin(), sortedIds.end(), id,
+                                     [this](int a, int b) { return names[a] < names[b]; }), id);
+        search.insert(name, id);
+        return id;
+    }
+    
+    // Returns -1 for unknown items
+    int find(string_view name) const {
+        auto it = ids.find(name);
+        return it == ids.end() ? -1 : it->second;
+    }
+    
+    const string& getName(int id) const { return names[id]; }
+    int size() const { return (int)names.size(); }
+    
+    // Position in alphabetical order (0-based) -> item ID
+    int getSortedId(int position) const { return sortedIds[position]; }
+    
+    const NameIndex& getSearch() const { return search; }
+};
+
+// Atomic Counters
+// Stock levels are shared between request handlers, so every counter is an
+// atomic. The copy operations exist only so the counters can live in vectors;
+// they are used while tables are set up or resized, never concurrently.
+struct AtomicCounter {
+    atomic<int> value;
+    
+    AtomicCounter(int v = 0) : value(v) {}
+    AtomicCounter(const AtomicCounter& other) : value(other.value.load(memory_order_relaxed)) {}
+    AtomicCounter& operator=(const AtomicCounter& other) {
+        value.store(other.value.load(memory_order_relaxed), memory_order_relaxed);
+        return *this;
+    }
+    
+    int load() const { return value.load(memory_order_relaxed); }
+    void store(int v) { value.store(v, memory_order_relaxed); }
+    int add(int delta) { return value.fetch_add(delta, memory_order_relaxed) + delta; }
+    
+    // Sequentially consistent, for a write to one counter followed by a read
+    // of another that must not be reordered (see InventorySystem::takeCentral)
+    int loadOrdered() const { return value.load(memory_order_seq_cst); }
+    int addOrdered(int delta) { return value.fetch_add(delta, memory_order_seq_cst) + delta; }
+    
+    // Takes quantity out of the counter unless that would leave less than
+    // floor. On success, before holds the value the decrement was applied to.
+    // The decrement is sequentially consistent, which costs nothing extra on
+    // x86, where every locked instruction is a full barrier.
+    bool tryTake(int quantity, int& before, int floor = 0) {
+        before = value.load(memory_order_relaxed);
+        do {
+            if (before - floor < quantity) return false;
+        } while (!value.compare_exchange_weak(before, before - quantity, memory_order_seq_cst,
+                                              memory_order_relaxed));
+        return true;
+    }
+    
+    // Adds a non-negative quantity unless the counter would pass INT_MAX.
+    // On success, after holds the new value.
+    bool tryAdd(int quantity, int& after) {
+        int current = value.load(memory_order_relaxed);
+        do {
+            if (current > numeric_limits<int>::max() - quantity) return false;
+        } while (!value.compare_exchange_weak(current, current + quantity, memory_order_relaxed));
+        after = current + quantity;
+        return true;
+    }
+};
+
+// One counter per cache line, so requests for different items never contend
+struct alignas(64) PaddedCounter : AtomicCounter {
+    using AtomicCounter::AtomicCounter;
+};
+
+// Battalion Class
+// The counters live in the battalion's row of the state store; the
+// battalion is re-attached whenever the store is laid out anew.
+constexpr int kBattalionRowHeader = 2;   // soldiers, supplying depot
+
+class Battalion {
+private:
+    string name;
+    string location;
+    AtomicCounter* soldierCount = nullptr;
+    AtomicCounter* supplier = nullptr;    // depot index + 1, 0 for the central depot
+    AtomicCounter* inventory = nullptr;   // indexed by item ID
+    
+public:
+    Battalion(string n, string loc) 
+        : name(move(n)), location(move(loc)) {}
+    
+    // row[0] is the soldier count and row[1] the supplying depot, followed
+    // by one holding per item
+    void attach(AtomicCounter* row) {
+        soldierCount = row;
+        supplier = row + 1;
+        inventory = row + kBattalionRowHeader;
+    }
+    
+    void addSoldiers(int count) { soldierCount->add(count); }
+    
+    // False, deploying nobody, if the total would pass INT_MAX
+    bool deploySoldiers(int count) {
+        int after;
+        return soldierCount->tryAdd(count, after);
+    }
+    void addEquipment(int itemId, int quantity) { inventory[itemId].add(quantity); }
+    void setDepot(int depot) { supplier->store(depot + 1); }
+    AtomicCounter& holding(int itemId) { return inventory[itemId]; }
+    
+    // Used when restoring from a snapshot
+    void restoreState(int soldiers, int depot, const int32_t* holdings, int itemCount) {
+        soldierCount->store(soldiers);
+        setDepot(depot);
+        for (int i = 0; i < itemCount; i++) inventory[i].store(holdings[i]);
+    }
+    
+    // Appends the battalion's status block to a report buffer
+    void render(string& out, const ItemCatalog& catalog) const {
+        out += "\nBattalion: ";
+        out += name;
+        out += "\nLocation: ";
+        out += location;
+        out += "\nSoldier Count: ";
+        out += to_string(soldierCount->load());
+        out += "\nInventory:\n";
+        for (int i = 0; i < catalog.size(); i++) {
+            int id = catalog.getSortedId(i);
+            int quantity = inventory[id].load();
+            if (quantity > 0) {
+                out += "- ";
+                out += catalog.getName(id);
+                out += ": ";
+                out += to_string(quantity);
+                out += '\n';
+            }
+        }
+    }
+    
+    const string& getName() const { return name; }
+    const string& getLocation() const { return location; }
+    int getSoldierCount() const { return soldierCount->load(); }
+    int getDepot() const { return supplier->load() - 1; }
+    int getHolding(int itemId) const { return inventory[itemId].load(); }
+};
+
+// Depot Hierarchy
+// Stock is held at three levels: the central depot, regional depots and
+// battalions, each battalion supplied by one regional depot or directly by
+// the central depot. Like battalions, depots keep their stock in a row of
+// the state store.
+class Depot {
+private:
+    string name;
+    string location;
+    AtomicCounter* stock = nullptr;   // indexed by item ID
+    
+public:
+    Depot(string n, string loc) : name(move(n)), location(move(loc)) {}
+    
+    void attach(AtomicCounter* row) { stock = row; }
+    
+    AtomicCounter& holding(int itemId) { return stock[itemId]; }
+    int getHolding(int itemId) const { return stock[itemId].load(); }
+    const string& getName() const { return name; }
+    const string& getLocation() const { return location; }
+};
+
+// Where stock sits: the central depot, a regional depot or a battalion
+enum class HolderKind : uint8_t { Central, Depot, Battalion };
+
+struct Holder {
+    HolderKind kind;
+    int index;   // depot or battalion index; unused for the central depot
+    
+    // Packed into 32 bits for journal records
+    uint32_t pack() const { return (uint32_t)kind << 24 | ((uint32_t)index & 0xffffff); }
+    static Holder unpack(uint32_t packed) { return {(HolderKind)(packed >> 24), (int)(packed & 0xffffff)}; }
+};
+
+// Running totals per item of what the regional depots and the battalions
+// hold, army-wide and per region (a depot plus the battalions it supplies).
+// Every stock movement outside the central depot updates them along with
+// the stock itself, so an army-wide or regional total is a single load.
+// Sized by the store's capacities and rebuilt whenever the store is laid
+// out anew.
+class StockRollup {
+private:
+    // Totals span many holders, each of which may hold up to INT_MAX
+    struct Total {
+        atomic<int64_t> value{0};
+        
+        Total() = default;
+        Total(const Total& other) : value(other.value.load(memory_order_relaxed)) {}
+        Total& operator=(const Total& other) {
+            value.store(other.value.load(memory_order_relaxed), memory_order_relaxed);
+            return *this;
+        }
+        void add(int64_t delta) { value.fetch_add(delta, memory_order_relaxed); }
+        int64_t load() const { return value.load(memory_order_relaxed); }
+    };
+    
+    int itemCapacity = 0;
+    vector<Total> inDepots;      // per item
+    vector<Total> inBattalions;  // per item
+    vector<Total> regions;       // per depot and item
+    
+public:
+    void reset(int items, int depots) {
+        itemCapacity = items;
+        inDepots.assign(items, Total());
+        inBattalions.assign(items, Total());
+        regions.assign((size_t)depots * items, Total());
+    }
+    
+    // A depot's stock changed by delta
+    void depotChanged(int depot, int itemId, int delta) {
+        inDepots[itemId].add(delta);
+        regions[(size_t)depot * itemCapacity + itemId].add(delta);
+    }
+    
+    // A battalion's holding changed by delta; depot is its supplier, -1 for central
+    void battalionChanged(int depot, int itemId, int delta) {
+        inBattalions[itemId].add(delta);
+        if (depot >= 0) regions[(size_t)depot * itemCapacity + itemId].add(delta);
+    }
+    
+    // A battalion with the given holding moved from one supplier to another
+    void battalionMoved(int fromDepot, int toDepot, int itemId, int holding) {
+        if (fromDepot >= 0) regions[(size_t)fromDepot * itemCapacity + itemId].add(-holding);
+        if (toDepot >= 0) regions[(size_t)toDepot * itemCapacity + itemId].add(holding);
+    }
+    
+    int64_t depotTotal(int itemId) const { return inDepots[itemId].load(); }
+    int64_t battalionTotal(int itemId) const { return inBattalions[itemId].load(); }
+    int64_t regionTotal(int depot, int itemId) const { return regions[(size_t)depot * itemCapacity + itemId].load(); }
+};
+
+// Tick Clock
+// The metrics hot path reads the CPU timestamp counter instead of
+// steady_clock; ticks are converted to nanoseconds only when metrics are read,
+// using the tick rate observed since the clock was created.
+class TickClock {
+private:
+    uint64_t originTicks;
+    chrono::steady_clock::time_point originTime;
+    
+public:
+    TickClock() : originTicks(now()), originTime(chrono::steady_clock::now()) {}
+    
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+    
+    double nanosPerTick() const {
+        double nanos = chrono::duration<double, nano>(chrono::steady_clock::now() - originTime).count();
+        uint64_t ticks = now() - originTicks;
+        return ticks > 0 && nanos > 0 ? nanos / ticks : 1.0;
+    }
+};
+
+// Latency Histogram
+// Log-linear buckets in the style of HdrHistogram: exact below 32, then 32
+// sub-buckets per power of two (about 3% relative error) up to 2^64. Values
+// are nanoseconds or TickClock ticks, depending on the recorder.
+// Each histogram has a single writer; readers may merge it at any time.
+class LatencyHistogram {
+public:
+    static constexpr int kSubBucketBits = 5;
+    static constexpr int kSubBuckets = 1 << kSubBucketBits;
+    static constexpr int kBucketCount = kSubBuckets + (64 - kSubBucketBits) * kSubBuckets;
+    
+private:
+    atomic<uint64_t> counts[kBucketCount];
+    atomic<uint64_t> total{0};
+    atomic<uint64_t> sum{0};
+    
+    static void bump(atomic<uint64_t>& counter, uint64_t delta) {
+        // Single writer, so a plain load/store is enough and avoids a locked RMW
+        counter.store(counter.load(memory_order_relaxed) + delta, memory_order_relaxed);
+    }
+    
+    static int bucketIndex(uint64_t value) {
+        if (value < (uint64_t)kSubBuckets) return (int)value;
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - kSubBucketBits;
+        return kSubBuckets + shift * kSubBuckets + (int)((value >> shift) & (kSubBuckets - 1));
+    }
+    
+    // Midpoint of the values that fall into a bucket
+    static uint64_t bucketValue(int index) {
+        if (index < kSubBuckets) return index;
+        int shift = (index - kSubBuckets) / kSubBuckets;
+        uint64_t lower = (uint64_t)(kSubBuckets + (index - kSubBuckets) % kSubBuckets) << shift;
+        return lower + (((uint64_t)1 << shift) >> 1);
+    }
+    
+public:
+    LatencyHistogram() {
+        for (auto& c : counts) c.store(0, memory_order_relaxed);
+    }
+    
+    void record(uint64_t nanos) {
+        bump(counts[bucketIndex(nanos)], 1);
+        bump(total, 1);
+        bump(sum, nanos);
+    }
+    
+    void record(chrono::steady_clock::duration elapsed) {
+        record((uint64_t)max<int64_t>(0, chrono::duration_cast<chrono::nanoseconds>(elapsed).count()));
+    }
+    
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < kBucketCount; i++) {
+            uint64_t c = other.counts[i].load(memory_order_relaxed);
+            if (c) bump(counts[i], c);
+        }
+        bump(total, other.total.load(memory_order_relaxed));
+        bump(sum, other.sum.load(memory_order_relaxed));
+    }
+    
+    uint64_t count() const { return total.load(memory_order_relaxed); }
+    uint64_t totalNanos() const { return sum.load(memory_order_relaxed); }
+    
+    uint64_t percentile(double p) const {
+        uint64_t n = count();
+        if (n == 0) return 0;
+        uint64_t target = max<uint64_t>(1, (uint64_t)ceil(p * n));
+        uint64_t seen = 0;
+        for (int i = 0; i < kBucketCount; i++) {
+            seen += counts[i].load(memory_order_relaxed);
+            if (seen >= target) return bucketValue(i);
+        }
+        return bucketValue(kBucketCount - 1);
+    }
+};
+
+// Transaction Log Writer
+// Requests only enqueue a fixed-size record into a lock-free MPSC ring;
+// a background thread formats the records and writes them in batches
+// through a file handle that stays open for the writer's lifetime.
+
+// The name pointers are read by the writer thread after the request has
+// returned. They stay valid because catalog names, battalions and depots
+// live in deques, which never move an element once it is added, and none
+// of them is ever removed.
+struct LogRecord {
+    time_t timestamp;
+    const string* item;        // interned catalog name
+    const string* battalion;   // allocation or transfer target, null for soldier requests
+    int quantity;
+    Rank rank;
+    bool returned = false;     // a soldier handing items back in
+    const string* source = nullptr;   // transfer origin, null for everything else
+};
+
+struct LogConfig {
+    string path = "inventory_log.txt";   // empty disables logging
+    size_t ringCapacity = 8192;          // rounded up to a power of two
+    int groupCommitMs = 20;              // batching interval of the writer thread
+    bool fsyncOnCommit = false;          // fsync after every batch
+    uint64_t rotateBytes = 0;            // start a new segment past this size, 0 never rotates
+};
+
+class AsyncLogWriter {
+private:
+    struct Slot {
+        atomic<size_t> sequence;
+        LogRecord record;
+    };
+    
+    unique_ptr<Slot[]> slots;
+    size_t mask = 0;
+    alignas(64) atomic<size_t> enqueuePos{0};
+    alignas(64) size_t dequeuePos = 0;      // writer thread only
+    
+    LogConfig config;
+    int fd = -1;
+    uint64_t segmentBytes = 0;              // size of the current segment
+    int nextSegment = 1;
+    string buffer;                          // reused between batches
+    bool writeFailed = false;               // the last batch could not be written in full
+    static constexpr size_t kMaxPendingBytes = 4 << 20;
+    LatencyHistogram commitLatency;         // written by the writer thread only
+    atomic<bool> running{false};
+    thread writer;
+    
+    void format(const LogRecord& rec) {
+        char dt[32];
+        ctime_r(&rec.timestamp, dt);        // keeps the trailing newline of ctime()
+        buffer += '[';
+        buffer += dt;
+        buffer += "] ";
+        buffer += rankName(rec.rank);
+        buffer += rec.source ? " transferred " : rec.battalion ? " allocated " : rec.returned ? " returned " : " requested ";
+        buffer += *rec.item;
+        buffer += " x";
+        buffer += to_string(rec.quantity);
+        if (rec.source) {
+            buffer += " from ";
+            buffer += *rec.source;
+        }
+        if (rec.battalion) {
+            buffer += " to ";
+            buffer += *rec.battalion;
+        }
+        buffer += '\n';
+    }
+    
+    // Drains everything currently in the ring and commits it in one write
+    void commitBatch() {
+        while (true) {
+            Slot& slot = slots[dequeuePos & mask];
+            if (slot.sequence.load(memory_order_acquire) != dequeuePos + 1) break;
+            format(slot.record);
+            slot.sequence.store(dequeuePos + mask + 1, memory_order_release);
+            dequeuePos++;
+        }
+        if (buffer.empty()) return;
+        
+        auto start = chrono::steady_clock::now();
+        size_t written = 0;
+        int error = 0;
+        while (written < buffer.size()) {
+            ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                error = n < 0 ? errno : EIO;
+                break;
+            }
+            written += n;
+        }
+        if (config.fsyncOnCommit) ::fsync(fd);
+        buffer.erase(0, written);
+        commitLatency.record(chrono::steady_clock::now() - start);
+        
+        // A failed write keeps the rest for the next batch, up to a limit
+        if (error != 0) {
+            if (!writeFailed) cerr << "Warning: cannot write transaction log " << config.path << ": " << strerror(error) << "\n";
+            if (buffer.size() > kMaxPendingBytes) {
+                cerr << "Warning: dropped " << buffer.size() << " bytes of transaction log\n";
+                buffer.clear();
+            }
+        } else if (writeFailed) {
+            cerr << "Transaction log " << config.path << " is writable again\n";
+        }
+        writeFailed = error != 0;
+        
+        segmentBytes += written;
+        if (config.rotateBytes > 0 && segmentBytes >= config.rotateBytes) rotate();
+    }
+    
+    // Moves the full log aside as the next numbered segment and starts afresh
+    void rotate() {
+        while (::access(segmentPath(config.path, nextSegment).c_str(), F_OK) == 0) nextSegment++;
+        if (::rename(config.path.c_str(), segmentPath(config.path, nextSegment).c_str()) != 0) return;
+        int next = ::open(config.path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (next < 0) return;
+        ::close(fd);
+        fd = next;
+        segmentBytes = 0;
+    }
+    
+    void run() {
+        while (running.load(memory_order_acquire)) {
+            commitBatch();
+            this_thread::sleep_for(chrono::milliseconds(config.groupCommitMs));
+        }
+        commitBatch();
+    }
+    
+public:
+    explicit AsyncLogWriter(const LogConfig& cfg) : config(cfg) {
+        if (config.path.empty()) return;
+        fd = ::open(config.path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) return;
+        struct stat st;
+        if (::fstat(fd, &st) == 0) segmentBytes = st.st_size;
+        
+        size_t capacity = 2;
+        while (capacity < config.ringCapacity) capacity <<= 1;
+        slots.reset(new Slot[capacity]);
+        mask = capacity - 1;
+        for (size_t i = 0; i < capacity; i++) {
+            slots[i].sequence.store(i, memory_order_relaxed);
+        }
+        
+        running = true;
+        writer = thread(&AsyncLogWriter::run, this);
+    }
+    
+    AsyncLogWriter(const AsyncLogWriter&) = delete;
+    AsyncLogWriter& operator=(const AsyncLogWriter&) = delete;
+    
+    ~AsyncLogWriter() {
+        if (writer.joinable()) {
+            running = false;
+            writer.join();
+        }
+        if (fd >= 0) ::close(fd);
+    }
+    
+    bool isEnabled() const { return fd >= 0; }
+    const LatencyHistogram& getCommitLatency() const { return commitLatency; }
+    
+    // Rotated segments are numbered upwards from 1, oldest first
+    static string segmentPath(const string& path, int segment) { return path + "." + to_string(segment); }
+    
+    // Safe to call from any number of threads. Blocks (yielding) only
+    // when the ring is full, i.e. the writer is behind by ringCapacity records.
+    void enqueue(const LogRecord& record) {
+        if (fd < 0) return;
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & mask];
+            size_t seq = slot.sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    slot.record = record;
+                    slot.sequence.store(pos + 1, memory_order_release);
+                    return;
+                }
+            } else if (diff < 0) {
+                this_thread::yield();
+                pos = enqueuePos.load(memory_order_relaxed);
+            } else {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+};
+
+// Transaction Journal
+// Fixed-size binary records appended on every state change. Together with
+// the periodic snapshot it is enough to rebuild the inventory after a crash:
+// startup maps the latest snapshot and replays only the journal tail, and the
+// journal is restarted after every snapshot so the tail stays bounded.
+// A Batch record (quantity = number of records that follow) frames the
+// records of one all-or-nothing batch; replay skips a batch cut short by a crash.
+// A Transfer record packs its source and destination Holder into soldier.
+// An Order record packs the ID and due time of a replenishment order into
+// soldier; the Restock record that books its receipt carries the same value.
+enum class JournalOp : uint8_t { Issue = 1, Allocate = 2, Deploy = 3, Restock = 4, Batch = 5, Return = 6, Transfer = 7, Order = 8 };
+
+struct JournalRecord {
+    int64_t timestamp;
+    uint64_t soldier;    // holdings ledger key, 0 when the soldier is not tracked
+    int32_t itemId;
+    int32_t quantity;
+    int16_t battalion;   // -1 when the operation has no battalion
+    uint8_t rank;
+    uint8_t op;
+    uint32_t checksum;
+};
+static_assert(sizeof(JournalRecord) == 32, "journal records must stay fixed-size");
+
+// Battalion indices must fit the 16-bit battalion field of a record
+constexpr int kMaxBattalions = numeric_limits<int16_t>::max() + 1;
+
+struct JournalHeader {
+    char magic[8];
+    uint64_t generation;   // must match the snapshot the journal continues from
+};
+
+constexpr char kJournalMagic[8] = {'M', 'A', 'M', 'S', 'J', 'R', 'N', '2'};
+constexpr char kSnapshotMagic[8] = {'M', 'A', 'M', 'S', 'S', 'N', 'P', '5'};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint64_t generation;
+    uint32_t itemCount;
+    uint32_t battalionCount;
+    uint32_t namesBytes;
+    uint32_t soldierCount;   // holdings ledger records
+    uint32_t depotCount;
+    uint32_t orderCount;     // open replenishment orders
+    uint32_t nextOrderId;
+    uint32_t reserved;
+    // Followed by itemCount x {stock, maxQuantity}, battalionCount x
+    // {soldierCount, depot, holdings[itemCount]}, depotCount x
+    // stock[itemCount], soldierCount ledger records, orderCount
+    // replenishment orders, then the NUL-separated item names, battalion
+    // name/location pairs and depot name/location pairs.
+};
+
+inline uint32_t journalChecksum(const JournalRecord& rec) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&rec);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(JournalRecord, checksum); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+class TransactionJournal {
+private:
+    int fd = -1;
+    string path;
+    bool fsyncEachRecord = false;
+    mutex writeLock;
+    off_t end = 0;              // offset just past the last whole record
+    
+public:
+    TransactionJournal() = default;
+    TransactionJournal(const TransactionJournal&) = delete;
+    TransactionJournal& operator=(const TransactionJournal&) = delete;
+    ~TransactionJournal() { close(); }
+    
+    bool isOpen() const { return fd >= 0; }
+    
+    // Opens the journal for appending. A journal from another generation
+    // (e.g. left behind by a crash during a snapshot) is discarded.
+    bool open(const string& journalPath, uint64_t generation, bool fsyncRecords) {
+        close();
+        path = journalPath;
+        fsyncEachRecord = fsyncRecords;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) return false;
+        
+        JournalHeader header;
+        if (::pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+            memcmp(header.magic, kJournalMagic, sizeof(kJournalMagic)) != 0 ||
+            header.generation != generation) {
+            return restart(generation);
+        }
+        
+        // Cut the file back to what replay accepts: a torn record, a batch
+        // cut short or anything after a corrupt record would otherwise
+        // swallow or hide the records appended from now on
+        struct stat st;
+        if (::lseek(fd, sizeof(JournalHeader), SEEK_SET) < 0 || ::fstat(fd, &st) != 0) return false;
+        scan(fd, [](const JournalRecord&) {}, end);
+        if (end < st.st_size && ::ftruncate(fd, end) != 0) return false;
+        return true;
+    }
+    
+    // Empties the journal and starts a new generation
+    bool restart(uint64_t generation) {
+        if (fd < 0) return false;
+        if (::ftruncate(fd, 0) != 0) return false;
+        JournalHeader header;
+        memcpy(header.magic, kJournalMagic, sizeof(kJournalMagic));
+        header.generation = generation;
+        end = 0;
+        if (!writeAll(&header, sizeof(header))) return false;
+        ::fsync(fd);
+        return true;
+    }
+    
+    // Returns false, with errno set, if the record could not be written
+    bool append(JournalRecord rec) {
+        if (fd < 0) return true;
+        rec.checksum = journalChecksum(rec);
+        lock_guard<mutex> guard(writeLock);
+        if (!writeAll(&rec, sizeof(rec))) return false;
+        if (fsyncEachRecord) ::fdatasync(fd);
+        return true;
+    }
+    
+    // Appends a whole batch, including its Batch framing record, in one write
+    bool appendBatch(vector<JournalRecord>& records) {
+        if (fd < 0 || records.empty()) return true;
+        for (auto& rec : records) rec.checksum = journalChecksum(rec);
+        lock_guard<mutex> guard(writeLock);
+        if (!writeAll(records.data(), records.size() * sizeof(JournalRecord))) return false;
+        if (fsyncEachRecord) ::fdatasync(fd);
+        return true;
+    }
+    
+    void close() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+    
+    // Calls apply for every intact record of the given generation, stopping
+    // at the first torn or corrupt record. Returns the number of records.
+    template <typename Apply>
+    static uint64_t replay(const string& journalPath, uint64_t generation, Apply apply) {
+        int in = ::open(journalPath.c_str(), O_RDONLY);
+        if (in < 0) return 0;
+        
+        uint64_t count = 0;
+        JournalHeader header;
+        if (::read(in, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+            memcmp(header.magic, kJournalMagic, sizeof(kJournalMagic)) == 0 &&
+            header.generation == generation) {
+            off_t end;
+            count = scan(in, apply, end);
+        }
+        ::close(in);
+        return count;
+    }
+    
+private:
+    // Writes through interrupted and short writes. On failure the file is
+    // cut back to the last whole record, so a torn record cannot misalign
+    // everything appended after it.
+    bool writeAll(const void* data, size_t bytes) {
+        const char* next = static_cast<const char*>(data);
+        size_t written = 0;
+        while (written < bytes) {
+            ssize_t n = ::write(fd, next + written, bytes - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                int error = n < 0 ? errno : EIO;
+                if (written > 0 && ::ftruncate(fd, end) != 0) {
+                    cerr << "Warning: cannot cut journal " << path << " back to its last record: " << strerror(errno) << "\n";
+                }
+                errno = error;
+                return false;
+            }
+            written += n;
+        }
+        end += bytes;
+        return true;
+    }
+    
+    // Reads records from the current offset up to the first torn or corrupt
+    // one and applies each standalone record and each complete batch. end is
+    // set to the file offset just past the last record applied, so a torn
+    // batch or anything after a corrupt record lies beyond it.
+    template <typename Apply>
+    static uint64_t scan(int in, Apply apply, off_t& end) {
+        end = (off_t)sizeof(JournalHeader);
+        off_t offset = end;
+        uint64_t count = 0;
+        vector<JournalRecord> chunk(4096);
+        vector<JournalRecord> pendingBatch;
+        size_t batchRemaining = 0;
+        bool intact = true;
+        while (intact) {
+            ssize_t n = ::read(in, chunk.data(), chunk.size() * sizeof(JournalRecord));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            size_t records = n / sizeof(JournalRecord);
+            for (size_t i = 0; i < records; i++) {
+                if (chunk[i].checksum != journalChecksum(chunk[i])) {
+                    intact = false;
+                    break;
+                }
+                count++;
+                offset += sizeof(JournalRecord);
+                if ((JournalOp)chunk[i].op == JournalOp::Batch) {
+                    pendingBatch.clear();
+                    batchRemaining = chunk[i].quantity;
+                    if (batchRemaining == 0) end = offset;
+                } else if (batchRemaining > 0) {
+                    pendingBatch.push_back(chunk[i]);
+                    if (--batchRemaining == 0) {
+                        for (auto& rec : pendingBatch) apply(rec);
+                        end = offset;
+                    }
+                } else {
+                    apply(chunk[i]);
+                    end = offset;
+                }
+            }
+            if (n % sizeof(JournalRecord) != 0) break;
+        }
+        return count;
+    }
+};
+
+// Stock History
+// Past stock levels of every holder, for point-in-time queries. The history
+// is a chain of checkpoints, each followed by the stock changes made until
+// the next one. A checkpoint stores only the cells (holder, item) whose
+// stock moved since the checkpoint before it; a key checkpoint, which lists
+// every nonzero cell, is stored instead of a diff whenever the diffs since
+// the last key would otherwise outgrow it. Cells and changes are
+// varint-encoded, so a change costs a few bytes and the checkpoints grow
+// with what moved, not with the size of the inventory. A query decodes the
+// nearest key checkpoint, diffs no larger than it in total and at most
+// kCheckpointRecords journal records of changes.
+// The journal feeds the history: when a snapshot retires a journal
+// generation, its records are folded into checkpoints and appended to the
+// history file as one frame, so requests never touch the history. A frame
+// newer than the snapshot found at startup belongs to a snapshot that never
+// landed and is cut off; its journal is folded again by the next snapshot.
+// Changes since the last snapshot are read from the live journal.
+//
+//   HistoryHeader | HistoryFrame + payload per snapshot
+//   payload: changes since the last checkpoint, then per checkpoint
+//            {time, key, diff bytes, diff, change bytes, changes}
+constexpr char kHistoryMagic[8] = {'M', 'A', 'M', 'S', 'H', 'S', 'T', '1'};
+
+struct HistoryHeader {
+    char magic[8];
+};
+
+struct HistoryFrame {
+    uint32_t bytes;        // payload length
+    uint32_t checksum;     // FNV-1a of the payload
+    uint64_t generation;   // snapshot generation the frame leads up to
+};
+
+class StockHistory {
+public:
+    static constexpr int kCheckpointRecords = 4096;   // journal records between checkpoints
+    
+private:
+    struct Checkpoint {
+        int64_t time;
+        bool key;
+        string diff;       // {holder, item, change} per cell, or {holder, item, stock} for a key
+        string changes;    // {seconds since the previous change, from, to, item, quantity}
+    };
+    
+    typedef vector<pair<uint64_t, int>> Cells;   // sorted by cellKey, no zero entries
+    
+    int fd = -1;
+    off_t fileSize = 0;
+    vector<Checkpoint> checkpoints;
+    Cells lastState;             // stock at the newest checkpoint
+    size_t keyBytes = 0;         // size of the newest key checkpoint
+    size_t diffBytes = 0;        // diffs stored since it
+    size_t totalBytes = 0;
+    
+    // A fold waiting for its snapshot to land
+    string pending;
+    Cells pendingState;
+    size_t pendingKeyBytes = 0, pendingDiffBytes = 0;
+    bool pendingAny = false;     // the fold has written a checkpoint
+    off_t pendingOffset = -1;
+    
+    struct Cursor {
+        const unsigned char* p;
+        const unsigned char* end;
+        bool ok = true;
+        
+        Cursor(const string& bytes, size_t offset = 0)
+            : p((const unsigned char*)bytes.data() + offset), end((const unsigned char*)bytes.data() + bytes.size()) {}
+        
+        bool done() const { return p >= end || !ok; }
+        
+        uint64_t next() {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                if (p >= end) break;
+                unsigned char byte = *p++;
+                value |= (uint64_t)(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) return value;
+            }
+            ok = false;
+            return 0;
+        }
+        
+        int64_t nextSigned() {
+            uint64_t value = next();
+            return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+        }
+        
+        // Reads a length-prefixed block
+        bool block(string& out) {
+            uint64_t length = next();
+            if (!ok || length > (uint64_t)(end - p)) return ok = false;
+            out.assign((const char*)p, length);
+            p += length;
+            return true;
+        }
+    };
+    
+    static void putVarint(string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out += (char)(value | 0x80);
+            value >>= 7;
+        }
+        out += (char)value;
+    }
+    
+    static void putSigned(string& out, int64_t value) {
+        putVarint(out, (uint64_t)value << 1 ^ (uint64_t)(value >> 63));
+    }
+    
+    static void putBlock(string& out, const string& bytes) {
+        putVarint(out, bytes.size());
+        out += bytes;
+    }
+    
+    static uint32_t checksum(const string& bytes) {
+        uint32_t hash = 2166136261u;
+        for (unsigned char c : bytes) hash = (hash ^ c) * 16777619u;
+        return hash;
+    }
+    
+    // Applies a sorted diff to a state; cells that reach zero are dropped
+    static Cells merge(const Cells& state, const Cells& diff) {
+        Cells result;
+        result.reserve(state.size() + diff.size());
+        size_t i = 0, j = 0;
+        while (i < state.size() || j < diff.size()) {
+            if (j == diff.size() || (i < state.size() && state[i].first < diff[j].first)) {
+                result.push_back(state[i++]);
+            } else if (i == state.size() || diff[j].first < state[i].first) {
+                result.push_back(diff[j++]);
+            } else {
+                int value = state[i++].second + diff[j++].second;
+                if (value != 0) result.push_back({state[i - 1].first, value});
+            }
+        }
+        return result;
+    }
+    
+    // Cells go out in key order as {holder gap, item, amount}; within one
+    // holder the item is written as the gap from the previous item
+    static string encode(const Cells& cells) {
+        string encoded;
+        uint32_t lastHolder = 0, lastItem = 0;
+        for (auto& cell : cells) {
+            uint32_t holder = (uint32_t)(cell.first >> 32), item = (uint32_t)cell.first;
+            putVarint(encoded, holder - lastHolder);
+            putVarint(encoded, holder == lastHolder ? item - lastItem : item);
+            putSigned(encoded, cell.second);
+            lastHolder = holder;
+            lastItem = item;
+        }
+        return encoded;
+    }
+    
+    // Appends a checkpoint to the pending frame and moves pendingState on
+    void putCheckpoint(int64_t time, const Cells& diff) {
+        pendingState = merge(pendingState, diff);
+        string encoded = encode(diff);
+        bool key = (checkpoints.empty() && !pendingAny) || pendingDiffBytes + encoded.size() > pendingKeyBytes;
+        if (key) {
+            encoded = encode(pendingState);
+            pendingKeyBytes = encoded.size();
+            pendingDiffBytes = 0;
+        } else {
+            pendingDiffBytes += encoded.size();
+        }
+        pendingAny = true;
+        putVarint(pending, time);
+        pending += (char)key;
+        putBlock(pending, encoded);
+    }
+    
+    // Adds the checkpoints of one frame, or nothing if it does not parse.
+    // The leading changes belong to the newest checkpoint already in memory.
+    bool parseFrame(const string& payload) {
+        Cursor in(payload);
+        string changes;
+        vector<Checkpoint> added;
+        if (!in.block(changes)) return false;
+        while (!in.done()) {
+            Checkpoint checkpoint;
+            checkpoint.time = (int64_t)in.next();
+            if (in.p >= in.end) return false;
+            checkpoint.key = *in.p++ != 0;
+            if (!in.block(checkpoint.diff) || !in.block(checkpoint.changes)) return false;
+            added.push_back(move(checkpoint));
+        }
+        if (!in.ok || (checkpoints.empty() && !added.empty() && !added[0].key)) return false;
+        
+        if (!checkpoints.empty()) {
+            checkpoints.back().changes += changes;
+            totalBytes += changes.size();
+        }
+        for (Checkpoint& checkpoint : added) {
+            if (!checkpoints.empty()) checkpoint.time = max(checkpoint.time, checkpoints.back().time);
+            totalBytes += checkpoint.diff.size() + checkpoint.changes.size();
+            checkpoints.push_back(move(checkpoint));
+        }
+        return true;
+    }
+    
+    // Calls visit(cell, amount) with the contributions that sum to the stock
+    // of every cell at checkpoint index
+    template <typename Visit>
+    void visitCheckpoint(size_t index, Visit visit) const {
+        size_t key = index;
+        while (!checkpoints[key].key) key--;
+        for (size_t c = key; c <= index; c++) {
+            Cursor in(checkpoints[c].diff);
+            uint32_t holder = 0, item = 0;
+            while (!in.done()) {
+                uint32_t gap = (uint32_t)in.next();
+                item = gap == 0 ? item + (uint32_t)in.next() : (uint32_t)in.next();
+                holder += gap;
+                int amount = (int)in.nextSigned();
+                if (in.ok) visit((uint64_t)holder << 32 | item, amount);
+            }
+        }
+    }
+    
+    // Rebuilds lastState and the key and diff sizes from the checkpoints
+    void restoreState() {
+        unordered_map<uint64_t, int> state;
+        if (!checkpoints.empty()) {
+            visitCheckpoint(checkpoints.size() - 1, [&](uint64_t cell, int amount) { state[cell] += amount; });
+        }
+        lastState.clear();
+        for (auto& cell : state) {
+            if (cell.second != 0) lastState.push_back(cell);
+        }
+        sort(lastState.begin(), lastState.end());
+        keyBytes = diffBytes = 0;
+        for (const Checkpoint& checkpoint : checkpoints) {
+            if (checkpoint.key) keyBytes = checkpoint.diff.size();
+            diffBytes = checkpoint.key ? 0 : diffBytes + checkpoint.diff.size();
+        }
+    }
+    
+public:
+    StockHistory() = default;
+    StockHistory(const StockHistory&) = delete;
+    StockHistory& operator=(const StockHistory&) = delete;
+    ~StockHistory() { close(); }
+    
+    // Holders are coded as index << 2 | kind; code 3 stands for stock
+    // entering or leaving the army through issues, returns and restocks
+    static constexpr uint32_t kCentral = 0, kOutside = 3;
+    
+    static uint32_t holderCode(Holder holder) { return (uint32_t)holder.index << 2 | (uint32_t)holder.kind; }
+    
+    static uint64_t cellKey(Holder holder, int itemId) {
+        return (uint64_t)holderCode(holder) << 32 | (uint32_t)itemId;
+    }
+    
+    static Holder cellHolder(uint64_t cell) {
+        uint32_t holder = (uint32_t)(cell >> 32);
+        return {(HolderKind)(holder & 3), (int)(holder >> 2)};
+    }
+    
+    static int cellItem(uint64_t cell) { return (int)(uint32_t)cell; }
+    
+    // Calls transfer(from, to, itemId, quantity) with the holder codes a
+    // journal record moves stock between
+    template <typename Transfer>
+    static void forEachMove(const JournalRecord& rec, Transfer transfer) {
+        switch ((JournalOp)rec.op) {
+            case JournalOp::Issue:
+                transfer(kCentral, kOutside, rec.itemId, rec.quantity);
+                break;
+            case JournalOp::Return:
+            case JournalOp::Restock:
+                transfer(kOutside, kCentral, rec.itemId, rec.quantity);
+                break;
+            case JournalOp::Allocate:
+                if (rec.battalion >= 0) transfer(kCentral, holderCode({HolderKind::Battalion, rec.battalion}), rec.itemId, rec.quantity);
+                break;
+            case JournalOp::Transfer:
+                transfer(holderCode(Holder::unpack(rec.soldier >> 32)), holderCode(Holder::unpack((uint32_t)rec.soldier)),
+                         rec.itemId, rec.quantity);
+                break;
+            default:
+                break;
+        }
+    }
+    
+    // Calls visit(cell, amount) for both ends of a move
+    template <typename Visit>
+    static void applyMove(uint32_t from, uint32_t to, int itemId, int quantity, Visit visit) {
+        if (from != kOutside) visit((uint64_t)from << 32 | (uint32_t)itemId, -quantity);
+        if (to != kOutside) visit((uint64_t)to << 32 | (uint32_t)itemId, quantity);
+    }
+    
+    // Parses a point in time: seconds since the epoch, YYYY-MM-DD (the end
+    // of that day) or YYYY-MM-DD HH:MM[:SS] with T or a space, in local time
+    static bool parseTime(const string& text, int64_t& when) {
+        if (!text.empty() && text.size() <= 12 && all_of(text.begin(), text.end(), [](char c) { return isdigit((unsigned char)c); })) {
+            when = stoll(text);
+            return true;
+        }
+        struct tm parts;
+        memset(&parts, 0, sizeof(parts));
+        int year, month, day, hour = 23, minute = 59, second = 59, length = 0, more = 0;
+        if (sscanf(text.c_str(), "%4d-%2d-%2d%n", &year, &month, &day, &length) != 3) return false;
+        if (length < (int)text.size()) {
+            second = 0;
+            if ((text[length] != 'T' && text[length] != ' ') ||
+                sscanf(text.c_str() + length + 1, "%2d:%2d%n", &hour, &minute, &more) != 2) return false;
+            length += 1 + more;
+            if (length < (int)text.size() &&
+                (sscanf(text.c_str() + length, ":%2d%n", &second, &more) != 1 || length + more != (int)text.size())) return false;
+        }
+        if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) return false;
+        parts.tm_year = year - 1900;
+        parts.tm_mon = month - 1;
+        parts.tm_mday = day;
+        parts.tm_hour = hour;
+        parts.tm_min = minute;
+        parts.tm_sec = second;
+        parts.tm_isdst = -1;
+        time_t local = mktime(&parts);
+        if (local == (time_t)-1) return false;
+        when = local;
+        return true;
+    }
+    
+    static string formatTime(int64_t when) {
+        time_t seconds = (time_t)when;
+        struct tm parts;
+        char text[32];
+        localtime_r(&seconds, &parts);
+        strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &parts);
+        return text;
+    }
+    
+    bool isOpen() const { return fd >= 0; }
+    bool empty() const { return checkpoints.empty(); }
+    size_t getCheckpointCount() const { return checkpoints.size(); }
+    size_t getBytes() const { return totalBytes; }
+    int64_t getStart() const { return checkpoints.empty() ? 0 : checkpoints.front().time; }
+    
+    // Loads the frames up to the given snapshot generation. A writable
+    // history drops anything after them, including a torn last frame.
+    bool open(const string& path, uint64_t generation, bool writable) {
+        close();
+        fd = ::open(path.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+        if (fd < 0) return false;
+        
+        struct stat st;
+        string file;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            file.resize(st.st_size);
+            if (::pread(fd, &file[0], file.size(), 0) != (ssize_t)file.size()) {
+                close();
+                return false;
+            }
+        }
+        size_t offset = 0;
+        if (file.size() >= sizeof(HistoryHeader) && memcmp(file.data(), kHistoryMagic, sizeof(kHistoryMagic)) == 0) {
+            offset = sizeof(HistoryHeader);
+            while (offset + sizeof(HistoryFrame) <= file.size()) {
+                HistoryFrame frame;
+                memcpy(&frame, file.data() + offset, sizeof(frame));
+                size_t end = offset + sizeof(frame) + frame.bytes;
+                if (frame.generation > generation || end > file.size()) break;
+                string payload = file.substr(offset + sizeof(frame), frame.bytes);
+                if (checksum(payload) != frame.checksum) break;
+                if (!parseFrame(payload)) break;
+                offset = end;
+            }
+        }
+        restoreState();
+        
+        fileSize = offset;
+        if (!writable) return true;
+        if (offset == 0) {
+            HistoryHeader header;
+            memcpy(header.magic, kHistoryMagic, sizeof(kHistoryMagic));
+            if (::ftruncate(fd, 0) != 0 || ::pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+                close();
+                return false;
+            }
+            fileSize = sizeof(header);
+        } else if ((off_t)file.size() > fileSize && ::ftruncate(fd, fileSize) != 0) {
+            close();
+            return false;
+        }
+        return true;
+    }
+    
+    void close() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+    
+    // Folds the records of a retired journal generation into checkpoints,
+    // ending in live, the stock of every cell at the moment of the fold, and
+    // appends them to the file as one frame. Nothing changes in memory until
+    // commit(); rollback() takes the frame back out of the file. Without a
+    // checkpoint to build on, the records are dropped and live becomes the
+    // first key checkpoint.
+    bool fold(const vector<JournalRecord>& records, Cells live, int64_t now, uint64_t generation) {
+        pending.clear();
+        pendingState = lastState;
+        pendingKeyBytes = keyBytes;
+        pendingDiffBytes = diffBytes;
+        pendingAny = false;
+        int64_t last = checkpoints.empty() ? 0 : checkpoints.back().time;
+        
+        string changes;
+        int64_t changeTime = last;
+        unordered_map<uint64_t, int> moved;
+        Cells diff;
+        for (size_t r = 0; r < records.size() && !checkpoints.empty(); r++) {
+            forEachMove(records[r], [&](uint32_t from, uint32_t to, int itemId, int quantity) {
+                putSigned(changes, records[r].timestamp - changeTime);
+                putVarint(changes, from);
+                putVarint(changes, to);
+                putVarint(changes, (uint32_t)itemId);
+                putSigned(changes, quantity);
+                changeTime = records[r].timestamp;
+                applyMove(from, to, itemId, quantity, [&](uint64_t cell, int amount) { moved[cell] += amount; });
+            });
+            if ((r + 1) % kCheckpointRecords != 0) continue;
+            
+            diff.clear();
+            for (auto& cell : moved) {
+                if (cell.second != 0) diff.push_back(cell);
+            }
+            sort(diff.begin(), diff.end());
+            moved.clear();
+            putBlock(pending, changes);
+            changes.clear();
+            last = max(last, records[r].timestamp);
+            putCheckpoint(last, diff);
+            changeTime = last;
+        }
+        putBlock(pending, changes);
+        
+        // The last checkpoint is the live stock, which also covers what the
+        // journal does not record, such as the opening stock of new items
+        sort(live.begin(), live.end());
+        Cells removed = pendingState;
+        for (auto& cell : removed) cell.second = -cell.second;
+        putCheckpoint(max(last, now), merge(removed, live));
+        putBlock(pending, string());
+        
+        if (fd < 0) return true;
+        HistoryFrame frame = {(uint32_t)pending.size(), checksum(pending), generation};
+        string bytes((const char*)&frame, sizeof(frame));
+        bytes += pending;
+        // A frame cut short is overwritten by the next one, or cut off at startup
+        if (::pwrite(fd, bytes.data(), bytes.size(), fileSize) != (ssize_t)bytes.size() || ::fsync(fd) != 0) return false;
+        pendingOffset = fileSize;
+        fileSize += bytes.size();
+        return true;
+    }
+    
+    void commit() {
+        parseFrame(pending);
+        lastState.swap(pendingState);
+        keyBytes = pendingKeyBytes;
+        diffBytes = pendingDiffBytes;
+        pending.clear();
+        pendingState.clear();
+        pendingOffset = -1;
+    }
+    
+    void rollback() {
+        // Should the truncate fail, the next frame overwrites this one
+        if (fd >= 0 && pendingOffset >= 0) {
+            ::ftruncate(fd, pendingOffset);
+            fileSize = pendingOffset;
+        }
+        pending.clear();
+        pendingState.clear();
+        pendingOffset = -1;
+    }
+    
+    // Calls visit(holder, itemId, amount) with contributions that sum, per
+    // holder and item, to the stock held at the end of second when. Past the
+    // last checkpoint the changes come from the live journal. Returns false
+    // if when lies before the first checkpoint.
+    template <typename Visit>
+    bool visitAt(int64_t when, const string& journalPath, uint64_t generation, Visit visit) const {
+        auto after = upper_bound(checkpoints.begin(), checkpoints.end(), when,
+                                 [](int64_t time, const Checkpoint& checkpoint) { return time < checkpoint.time; });
+        if (after == checkpoints.begin()) return false;
+        size_t index = after - checkpoints.begin() - 1;
+        
+        auto forward = [&](uint64_t cell, int amount) { visit(cellHolder(cell), cellItem(cell), amount); };
+        visitCheckpoint(index, forward);
+        Cursor in(checkpoints[index].changes);
+        int64_t time = checkpoints[index].time;
+        while (!in.done()) {
+            time += in.nextSigned();
+            uint32_t from = (uint32_t)in.next(), to = (uint32_t)in.next(), itemId = (uint32_t)in.next();
+            int quantity = (int)in.nextSigned();
+            if (!in.ok || time > when) break;
+            applyMove(from, to, itemId, quantity, forward);
+        }
+        if (index + 1 == checkpoints.size() && !journalPath.empty()) {
+            TransactionJournal::replay(journalPath, generation, [&](const JournalRecord& rec) {
+                if (rec.timestamp > when) return;
+                forEachMove(rec, [&](uint32_t from, uint32_t to, int itemId, int quantity) { applyMove(from, to, itemId, quantity, forward); });
+            });
+        }
+        return true;
+    }
+};
+
+// State Store
+// Central stock, capacities, battalion and depot rows in one fixed layout:
+//
+//   StoreHeader | itemCapacity x PaddedCounter stock | itemCapacity x int32 max
+//   | battalionCapacity x {soldiers, depot, holdings[itemCapacity]}
+//   | depotCapacity x stock[itemCapacity] | names
+//
+// The counters are used in place. A store backed by a file is mapped
+// shared, so startup only maps it and other processes can watch the live
+// state read-only; without a file the same layout lives in anonymous
+// memory. Names are appended as 'I' item / 'B' battalion / 'D' depot records, and the
+// counts in the header are published after the data they cover. When a
+// capacity runs out the store is laid out anew at double size; a file
+// store is rebuilt beside the old file, renamed over it, and the old
+// mapping is flagged superseded so readers know to map the file again.
+struct StoreHeader {
+    char magic[8];
+    uint32_t itemCapacity;
+    uint32_t battalionCapacity;
+    uint32_t namesCapacity;
+    uint32_t itemCount;
+    uint32_t battalionCount;
+    uint32_t namesBytes;
+    uint32_t superseded;
+    uint32_t depotCapacity;
+    uint32_t depotCount;
+    uint32_t reserved[5];
+};
+static_assert(sizeof(StoreHeader) == 64, "store header fills one cache line");
+static_assert(sizeof(AtomicCounter) == sizeof(int32_t) && atomic<int>::is_always_lock_free,
+              "counters must be usable in place in shared memory");
+
+constexpr char kStoreMagic[8] = {'M', 'A', 'M', 'S', 'S', 'T', 'O', '2'};
+
+enum class StoreGrowth { Fits, Moved, Failed };
+
+class StateStore {
+private:
+    string path;            // empty for an anonymous store
+    int fd = -1;
+    char* base = nullptr;
+    size_t bytes = 0;
+    StoreHeader* header = nullptr;
+    
+    static size_t rowsOffset(uint32_t items) {
+        size_t offset = sizeof(StoreHeader) + (size_t)items * (sizeof(PaddedCounter) + sizeof(int32_t));
+        return (offset + 63) & ~(size_t)63;
+    }
+    
+    static size_t layoutBytes(uint32_t items, uint32_t battalions, uint32_t depots, uint32_t names) {
+        return rowsOffset(items) + ((size_t)battalions * (kBattalionRowHeader + items) + (size_t)depots * items) * sizeof(int32_t) + names;
+    }
+    
+    size_t depotsOffset() const {
+        return rowsOffset(header->itemCapacity) +
+               (size_t)header->battalionCapacity * (kBattalionRowHeader + header->itemCapacity) * sizeof(int32_t);
+    }
+    
+    size_t namesOffset() const {
+        return depotsOffset() + (size_t)header->depotCapacity * header->itemCapacity * sizeof(int32_t);
+    }
+    
+    bool map(bool writable) {
+        int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        void* mapped = fd >= 0 ? ::mmap(nullptr, bytes, protection, MAP_SHARED, fd, 0)
+                               : ::mmap(nullptr, bytes, protection, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED) return false;
+        base = static_cast<char*>(mapped);
+        header = reinterpret_cast<StoreHeader*>(base);
+        return true;
+    }
+    
+    void appendName(char kind, const string& first, const string* second) {
+        char* names = base + namesOffset() + header->namesBytes;
+        names[0] = kind;
+        memcpy(names + 1, first.c_str(), first.size() + 1);
+        size_t used = first.size() + 2;
+        if (second) {
+            memcpy(names + used, second->c_str(), second->size() + 1);
+            used += second->size() + 1;
+        }
+        __atomic_store_n(&header->namesBytes, header->namesBytes + (uint32_t)used, __ATOMIC_RELEASE);
+    }
+    
+    // Copies the live contents into a store with larger capacities
+    void copyInto(StateStore& next) const {
+        uint32_t items = header->itemCount;
+        PaddedCounter* toStock = next.stock();
+        for (uint32_t id = 0; id < items; id++) {
+            toStock[id].store(stock()[id].load());
+            next.maxQuantities()[id] = maxQuantities()[id];
+        }
+        for (uint32_t b = 0; b < header->battalionCount; b++) {
+            const AtomicCounter* from = battalionRow(b);
+            AtomicCounter* to = next.battalionRow(b);
+            for (uint32_t i = 0; i < kBattalionRowHeader + items; i++) to[i].store(from[i].load());
+        }
+        for (uint32_t d = 0; d < header->depotCount; d++) {
+            const AtomicCounter* from = depotRow(d);
+            AtomicCounter* to = next.depotRow(d);
+            for (uint32_t i = 0; i < items; i++) to[i].store(from[i].load());
+        }
+        memcpy(next.base + next.namesOffset(), base + namesOffset(), header->namesBytes);
+        next.header->namesBytes = header->namesBytes;
+        next.header->itemCount = items;
+        next.header->battalionCount = header->battalionCount;
+        next.header->depotCount = header->depotCount;
+    }
+    
+public:
+    StateStore() = default;
+    StateStore(const StateStore&) = delete;
+    StateStore& operator=(const StateStore&) = delete;
+    ~StateStore() { close(); }
+    
+    void swap(StateStore& other) {
+        std::swap(path, other.path);
+        std::swap(fd, other.fd);
+        std::swap(base, other.base);
+        std::swap(bytes, other.bytes);
+        std::swap(header, other.header);
+    }
+    
+    // Creates an empty store, in anonymous memory when storePath is empty.
+    // An existing file at storePath is replaced.
+    bool create(const string& storePath, uint32_t items, uint32_t battalions, uint32_t depots, uint32_t names) {
+        close();
+        path = storePath;
+        bytes = layoutBytes(items, battalions, depots, names);
+        if (!path.empty()) {
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0 || ::flock(fd, LOCK_EX | LOCK_NB) != 0 || ::ftruncate(fd, bytes) != 0) {
+                close();
+                return false;
+            }
+        }
+        if (!map(true)) {
+            close();
+            return false;
+        }
+        memcpy(header->magic, kStoreMagic, sizeof(kStoreMagic));
+        header->itemCapacity = items;
+        header->battalionCapacity = battalions;
+        header->depotCapacity = depots;
+        header->namesCapacity = names;
+        return true;
+    }
+    
+    // Maps an existing store file. A writer takes an exclusive lock, so only
+    // one process can update a store; readers may be any number.
+    bool open(const string& storePath, bool writable) {
+        close();
+        path = storePath;
+        fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+        struct stat st;
+        if (fd < 0 || (writable && ::flock(fd, LOCK_EX | LOCK_NB) != 0) ||
+            ::fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(StoreHeader)) {
+            close();
+            return false;
+        }
+        bytes = st.st_size;
+        if (!map(writable)) {
+            close();
+            return false;
+        }
+        bool valid = memcmp(header->magic, kStoreMagic, sizeof(kStoreMagic)) == 0 &&
+                     layoutBytes(header->itemCapacity, header->battalionCapacity, header->depotCapacity,
+                                 header->namesCapacity) <= bytes &&
+                     header->itemCount <= header->itemCapacity &&
+                     header->battalionCount <= header->battalionCapacity &&
+                     header->depotCount <= header->depotCapacity &&
+                     header->namesBytes <= header->namesCapacity;
+        if (!valid) close();
+        return valid;
+    }
+    
+    void close() {
+        if (base) ::munmap(base, bytes);
+        if (fd >= 0) ::close(fd);
+        base = nullptr;
+        header = nullptr;
+        fd = -1;
+    }
+    
+    bool isOpen() const { return base != nullptr; }
+    bool isFileBacked() const { return fd >= 0; }
+    bool isSuperseded() const { return __atomic_load_n(&header->superseded, __ATOMIC_ACQUIRE) != 0; }
+    
+    uint32_t getItemCount() const { return __atomic_load_n(&header->itemCount, __ATOMIC_ACQUIRE); }
+    uint32_t getBattalionCount() const { return __atomic_load_n(&header->battalionCount, __ATOMIC_ACQUIRE); }
+    uint32_t getDepotCount() const { return __atomic_load_n(&header->depotCount, __ATOMIC_ACQUIRE); }
+    uint32_t getItemCapacity() const { return header->itemCapacity; }
+    uint32_t getDepotCapacity() const { return header->depotCapacity; }
+    
+    PaddedCounter* stock() const { return reinterpret_cast<PaddedCounter*>(base + sizeof(StoreHeader)); }
+    int32_t* maxQuantities() const {
+        return reinterpret_cast<int32_t*>(base + sizeof(StoreHeader) + (size_t)header->itemCapacity * sizeof(PaddedCounter));
+    }
+    AtomicCounter* battalionRow(uint32_t battalion) const {
+        return reinterpret_cast<AtomicCounter*>(base + rowsOffset(header->itemCapacity)) +
+               (size_t)battalion * (kBattalionRowHeader + header->itemCapacity);
+    }
+    AtomicCounter* depotRow(uint32_t depot) const {
+        return reinterpret_cast<AtomicCounter*>(base + depotsOffset()) + (size_t)depot * header->itemCapacity;
+    }
+    
+    // Makes room for the given number of items, battalions, depots and
+    // further name bytes. Moved means the store was laid out anew, which
+    // moves every table. Failed means a file could not be rebuilt; the
+    // store is left as it was and still holds every change made so far.
+    StoreGrowth reserve(uint32_t items, uint32_t battalions, uint32_t depots, size_t moreNames) {
+        uint32_t names = header->namesBytes + (uint32_t)moreNames;
+        if (items <= header->itemCapacity && battalions <= header->battalionCapacity &&
+            depots <= header->depotCapacity && names <= header->namesCapacity) {
+            return StoreGrowth::Fits;
+        }
+        auto grown = [](uint32_t wanted, uint32_t capacity) { return max(wanted, capacity * (wanted > capacity ? 2 : 1)); };
+        uint32_t newItems = grown(items, header->itemCapacity);
+        uint32_t newBattalions = grown(battalions, header->battalionCapacity);
+        uint32_t newDepots = grown(depots, header->depotCapacity);
+        uint32_t newNames = grown(names, header->namesCapacity);
+        
+        StateStore next;
+        string tmpPath = path.empty() ? "" : path + ".tmp";
+        if (!next.create(tmpPath, newItems, newBattalions, newDepots, newNames)) {
+            cerr << "Cannot grow state store " << path << "\n";
+            return StoreGrowth::Failed;
+        }
+        copyInto(next);
+        if (next.isFileBacked()) {
+            if (::msync(next.base, next.bytes, MS_SYNC) == 0 && ::rename(tmpPath.c_str(), path.c_str()) == 0) {
+                next.path = path;
+            } else {
+                cerr << "Cannot replace state store " << path << "\n";
+                ::unlink(tmpPath.c_str());
+                return StoreGrowth::Failed;
+            }
+        }
+        __atomic_store_n(&header->superseded, 1u, __ATOMIC_RELEASE);
+        swap(next);
+        return StoreGrowth::Moved;
+    }
+    
+    // Publishes a new item or battalion; reserve() must have made room.
+    // Its counters start at zero.
+    int addItem(const string& name) {
+        appendName('I', name, nullptr);
+        __atomic_store_n(&header->itemCount, header->itemCount + 1, __ATOMIC_RELEASE);
+        return header->itemCount - 1;
+    }
+    
+    int addBattalion(const string& name, const string& location) {
+        appendName('B', name, &location);
+        __atomic_store_n(&header->battalionCount, header->battalionCount + 1, __ATOMIC_RELEASE);
+        return header->battalionCount - 1;
+    }
+    
+    int addDepot(const string& name, const string& location) {
+        appendName('D', name, &location);
+        __atomic_store_n(&header->depotCount, header->depotCount + 1, __ATOMIC_RELEASE);
+        return header->depotCount - 1;
+    }
+    
+    static size_t nameBytes(const string& first, const string* second = nullptr) {
+        return first.size() + 2 + (second ? second->size() + 1 : 0);
+    }
+    
+    // Calls item(name), battalion(name, location) and depot(name, location)
+    // in the order they were added
+    template <typename Item, typename BattalionVisit, typename DepotVisit>
+    void forEachName(Item item, BattalionVisit battalion, DepotVisit depot) const {
+        const char* names = base + namesOffset();
+        const char* end = names + __atomic_load_n(&header->namesBytes, __ATOMIC_ACQUIRE);
+        while (names < end) {
+            char kind = *names++;
+            string first(names, strnlen(names, end - names));
+            names += first.size() + 1;
+            if (kind == 'B' || kind == 'D') {
+                string second(names, strnlen(names, max<ptrdiff_t>(0, end - names)));
+                names += second.size() + 1;
+                if (kind == 'B') battalion(first, second);
+                else depot(first, second);
+            } else {
+                item(first);
+            }
+        }
+    }
+    
+    // Flushes a file-backed store to disk
+    void sync() {
+        if (fd >= 0) ::msync(base, bytes, MS_SYNC);
+    }
+};
+
+// Replenishment
+// Learns how fast each item leaves the central depot and reorders it before
+// it runs out. Demand is counted per period (a day by default). When a
+// period closes, its count is folded into an exponentially weighted mean and
+// variance. A run of idle periods is folded in one step in closed form, so
+// an update costs the same however long an item has been tracked.
+//
+// The reorder point is the mean demand over the lead time plus a safety
+// margin of some standard deviations. The order-up-to level adds cover for
+// a number of further periods. Every central stock decrease is checked
+// against the reorder point with a few atomic loads. Only an item that has
+// fallen to it takes the lock, and it orders enough to bring its stock plus
+// what is already on order back up to the order-up-to level. An order is
+// expected after the item's lead time but stays open, and counts as on
+// order, until an officer receives it.
+//
+// Demand a request could not be met for is counted too, but only once per
+// soldier and item in a period, and not when the stock was there but set
+// aside for holds. Requests without a soldier add no unmet demand.
+//
+// Like the reservation book, the engine moves no stock. The owner books
+// received orders, journals both orders and receipts and keeps the open
+// orders in its snapshot.
+struct ReplenishConfig {
+    string path = "inventory_replenish.bin";   // learned rates and lead times, empty keeps them in memory
+    int64_t periodSeconds = 86400;
+    double smoothing = 0.2;                    // weight of the newest period
+    int64_t leadSeconds = 7 * 86400;           // lead time of items that have none set
+    double safetyFactor = 1.65;                // standard deviations of lead time demand, about 95% service
+    int coverPeriods = 14;                     // periods of demand an order covers beyond the reorder point
+    int warmupPeriods = 3;                     // periods observed before an item is first reordered
+};
+
+struct ReplenishOrder {
+    int64_t due;          // expected arrival
+    uint32_t id;
+    int32_t itemId;
+    int32_t quantity;
+    int32_t reserved = 0;
+};
+static_assert(sizeof(ReplenishOrder) == 24, "replenishment orders are stored as written");
+
+// What the engine has learned about one item
+struct ItemForecast {
+    double rate = 0;           // mean demand per period
+    double deviation = 0;      // standard deviation of demand per period
+    int periods = 0;           // closed periods learned from
+    int reorderPoint = -1;     // -1 while the item is still being learned
+    int orderUpTo = 0;
+    int onOrder = 0;
+    int64_t leadSeconds = 0;
+    int64_t nextDelivery = 0;  // earliest expected arrival, possibly past; 0 when nothing is on order
+};
+
+constexpr char kReplenishMagic[8] = {'M', 'A', 'M', 'S', 'R', 'P', 'L', '3'};
+
+// Order journal records carry the due time as seconds after the record, so
+// lead times are capped at what 32 bits hold, about 136 years
+constexpr int64_t kMaxLeadSeconds = numeric_limits<uint32_t>::max();
+
+struct ReplenishHeader {
+    char magic[8];
+    uint64_t generation;      // snapshot the state was saved with
+    int64_t periodSeconds;    // learned rates are dropped if the period changes
+    uint32_t itemCount;
+    uint32_t reserved;
+    // Followed by itemCount ReplenishItemRecords
+};
+
+struct ReplenishItemRecord {
+    double mean;
+    double variance;
+    int64_t period;
+    int32_t demand;
+    int32_t periods;
+    int64_t leadSeconds;
+};
+static_assert(sizeof(ReplenishItemRecord) == 40, "replenishment records are stored as written");
+
+class ReplenishmentEngine {
+private:
+    struct ItemState {
+        atomic<int64_t> period{-1};     // the open period, -1 before any demand
+        AtomicCounter demand;           // units taken in the open period
+        AtomicCounter reorderPoint{-1};
+        AtomicCounter onOrder;
+        double mean = 0, variance = 0;  // per closed period
+        int periods = 0;
+        int orderUpTo = 0;
+        int64_t leadSeconds = 0;
+    };
+    
+    ReplenishConfig config;
+    mutable mutex lock;
+    deque<ItemState> items;             // deque: states hold atomics and never move
+    vector<ReplenishOrder> orders;      // open orders by ID
+    uint32_t nextOrderId = 1;
+    set<pair<uint64_t, int>> unmetRequests;   // soldier and item of unmet demand counted this period
+    int64_t unmetPeriod = -1;
+    
+    void closePeriod(ItemState& state, int demand) {
+        if (state.periods == 0) {
+            state.mean = demand;
+            state.variance = 0;
+        } else {
+            double a = config.smoothing, diff = demand - state.mean;
+            state.mean += a * diff;
+            state.variance = (1 - a) * (state.variance + a * diff * diff);
+        }
+        state.periods++;
+    }
+    
+    // Folds n periods without demand at once: with r = 1 - smoothing, the
+    // mean becomes m r^n and the variance r^n (v + m^2 (1 - r^n))
+    void closeIdlePeriods(ItemState& state, int64_t n) {
+        if (n <= 0 || state.periods == 0) return;
+        double decay = pow(1 - config.smoothing, (double)n);
+        state.variance = decay * (state.variance + state.mean * state.mean * (1 - decay));
+        state.mean *= decay;
+        state.periods = (int)min<int64_t>(state.periods + n, numeric_limits<int>::max());
+    }
+    
+    // Closes the open period and the idle ones after it, up to period. Caller holds the lock.
+    void roll(ItemState& state, int64_t period) {
+        int64_t open = state.period.load(memory_order_relaxed);
+        if (period <= open) return;
+        if (open >= 0) {
+            closePeriod(state, state.demand.value.exchange(0, memory_order_relaxed));
+            closeIdlePeriods(state, period - open - 1);
+            refresh(state);
+        }
+        state.period.store(period, memory_order_relaxed);
+    }
+    
+    // Recomputes the reorder point and order-up-to level. An item that
+    // would not sell a unit over its cover is left alone. Caller holds the lock.
+    void refresh(ItemState& state) {
+        if (state.periods < config.warmupPeriods || state.mean * config.coverPeriods < 1) {
+            state.reorderPoint.store(-1);
+            state.orderUpTo = 0;
+            return;
+        }
+        double lead = (double)state.leadSeconds / config.periodSeconds;
+        double point = state.mean * lead + config.safetyFactor * sqrt(state.variance * lead);
+        state.reorderPoint.store((int)min(ceil(point), 1e9));
+        state.orderUpTo = (int)min(ceil(point + state.mean * config.coverPeriods), 1e9);
+    }
+    
+    void addOrder(const ReplenishOrder& order) {
+        auto at = lower_bound(orders.begin(), orders.end(), order.id,
+                              [](const ReplenishOrder& open, uint32_t id) { return open.id < id; });
+        if (at != orders.end() && at->id == order.id) return;
+        orders.insert(at, order);
+        items[order.itemId].onOrder.add(order.quantity);
+        nextOrderId = max(nextOrderId, order.id + 1);
+    }
+    
+public:
+    explicit ReplenishmentEngine(const ReplenishConfig& cfg = ReplenishConfig()) : config(cfg) {
+        config.periodSeconds = max<int64_t>(1, config.periodSeconds);
+        config.leadSeconds = min(max<int64_t>(0, config.leadSeconds), kMaxLeadSeconds);
+        config.smoothing = min(1.0, max(0.001, config.smoothing));
+    }
+    
+    const ReplenishConfig& getConfig() const { return config; }
+    
+    // Journal records carry an order's ID and its due time, relative to the
+    // record's timestamp, packed into one field. A receipt's due time may
+    // lie in the past and is not kept.
+    static uint64_t packOrder(const ReplenishOrder& order, int64_t timestamp) {
+        return (uint64_t)order.id << 32 | (uint32_t)min(max<int64_t>(0, order.due - timestamp), kMaxLeadSeconds);
+    }
+    static ReplenishOrder unpackOrder(uint64_t packed, int64_t timestamp, int itemId, int quantity) {
+        return {timestamp + (uint32_t)packed, (uint32_t)(packed >> 32), itemId, quantity};
+    }
+    
+    // New items start with the default lead time. Expects no concurrent updates.
+    void resize(int itemCount) {
+        lock_guard<mutex> guard(lock);
+        while ((int)items.size() < itemCount) {
+            items.emplace_back();
+            items.back().leadSeconds = config.leadSeconds;
+        }
+    }
+    
+    // Counts units of demand for an item at time now: stock taken from the
+    // central depot, or asked for when there was none
+    void observe(int itemId, int quantity, int64_t now) {
+        ItemState& state = items[itemId];
+        int64_t period = now / config.periodSeconds;
+        if (period > state.period.load(memory_order_relaxed)) {
+            lock_guard<mutex> guard(lock);
+            roll(state, period);
+        }
+        state.demand.add(quantity);
+    }
+    
+    // Counts demand a request could not be met for, once per soldier and
+    // item in a period, so retries do not inflate the rate
+    void observeUnmet(int itemId, int quantity, uint64_t soldier, int64_t now) {
+        if (soldier == 0) return;
+        int64_t period = now / config.periodSeconds;
+        {
+            lock_guard<mutex> guard(lock);
+            if (period != unmetPeriod) {
+                unmetRequests.clear();
+                unmetPeriod = period;
+            }
+            if (!unmetRequests.insert({soldier, itemId}).second) return;
+        }
+        observe(itemId, quantity, now);
+    }
+    
+    // Places an order if the item's stock plus what is on order has fallen
+    // to its reorder point. Returns false if no order is needed.
+    bool reorder(int itemId, const AtomicCounter& stock, int64_t now, ReplenishOrder& order) {
+        ItemState& state = items[itemId];
+        if (stock.load() + state.onOrder.load() > state.reorderPoint.load()) return false;
+        
+        lock_guard<mutex> guard(lock);
+        int position = stock.load() + state.onOrder.load();
+        if (state.reorderPoint.load() < 0 || position > state.reorderPoint.load()) return false;
+        order = {now + state.leadSeconds, nextOrderId, itemId, state.orderUpTo - position};
+        if (order.quantity <= 0) return false;
+        addOrder(order);
+        return true;
+    }
+    
+    // Closes an open order that has arrived. Returns false if no order
+    // with that ID is open.
+    bool receive(uint32_t id, ReplenishOrder& order) {
+        lock_guard<mutex> guard(lock);
+        auto at = lower_bound(orders.begin(), orders.end(), id,
+                              [](const ReplenishOrder& open, uint32_t wanted) { return open.id < wanted; });
+        if (at == orders.end() || at->id != id) return false;
+        order = *at;
+        items[order.itemId].onOrder.add(-order.quantity);
+        orders.erase(at);
+        return true;
+    }
+    
+    // Journal replay: an order record reopens an order, a receipt closes it
+    void replayOrder(const ReplenishOrder& order) {
+        if (order.itemId < 0 || order.itemId >= (int)items.size() || order.quantity <= 0) return;
+        lock_guard<mutex> guard(lock);
+        addOrder(order);
+    }
+    
+    void replayReceipt(uint32_t id) {
+        ReplenishOrder order;
+        receive(id, order);
+    }
+    
+    void setLeadTime(int itemId, int64_t seconds) {
+        lock_guard<mutex> guard(lock);
+        items[itemId].leadSeconds = min(seconds, kMaxLeadSeconds);
+        refresh(items[itemId]);
+    }
+    
+    // The item's estimates as of now; periods that have ended are closed first
+    ItemForecast forecast(int itemId, int64_t now) {
+        lock_guard<mutex> guard(lock);
+        ItemState& state = items[itemId];
+        roll(state, now / config.periodSeconds);
+        ItemForecast result;
+        result.rate = state.mean;
+        result.deviation = sqrt(state.variance);
+        result.periods = state.periods;
+        result.reorderPoint = state.reorderPoint.load();
+        result.orderUpTo = state.orderUpTo;
+        result.onOrder = state.onOrder.load();
+        result.leadSeconds = state.leadSeconds;
+        for (const ReplenishOrder& order : orders) {
+            if (order.itemId == itemId && (result.nextDelivery == 0 || order.due < result.nextDelivery)) result.nextDelivery = order.due;
+        }
+        return result;
+    }
+    
+    vector<ReplenishOrder> getOrders() const {
+        lock_guard<mutex> guard(lock);
+        vector<ReplenishOrder> sorted(orders);
+        sort(sorted.begin(), sorted.end(), [](const ReplenishOrder& a, const ReplenishOrder& b) { return a.due < b.due; });
+        return sorted;
+    }
+    
+    // Copies the open orders, by ID, for a snapshot and returns the next order ID
+    uint32_t collectOrders(vector<ReplenishOrder>& open) const {
+        lock_guard<mutex> guard(lock);
+        open = orders;
+        return nextOrderId;
+    }
+    
+    // Reopens the orders a snapshot recorded
+    void restoreOrders(const vector<ReplenishOrder>& open, uint32_t next) {
+        lock_guard<mutex> guard(lock);
+        nextOrderId = max(nextOrderId, next);
+        for (const ReplenishOrder& order : open) {
+            if (order.itemId >= 0 && order.itemId < (int)items.size() && order.quantity > 0) addOrder(order);
+        }
+    }
+    
+    // Writes the learned state alongside the snapshot of the given
+    // generation, through a temporary file renamed into place
+    bool save(const string& path, uint64_t generation) const {
+        if (path.empty()) return false;
+        lock_guard<mutex> guard(lock);
+        ReplenishHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, kReplenishMagic, sizeof(kReplenishMagic));
+        header.generation = generation;
+        header.periodSeconds = config.periodSeconds;
+        header.itemCount = items.size();
+        vector<ReplenishItemRecord> records;
+        records.reserve(items.size());
+        for (const ItemState& state : items) {
+            records.push_back({state.mean, state.variance, state.period.load(), state.demand.load(), state.periods, state.leadSeconds});
+        }
+        
+        string tmpPath = path + ".tmp";
+        int out = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) return false;
+        size_t recordBytes = records.size() * sizeof(ReplenishItemRecord);
+        bool ok = ::write(out, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+                  ::write(out, records.data(), recordBytes) == (ssize_t)recordBytes &&
+                  ::fsync(out) == 0;
+        ::close(out);
+        if (!ok || ::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            ::unlink(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+    
+    // Restores the saved rates and lead times. The file is written just
+    // after the snapshot, so a crash in between leaves it one generation
+    // behind; the rates are still good then. Open orders are not kept here
+    // but in the snapshot itself, so they cannot fall out of step with it.
+    bool load(const string& path) {
+        int in = path.empty() ? -1 : ::open(path.c_str(), O_RDONLY);
+        if (in < 0) return false;
+        ReplenishHeader header;
+        bool ok = ::read(in, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+                  memcmp(header.magic, kReplenishMagic, sizeof(kReplenishMagic)) == 0 &&
+                  header.itemCount <= items.size();
+        vector<ReplenishItemRecord> records(ok ? header.itemCount : 0);
+        size_t recordBytes = records.size() * sizeof(ReplenishItemRecord);
+        ok = ok && ::read(in, records.data(), recordBytes) == (ssize_t)recordBytes;
+        ::close(in);
+        if (!ok) return false;
+        
+        lock_guard<mutex> guard(lock);
+        bool sameRates = header.periodSeconds == config.periodSeconds;
+        for (uint32_t id = 0; id < header.itemCount; id++) {
+            ItemState& state = items[id];
+            const ReplenishItemRecord& record = records[id];
+            state.leadSeconds = record.leadSeconds > 0 ? min(record.leadSeconds, kMaxLeadSeconds) : config.leadSeconds;
+            if (sameRates) {
+                state.mean = record.mean;
+                state.variance = record.variance;
+                state.periods = record.periods;
+                state.period.store(record.period);
+                state.demand.store(record.demand);
+            }
+            refresh(state);
+        }
+        return true;
+    }
+};
+
+enum class RequestResult { Success, RankLimitExceeded, OutOfStock, UnknownItem, HoldingLimitExceeded, NotHeld,
+                           UnknownHolder, SameHolder, HolderFull };
+constexpr int kRequestResultCount = 9;
+
+// Batch operations
+struct IssueOperation {
+    Rank rank;
+    int itemId;
+    int quantity;
+    uint64_t soldier = 0;   // holdings ledger key, 0 for an untracked request
+};
+
+struct AllocationOperation {
+    int battalionIndex;
+    int itemId;
+    int quantity;
+};
+
+struct BatchResult {
+    RequestResult status;
+    int failedIndex;   // first offending operation, -1 on success
+    
+    bool ok() const { return status == RequestResult::Success; }
+};
+
+struct InventoryConfig {
+    LogConfig log;
+    string journalPath = "inventory_journal.bin";     // empty disables persistence
+    string snapshotPath = "inventory_snapshot.bin";
+    string historyPath = "inventory_history.bin";     // stock history, empty keeps none
+    string storePath;                                 // memory-mapped state store, empty keeps state in memory
+    bool readOnly = false;                            // recover state but never write journal, snapshot or store
+    uint64_t snapshotInterval = 100000;               // journal records between snapshots
+    bool fsyncJournal = false;
+    uint32_t metricsSampleInterval = 16;              // time one request in N per thread
+    ReplenishConfig replenish;
+};
+
+// Holdings Ledger
+// What every tracked soldier currently holds, so rank entitlements apply to
+// a soldier's cumulative holdings rather than to each request on its own.
+// Soldiers are keyed by their PAK number packed into 64 bits and stored in
+// open-addressed tables, one per shard; each record is 24 bytes, so a
+// million soldiers need roughly 32-64 MB. Every operation touches a single
+// record under its shard's lock.
+constexpr int maxEntitlement() {
+    int most = 0;
+    for (int r = 0; r < kSoldierRankCount; r++) {
+        for (int item = 0; item < kStandardItemCount; item++) {
+            if (kEntitlements[r][item] > most) most = kEntitlements[r][item];
+        }
+    }
+    return most;
+}
+static_assert(maxEntitlement() <= 255, "ledger records hold per-item counts in one byte");
+
+class HoldingsLedger {
+public:
+    struct Entry {
+        uint64_t soldier;                       // 0 marks an empty slot
+        uint8_t held[kStandardItemCount];       // only standard items are issued to soldiers
+    };
+    static_assert(sizeof(Entry) == 24, "ledger records are persisted as-is");
+    
+private:
+    static constexpr int kShards = 64;
+    
+    struct alignas(64) Shard {
+        mutable mutex lock;
+        vector<Entry> slots;   // power-of-two sized, linear probing
+        size_t used = 0;
+    };
+    Shard shards[kShards];
+    
+    static uint64_t mix(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return key;
+    }
+    
+    Shard& shardFor(uint64_t soldier) { return shards[mix(soldier) % kShards]; }
+    const Shard& shardFor(uint64_t soldier) const { return shards[mix(soldier) % kShards]; }
+    
+    static Entry* probe(vector<Entry>& slots, uint64_t soldier) {
+        size_t mask = slots.size() - 1;
+        for (size_t i = (mix(soldier) / kShards) & mask;; i = (i + 1) & mask) {
+            if (slots[i].soldier == soldier || slots[i].soldier == 0) return &slots[i];
+        }
+    }
+    
+    // Finds a soldier's record, optionally creating it. Caller holds the shard lock.
+    static Entry* locate(Shard& shard, uint64_t soldier, bool create) {
+        if (shard.slots.empty()) {
+            if (!create) return nullptr;
+            shard.slots.assign(16, Entry());
+        } else if (create && (shard.used + 1) * 4 > shard.slots.size() * 3) {
+            vector<Entry> old(shard.slots.size() * 2, Entry());
+            old.swap(shard.slots);
+            for (const Entry& e : old) {
+                if (e.soldier != 0) *probe(shard.slots, e.soldier) = e;
+            }
+        }
+        Entry* entry = probe(shard.slots, soldier);
+        if (entry->soldier == 0) {
+            if (!create) return nullptr;
+            entry->soldier = soldier;
+            shard.used++;
+        }
+        return entry;
+    }
+    
+public:
+    // Packs a soldier PAK number ("PAK" followed by 1-17 digits) into a
+    // ledger key. The digit count is kept so PAK007 and PAK7 stay distinct.
+    // Returns 0 for anything else, including officer PAK numbers.
+    static uint64_t soldierKey(string_view pakNumber) {
+        Rank rank;
+        uint64_t number;
+        if (!parsePakNumber(pakNumber.data(), pakNumber.size(), rank, number) || rank != Rank::Enlisted) return 0;
+        return number;
+    }
+    
+    static string pakNumber(uint64_t soldier) {
+        size_t width = soldier % 32;
+        string digits = to_string(soldier / 32);
+        if (digits.size() < width) digits.insert(0, width - digits.size(), '0');
+        return "PAK" + digits;
+    }
+    
+    // Adds quantity to a soldier's holding if the total stays within limit
+    bool reserve(uint64_t soldier, int itemId, int quantity, int limit) {
+        Shard& shard = shardFor(soldier);
+        lock_guard<mutex> guard(shard.lock);
+        Entry* entry = locate(shard, soldier, true);
+        if (entry->held[itemId] + quantity > limit) return false;
+        entry->held[itemId] += quantity;
+        return true;
+    }
+    
+    // Takes quantity off a soldier's holding if they hold that much
+    bool release(uint64_t soldier, int itemId, int quantity) {
+        Shard& shard = shardFor(soldier);
+        lock_guard<mutex> guard(shard.lock);
+        Entry* entry = locate(shard, soldier, false);
+        if (!entry || entry->held[itemId] < quantity) return false;
+        entry->held[itemId] -= quantity;
+        return true;
+    }
+    
+    // Applies a recovered change without any limit check
+    void apply(uint64_t soldier, int itemId, int delta) {
+        Shard& shard = shardFor(soldier);
+        lock_guard<mutex> guard(shard.lock);
+        Entry* entry = locate(shard, soldier, true);
+        entry->held[itemId] = (uint8_t)max(0, min(255, entry->held[itemId] + delta));
+    }
+    
+    void restore(const Entry& record) {
+        Shard& shard = shardFor(record.soldier);
+        lock_guard<mutex> guard(shard.lock);
+        memcpy(locate(shard, record.soldier, true)->held, record.held, sizeof(record.held));
+    }
+    
+    int holding(uint64_t soldier, int itemId) const {
+        const Shard& shard = shardFor(soldier);
+        lock_guard<mutex> guard(shard.lock);
+        Entry* entry = locate(const_cast<Shard&>(shard), soldier, false);
+        return entry ? entry->held[itemId] : 0;
+    }
+    
+    size_t size() const {
+        size_t total = 0;
+        for (const Shard& shard : shards) {
+            lock_guard<mutex> guard(shard.lock);
+            total += shard.used;
+        }
+        return total;
+    }
+    
+    // Appends every record to out, e.g. for a snapshot
+    void collect(vector<Entry>& out) const {
+        for (const Shard& shard : shards) {
+            lock_guard<mutex> guard(shard.lock);
+            for (const Entry& e : shard.slots) {
+                if (e.soldier != 0) out.push_back(e);
+            }
+        }
+    }
+};
+
+// Low Stock Index
+// Maintained incrementally on every stock change. Items sit in one of 101
+// fill-ratio buckets (0-100% of capacity) and, when at or below their
+// threshold, in a dense below-threshold set. A change that stays within the
+// same bucket and on the same side of the threshold costs two divisions and
+// no lock; only bucket moves and threshold crossings take the mutex. The
+// lock-free check reads capacity and threshold from a table of atomics that
+// a resize replaces but never frees, so it cannot race a growing catalog.
+// Subscribers are called once per crossing, in either direction.
+class LowStockIndex {
+public:
+    using Subscriber = function<void(int itemId, int stock, bool below)>;
+    
+private:
+    static constexpr int kBuckets = 101;
+    
+    struct ItemState {
+        int capacity = 0;
+        int threshold = 0;
+        bool customThreshold = false;
+        bool below = false;
+        int bucket = -1;          // -1 while not linked
+        int prev = -1, next = -1;
+        int belowPos = -1;        // position in belowItems
+    };
+    
+    struct Limits {
+        atomic<int> capacity{0};
+        atomic<int> threshold{0};
+    };
+    
+    mutable mutex lock;
+    vector<ItemState> items;
+    atomic<Limits*> limits{nullptr};          // mirrors items' capacity and threshold
+    vector<unique_ptr<Limits[]>> limitTables; // the current table last; older ones stay for readers that loaded them
+    size_t limitCapacity = 0;
+    int bucketHeads[kBuckets];
+    vector<int> belowItems;
+    
+    shared_mutex subscriberLock;           // held shared while callbacks run
+    vector<pair<int, Subscriber>> subscribers;
+    int nextSubscription = 1;
+    
+    static int bucketFor(int capacity, int stock) {
+        if (capacity <= 0 || stock <= 0) return 0;
+        return (int)min<int64_t>(100, (int64_t)stock * 100 / capacity);
+    }
+    
+    // Copies an item's capacity and threshold into the lock-free table. Caller holds the lock.
+    void publishLimits(int itemId) {
+        Limits& mirror = limits.load(memory_order_relaxed)[itemId];
+        mirror.capacity.store(items[itemId].capacity, memory_order_relaxed);
+        mirror.threshold.store(items[itemId].threshold, memory_order_relaxed);
+    }
+    
+    void unlink(int itemId) {
+        ItemState& state = items[itemId];
+        if (state.bucket < 0) return;
+        if (state.prev >= 0) items[state.prev].next = state.next;
+        else bucketHeads[state.bucket] = state.next;
+        if (state.next >= 0) items[state.next].prev = state.prev;
+        state.bucket = state.prev = state.next = -1;
+    }
+    
+    void link(int itemId, int bucket) {
+        ItemState& state = items[itemId];
+        state.bucket = bucket;
+        state.prev = -1;
+        state.next = bucketHeads[bucket];
+        if (state.next >= 0) items[state.next].prev = itemId;
+        bucketHeads[bucket] = itemId;
+    }
+    
+    // Places the item according to its current stock. Returns true if the
+    // item crossed its threshold. Caller holds the lock.
+    bool place(int itemId, int stock) {
+        ItemState& state = items[itemId];
+        int bucket = bucketFor(state.capacity, stock);
+        if (bucket != state.bucket) {
+            unlink(itemId);
+            link(itemId, bucket);
+        }
+        bool below = stock <= state.threshold;
+        if (below == state.below) return false;
+        
+        state.below = below;
+        if (below) {
+            state.belowPos = (int)belowItems.size();
+            belowItems.push_back(itemId);
+        } else {
+            int last = belowItems.back();
+            belowItems[state.belowPos] = last;
+            items[last].belowPos = state.belowPos;
+            belowItems.pop_back();
+            state.belowPos = -1;
+        }
+        return true;
+    }
+    
+    void notify(int itemId, int stock, bool below) {
+        shared_lock<shared_mutex> guard(subscriberLock);
+        for (auto& subscriber : subscribers) subscriber.second(itemId, stock, below);
+    }
+    
+public:
+    LowStockIndex() {
+        fill(begin(bucketHeads), end(bucketHeads), -1);
+    }
+    
+    // Returns a handle for unsubscribe. A subscriber must not unsubscribe
+    // from inside its own callback.
+    int subscribe(Subscriber subscriber) {
+        lock_guard<shared_mutex> guard(subscriberLock);
+        subscribers.emplace_back(nextSubscription, move(subscriber));
+        return nextSubscription++;
+    }
+    
+    // Waits for callbacks in progress, so the subscriber may be destroyed
+    // once this returns
+    void unsubscribe(int subscription) {
+        lock_guard<shared_mutex> guard(subscriberLock);
+        subscribers.erase(remove_if(subscribers.begin(), subscribers.end(),
+                                    [&](const pair<int, Subscriber>& s) { return s.first == subscription; }),
+                          subscribers.end());
+    }
+    
+    void resize(int itemCount) {
+        lock_guard<mutex> guard(lock);
+        items.resize(itemCount);
+        if ((size_t)itemCount <= limitCapacity) return;
+        size_t grown = max<size_t>({(size_t)itemCount, 2 * limitCapacity, 64});
+        unique_ptr<Limits[]> table(new Limits[grown]);
+        limitTables.push_back(move(table));
+        limitCapacity = grown;
+        limits.store(limitTables.back().get(), memory_order_release);
+        for (size_t id = 0; id < items.size(); id++) publishLimits((int)id);
+    }
+    
+    // Capacity changes move a default threshold along with it (50%)
+    void setCapacity(int itemId, int capacity, int stock) {
+        lock_guard<mutex> guard(lock);
+        ItemState& state = items[itemId];
+        state.capacity = capacity;
+        if (!state.customThreshold) state.threshold = capacity / 2;
+        publishLimits(itemId);
+        place(itemId, stock);
+    }
+    
+    void setThreshold(int itemId, int threshold, int stock) {
+        bool crossed;
+        {
+            lock_guard<mutex> guard(lock);
+            items[itemId].threshold = threshold;
+            items[itemId].customThreshold = true;
+            publishLimits(itemId);
+            crossed = place(itemId, stock);
+        }
+        if (crossed) notify(itemId, stock, stock <= threshold);
+    }
+    
+    // Called after every stock change with the values around the change and
+    // the live counter, which is re-read under the lock so that concurrent
+    // updates of the same item always leave it filed by its latest stock.
+    void update(int itemId, int before, int after, const AtomicCounter& stock) {
+        const Limits& mirror = limits.load(memory_order_acquire)[itemId];
+        int capacity = mirror.capacity.load(memory_order_relaxed);
+        int threshold = mirror.threshold.load(memory_order_relaxed);
+        if (bucketFor(capacity, before) == bucketFor(capacity, after) &&
+            (before <= threshold) == (after <= threshold)) {
+            return;
+        }
+        
+        int current;
+        bool crossed, below;
+        {
+            lock_guard<mutex> guard(lock);
+            current = stock.load();
+            crossed = place(itemId, current);
+            below = items[itemId].below;
+        }
+        if (crossed) notify(itemId, current, below);
+    }
+    
+    bool isBelow(int itemId) const {
+        lock_guard<mutex> guard(lock);
+        return items[itemId].below;
+    }
+    
+    int getThreshold(int itemId) const {
+        lock_guard<mutex> guard(lock);
+        return items[itemId].threshold;
+    }
+    
+    // All items at or below their threshold, O(k)
+    vector<int> belowThreshold() const {
+        lock_guard<mutex> guard(lock);
+        return belowItems;
+    }
+    
+    // The n items with the lowest fill ratio. Whole buckets are taken,
+    // lowest first, until they hold n items, and those m items are ordered
+    // exactly by the stock reader: O(buckets + m log n).
+    template <typename StockReader>
+    vector<int> mostDepleted(int n, StockReader readStock) const {
+        vector<pair<double, int>> candidates;   // fill ratio, item
+        {
+            lock_guard<mutex> guard(lock);
+            for (int b = 0; b < kBuckets && (int)candidates.size() < n; b++) {
+                for (int id = bucketHeads[b]; id >= 0; id = items[id].next) {
+                    int capacity = items[id].capacity;
+                    candidates.emplace_back(capacity > 0 ? (double)readStock(id) / capacity : 0.0, id);
+                }
+            }
+        }
+        size_t count = min(candidates.size(), (size_t)max(0, n));
+        partial_sort(candidates.begin(), candidates.begin() + count, candidates.end());
+        vector<int> result(count);
+        for (size_t i = 0; i < count; i++) result[i] = candidates[i].second;
+        return result;
+    }
+};
+
+// Metrics
+// Hot-path counters and latency histograms. Every thread records into its
+// own shard with plain stores, so recording never contends; a dump merges
+// all shards.
+struct MetricsShard {
+    uint64_t requestOutcomes[kRequestResultCount] = {};   // indexed by RequestResult
+    uint64_t allocations = 0;
+    uint64_t allocationFailures = 0;
+    uint64_t returns = 0;
+    uint64_t batches = 0;
+    uint64_t batchOperations = 0;
+    uint32_t untilSample = 0;           // requests left before the next timed one
+    vector<uint64_t> itemRequests;      // successful requests per item
+    vector<uint64_t> itemUnits;         // units issued per item
+    vector<uint64_t> battalionUnits;    // units allocated per battalion
+    LatencyHistogram requestLatency;
+    LatencyHistogram allocationLatency;
+    LatencyHistogram batchLatency;
+    
+    // Counters are written by the owning thread only and read with relaxed
+    // loads by dumps; the atomic_ref-style access keeps them race free.
+    static void bump(uint64_t& counter, uint64_t delta = 1) {
+        __atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + delta, __ATOMIC_RELAXED);
+    }
+    static uint64_t read(const uint64_t& counter) { return __atomic_load_n(&counter, __ATOMIC_RELAXED); }
+    
+    // True for one request in every interval; only those are timed
+    bool sample(uint32_t interval) {
+        if (untilSample > 0) {
+            untilSample--;
+            return false;
+        }
+        untilSample = interval - 1;
+        return true;
+    }
+};
+
+class Metrics {
+private:
+    // Live instances use small slot numbers that index each thread's shard
+    // table; the ID tells a slot's current owner from an earlier one
+    static atomic<uint64_t> nextId;
+    static mutex slotLock;
+    static vector<int> freeSlots;
+    static int slotCount;
+    
+    uint64_t id = nextId.fetch_add(1);
+    int slot;
+    mutable mutex lock;
+    TickClock clock;
+    uint32_t sampleInterval = 1;
+    vector<unique_ptr<MetricsShard>> shards;
+    
+    // Grows one of the calling thread's per-item/per-battalion arrays. The
+    // lock keeps a concurrent merge from reading a buffer being reallocated.
+    void grow(vector<uint64_t>& counters, size_t size) {
+        lock_guard<mutex> guard(lock);
+        counters.resize(size, 0);
+    }
+    
+public:
+    Metrics() {
+        lock_guard<mutex> guard(slotLock);
+        if (freeSlots.empty()) {
+            slot = slotCount++;
+        } else {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+    }
+    
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+    
+    ~Metrics() {
+        lock_guard<mutex> guard(slotLock);
+        freeSlots.push_back(slot);
+    }
+    
+    // The calling thread's shard, registered on first use. A table entry
+    // left by a destroyed instance is overwritten by the next owner of its slot.
+    MetricsShard& local() {
+        thread_local vector<pair<uint64_t, MetricsShard*>> owned;   // by slot
+        if ((size_t)slot < owned.size() && owned[slot].first == id) return *owned[slot].second;
+        lock_guard<mutex> guard(lock);
+        shards.emplace_back(new MetricsShard());
+        if (owned.size() <= (size_t)slot) owned.resize(slot + 1, {0, nullptr});
+        owned[slot] = {id, shards.back().get()};
+        return *shards.back();
+    }
+    
+    void countIssue(MetricsShard& shard, int itemId, int quantity) {
+        if ((size_t)itemId >= shard.itemUnits.size()) {
+            grow(shard.itemRequests, itemId + 1);
+            grow(shard.itemUnits, itemId + 1);
+        }
+        MetricsShard::bump(shard.itemRequests[itemId]);
+        MetricsShard::bump(shard.itemUnits[itemId], quantity);
+    }
+    
+    void countAllocation(MetricsShard& shard, int battalionIndex, int quantity) {
+        if ((size_t)battalionIndex >= shard.battalionUnits.size()) {
+            grow(shard.battalionUnits, battalionIndex + 1);
+        }
+        MetricsShard::bump(shard.battalionUnits[battalionIndex], quantity);
+    }
+    
+    // Latency is recorded for one operation in every interval per thread.
+    // Counters are always exact.
+    void setSampleInterval(uint32_t interval) { sampleInterval = max(1u, interval); }
+    uint32_t getSampleInterval() const { return sampleInterval; }
+    
+    // Shard latencies are recorded in ticks
+    static uint64_t startTimer() { return TickClock::now(); }
+    static uint64_t elapsed(uint64_t start) { return TickClock::now() - start; }
+    double nanosPerTick() const { return clock.nanosPerTick(); }
+    
+    // Sums every shard into one view with the given array sizes
+    unique_ptr<MetricsShard> merge(int itemCount, int battalionCount) const {
+        unique_ptr<MetricsShard> merged(new MetricsShard());
+        merged->itemRequests.assign(itemCount, 0);
+        merged->itemUnits.assign(itemCount, 0);
+        merged->battalionUnits.assign(battalionCount, 0);
+        
+        auto add = [](vector<uint64_t>& into, const vector<uint64_t>& from) {
+            for (size_t i = 0; i < from.size() && i < into.size(); i++) into[i] += MetricsShard::read(from[i]);
+        };
+        lock_guard<mutex> guard(lock);
+        for (auto& shard : shards) {
+            add(merged->itemRequests, shard->itemRequests);
+            add(merged->itemUnits, shard->itemUnits);
+            add(merged->battalionUnits, shard->battalionUnits);
+            for (int i = 0; i < kRequestResultCount; i++) merged->requestOutcomes[i] += MetricsShard::read(shard->requestOutcomes[i]);
+            merged->allocations += MetricsShard::read(shard->allocations);
+            merged->allocationFailures += MetricsShard::read(shard->allocationFailures);
+            merged->returns += MetricsShard::read(shard->returns);
+            merged->batches += MetricsShard::read(shard->batches);
+            merged->batchOperations += MetricsShard::read(shard->batchOperations);
+            merged->requestLatency.merge(shard->requestLatency);
+            merged->allocationLatency.merge(shard->allocationLatency);
+            merged->batchLatency.merge(shard->batchLatency);
+        }
+        return merged;
+    }
+};
+
+atomic<uint64_t> Metrics::nextId{1};
+mutex Metrics::slotLock;
+vector<int> Metrics::freeSlots;
+int Metrics::slotCount = 0;
+
+// Allocation Planner
+// Splits the central stock of one item across battalions by need
+// (soldiers x per-soldier norm - current holding). Items are independent,
+// so a plan solves them in parallel and then applies every transfer as
+// one all-or-nothing batch.
+enum class AllocationPolicy {
+    MaxMinFair,     // raise every battalion towards the same unit level; small needs are met in full
+    Proportional    // every battalion receives the same fraction of its need
+};
+
+struct AllocationPlan {
+    vector<AllocationOperation> transfers;   // ordered by item, then battalion
+    uint64_t totalNeed = 0;
+    uint64_t totalPlanned = 0;
+    double solveMillis = 0;
+};
+
+// GCC and Clang both provide 128-bit integers; __extension__ keeps
+// -Wpedantic quiet about it
+__extension__ typedef __int128 int128_t;
+
+// Writes the share of supply for every battalion into share. order is scratch space.
+inline void fairShare(AllocationPolicy policy, const vector<int64_t>& need, int64_t supply,
+                      vector<int>& share, vector<int>& order) {
+    size_t count = need.size();
+    int64_t totalNeed = 0;
+    for (int64_t n : need) totalNeed += n;
+    if (supply >= totalNeed) {
+        for (size_t b = 0; b < count; b++) share[b] = (int)need[b];
+        return;
+    }
+    
+    if (policy == AllocationPolicy::MaxMinFair) {
+        // Water-filling: start from an equal split of the supply; battalions
+        // needing no more than the split are served in full and drop out,
+        // which raises the split for the rest. Stops after a pass that serves
+        // nobody, usually within two or three passes. The rounding leftovers
+        // go one unit each to battalions still short, in battalion order.
+        order.resize(count);
+        for (size_t b = 0; b < count; b++) order[b] = (int)b;
+        size_t active = count;
+        int64_t remaining = supply;
+        int64_t level;
+        while (true) {
+            level = remaining / (int64_t)active;
+            size_t kept = 0;
+            for (size_t i = 0; i < active; i++) {
+                int b = order[i];
+                if (need[b] <= level) remaining -= need[b];
+                else order[kept++] = b;
+            }
+            if (kept == active) break;
+            active = kept;
+        }
+        int64_t extra = remaining - level * (int64_t)active;
+        for (size_t b = 0; b < count; b++) {
+            share[b] = (int)min(need[b], level);
+            if (need[b] > level && extra > 0) {
+                share[b]++;
+                extra--;
+            }
+        }
+        return;
+    }
+    
+    // Proportional, with the rounding leftovers going to the largest
+    // remainders. supply * need can pass 64 bits, so it is formed in 128.
+    auto scaled = [&](size_t b) { return (int128_t)supply * need[b]; };
+    int64_t given = 0;
+    order.clear();
+    for (size_t b = 0; b < count; b++) {
+        share[b] = (int)(scaled(b) / totalNeed);
+        given += share[b];
+        if (need[b] > share[b]) order.push_back((int)b);
+    }
+    sort(order.begin(), order.end(), [&](int a, int b) {
+        return scaled(a) % totalNeed > scaled(b) % totalNeed;
+    });
+    for (size_t i = 0; i < order.size() && given < supply; i++, given++) share[order[i]]++;
+}
+
+// Reservations
+// Holds set stock aside for a soldier until it is collected or its deadline
+// passes. A hold that cannot be met at once waits in its item's queue, which
+// is a heap ordered by rank and then arrival. Cancelled waiters are left in
+// the heap and skipped when they surface. Deadlines sit in a hashed timer
+// wheel with one-second slots; an entry further out than one turn stays in
+// its slot until the turn that reaches it. The book does no locking and
+// moves no stock: the owner does both and keeps the per-item held totals
+// that requests must leave untouched.
+enum class HoldState : uint8_t { Free, Waiting, Held };
+
+constexpr int kDefaultHoldSeconds = 15 * 60;
+
+struct HoldResult {
+    RequestResult result;
+    uint32_t id;       // 0 unless the hold was placed
+    bool waiting;      // queued rather than met at once
+};
+
+struct Hold {
+    uint32_t id = 0;
+    int itemId = 0;
+    int quantity = 0;
+    int ttl = 0;              // seconds, restarted when a waiting hold is met
+    int64_t deadline = 0;
+    uint64_t soldier = 0;     // owner, HoldingsLedger::soldierKey of the PAK number
+    Rank rank = Rank::Enlisted;
+    HoldState state = HoldState::Free;
+    int timerPrev = -1, timerNext = -1;
+};
+
+class ReservationBook {
+public:
+    static constexpr int kWheelSlots = 4096;   // about 68 minutes per turn
+    
+private:
+    struct Waiter {
+        uint32_t id;
+        int slot;
+        uint8_t rank;
+        
+        // Heap order: higher ranks first, then earlier IDs
+        bool operator<(const Waiter& other) const {
+            return rank != other.rank ? rank < other.rank : id > other.id;
+        }
+    };
+    
+    vector<Hold> holds;
+    vector<int> freeSlots;
+    unordered_map<uint32_t, int> slots;   // hold ID -> slot
+    uint32_t nextId = 1;
+    
+    vector<vector<Waiter>> queues;        // per item
+    vector<int> staleWaiters;             // per item, cancelled entries still in the heap
+    vector<AtomicCounter> waiting;        // per item, read without the owner's lock
+    vector<AtomicCounter> held;           // per item units set aside
+    unordered_map<uint64_t, array<int, kStandardItemCount>> soldierUnits;   // open hold units per soldier and standard item
+    
+    int wheel[kWheelSlots];
+    int64_t wheelTime;                    // last second processed
+    size_t waitingCount = 0, heldCount = 0;
+    
+    void link(int slot) {
+        Hold& hold = holds[slot];
+        int& head = wheel[hold.deadline & (kWheelSlots - 1)];
+        hold.timerPrev = -1;
+        hold.timerNext = head;
+        if (head >= 0) holds[head].timerPrev = slot;
+        head = slot;
+    }
+    
+    void unlink(int slot) {
+        Hold& hold = holds[slot];
+        if (hold.timerPrev >= 0) holds[hold.timerPrev].timerNext = hold.timerNext;
+        else wheel[hold.deadline & (kWheelSlots - 1)] = hold.timerNext;
+        if (hold.timerNext >= 0) holds[hold.timerNext].timerPrev = hold.timerPrev;
+        hold.timerPrev = hold.timerNext = -1;
+    }
+    
+    void countSoldier(const Hold& hold, int delta) {
+        if (hold.soldier == 0 || hold.itemId >= kStandardItemCount) return;
+        auto it = soldierUnits.try_emplace(hold.soldier).first;
+        it->second[hold.itemId] += delta;
+        if (all_of(it->second.begin(), it->second.end(), [](int units) { return units == 0; })) soldierUnits.erase(it);
+    }
+    
+    bool live(const Waiter& waiter) const {
+        const Hold& hold = holds[waiter.slot];
+        return hold.id == waiter.id && hold.state == HoldState::Waiting;
+    }
+    
+    // Drops cancelled entries once they make up most of a heap
+    void compact(int itemId) {
+        vector<Waiter>& queue = queues[itemId];
+        if (staleWaiters[itemId] < 64 || staleWaiters[itemId] * 2 < (int)queue.size()) return;
+        queue.erase(remove_if(queue.begin(), queue.end(), [this](const Waiter& w) { return !live(w); }), queue.end());
+        make_heap(queue.begin(), queue.end());
+        staleWaiters[itemId] = 0;
+    }
+    
+public:
+    ReservationBook() : wheelTime(time(0)) {
+        fill(begin(wheel), end(wheel), -1);
+    }
+    
+    void resize(int itemCount) {
+        queues.resize(itemCount);
+        staleWaiters.resize(itemCount, 0);
+        waiting.resize(itemCount);
+        held.resize(itemCount);
+    }
+    
+    // Units of an item set aside and the number of holds waiting for it;
+    // both may be read while holds are being changed
+    int heldUnits(int itemId) const { return held[itemId].load(); }
+    AtomicCounter& heldCounter(int itemId) { return held[itemId]; }
+    bool hasWaiters(int itemId) const { return waiting[itemId].load() > 0; }
+    
+    size_t getWaitingCount() const { return waitingCount; }
+    size_t getHeldCount() const { return heldCount; }
+    
+    // Units a soldier has in open holds of a standard item, waiting or met
+    int soldierHoldUnits(uint64_t soldier, int itemId) const {
+        auto it = soldierUnits.find(soldier);
+        return it == soldierUnits.end() || itemId >= kStandardItemCount ? 0 : it->second[itemId];
+    }
+    
+    // Adds a waiting hold and returns its ID
+    uint32_t add(int itemId, int quantity, Rank rank, uint64_t soldier, int ttl, int64_t now) {
+        int slot;
+        if (freeSlots.empty()) {
+            slot = (int)holds.size();
+            holds.emplace_back();
+        } else {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        Hold& hold = holds[slot];
+        hold.id = nextId++;
+        hold.itemId = itemId;
+        hold.quantity = quantity;
+        hold.ttl = ttl;
+        hold.deadline = max(now + ttl, wheelTime + 1);   // always ahead of the wheel
+        hold.soldier = soldier;
+        hold.rank = rank;
+        hold.state = HoldState::Waiting;
+        link(slot);
+        slots.emplace(hold.id, slot);
+        countSoldier(hold, quantity);
+        
+        queues[itemId].push_back({hold.id, slot, (uint8_t)rank});
+        push_heap(queues[itemId].begin(), queues[itemId].end());
+        waiting[itemId].add(1);
+        waitingCount++;
+        return hold.id;
+    }
+    
+    Hold* find(uint32_t id) {
+        auto it = slots.find(id);
+        return it == slots.end() ? nullptr : &holds[it->second];
+    }
+    
+    // The first hold in an item's queue, nullptr if none waits
+    Hold* nextWaiter(int itemId) {
+        vector<Waiter>& queue = queues[itemId];
+        while (!queue.empty() && !live(queue.front())) {
+            pop_heap(queue.begin(), queue.end());
+            queue.pop_back();
+            staleWaiters[itemId]--;
+        }
+        return queue.empty() ? nullptr : &holds[queue.front().slot];
+    }
+    
+    // Marks the first waiter as met; its stock has been set aside and its
+    // deadline starts over
+    void promote(int itemId, int64_t now) {
+        vector<Waiter>& queue = queues[itemId];
+        int slot = queue.front().slot;
+        pop_heap(queue.begin(), queue.end());
+        queue.pop_back();
+        
+        Hold& hold = holds[slot];
+        unlink(slot);
+        hold.state = HoldState::Held;
+        hold.deadline = max(now + hold.ttl, wheelTime + 1);
+        link(slot);
+        waiting[itemId].add(-1);
+        waitingCount--;
+        heldCount++;
+    }
+    
+    // Forgets a hold. The caller gives back any stock it had set aside.
+    void remove(uint32_t id) {
+        auto it = slots.find(id);
+        if (it == slots.end()) return;
+        int slot = it->second;
+        Hold& hold = holds[slot];
+        unlink(slot);
+        if (hold.state == HoldState::Waiting) {
+            waiting[hold.itemId].add(-1);
+            waitingCount--;
+            staleWaiters[hold.itemId]++;
+            compact(hold.itemId);
+        } else {
+            heldCount--;
+        }
+        countSoldier(hold, -hold.quantity);
+        hold.state = HoldState::Free;
+        slots.erase(it);
+        freeSlots.push_back(slot);
+    }
+    
+    // Removes the holds whose deadline is at or before now and appends
+    // them to expired. Each second since the last call visits one slot,
+    // and a gap of a full turn or more visits every slot once.
+    void expire(int64_t now, vector<Hold>& expired) {
+        int64_t from = max(wheelTime + 1, now - kWheelSlots + 1);
+        for (int64_t second = from; second <= now; second++) {
+            int slot = wheel[second & (kWheelSlots - 1)];
+            while (slot >= 0) {
+                int next = holds[slot].timerNext;
+                if (holds[slot].deadline <= now) {
+                    expired.push_back(holds[slot]);
+                    remove(holds[slot].id);
+                }
+                slot = next;
+            }
+        }
+        wheelTime = max(wheelTime, now);
+    }
+};
+
+// Report Rendering
+// Reports are rendered into a reused buffer and written out in one go. A
+// rendered report is kept until the state version moves on, so viewing an
+// unchanged inventory again costs a single write. Mutators bump the
+// version after their change has landed and renderers read it before they
+// start, so a change racing a render always forces the next rebuild.
+class VersionCounter {
+private:
+    static constexpr int kStripes = 16;
+    struct alignas(64) Stripe {
+        atomic<uint64_t> count{0};
+    };
+    Stripe stripes[kStripes];   // striped so request threads do not share one cache line
+    
+    static int stripeIndex() {
+        static atomic<int> next{0};
+        thread_local int index = next.fetch_add(1, memory_order_relaxed) % kStripes;
+        return index;
+    }
+    
+public:
+    void bump() { stripes[stripeIndex()].count.fetch_add(1, memory_order_release); }
+    
+    uint64_t read() const {
+        uint64_t total = 0;
+        for (const Stripe& stripe : stripes) total += stripe.count.load(memory_order_acquire);
+        return total;
+    }
+};
+
+enum class ReportKind { CentralInventory, BattalionStatus };
+enum class ReportFormat { Text, Csv, Json };
+constexpr int kReportKindCount = 2;
+constexpr int kReportFormatCount = 3;
+
+inline bool parseReportKind(string_view text, ReportKind& kind) {
+    if (text == "inventory") kind = ReportKind::CentralInventory;
+    else if (text == "battalions") kind = ReportKind::BattalionStatus;
+    else return false;
+    return true;
+}
+
+inline bool parseReportFormat(string_view text, ReportFormat& format) {
+    if (text == "text") format = ReportFormat::Text;
+    else if (text == "csv") format = ReportFormat::Csv;
+    else if (text == "json") format = ReportFormat::Json;
+    else return false;
+    return true;
+}
+
+// Appenders for the render buffers; they bypass iostreams entirely
+inline void appendNumber(string& out, long long value) {
+    char digits[24];
+    out.append(digits, to_chars(digits, digits + sizeof(digits), value).ptr);
+}
+
+inline void appendCsvField(string& out, const string& field) {
+    if (field.find_first_of(",\"\n") == string::npos) {
+        out += field;
+        return;
+    }
+    out += '"';
+    for (char c : field) {
+        if (c == '"') out += '"';
+        out += c;
+    }
+    out += '"';
+}
+
+inline void appendJsonString(string& out, const string& text) {
+    out += '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            static const char hex[] = "0123456789abcdef";
+            out += "\\u00";
+            out += hex[(unsigned char)c >> 4];
+            out += hex[c & 15];
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+struct ReportWrite {
+    size_t bytes;
+    bool cached;   // served from the cache without rendering
+};
+
+class ReportCache {
+private:
+    struct Entry {
+        bool valid = false;
+        uint64_t version = 0;
+        string text;   // keeps its capacity across renders
+    };
+    Entry entries[kReportKindCount][kReportFormatCount];
+    mutex lock;
+    
+public:
+    // Writes the report for the given state version, first calling
+    // render(buffer) if the cached copy belongs to an older version
+    template <typename Render>
+    ReportWrite write(ostream& out, ReportKind kind, ReportFormat format, uint64_t version, Render render) {
+        lock_guard<mutex> guard(lock);
+        Entry& entry = entries[(int)kind][(int)format];
+        bool cached = entry.valid && entry.version == version;
+        if (!cached) {
+            entry.text.clear();
+            render(entry.text);
+            entry.version = version;
+            entry.valid = true;
+        }
+        out.write(entry.text.data(), entry.text.size());
+        out.flush();
+        return {entry.text.size(), cached};
+    }
+};
+
+// Inventory Management System
+// requestItem, allocateToBattalion and deploySoldiers may be called from any
+// number of threads. Catalog changes (addItem), threshold changes, snapshots
+// and the console views expect no concurrent mutators.
+class InventorySystem {
+private:
+    // Struct-of-arrays stock tables, all indexed by item ID. They point into
+    // the state store and move only when the store is laid out anew.
+    ItemCatalog catalog;
+    StateStore store;
+    PaddedCounter* centralInventory = nullptr;
+    int32_t* maxQuantities = nullptr;
+    deque<Battalion> battalions;   // deque keeps battalion names at stable addresses for the log
+    deque<Depot> depots;
+    NameIndex battalionSearch;
+    NameIndex depotSearch;
+    StockRollup rollup;
+    VersionCounter version;     // bumped by every mutation, keys the report cache
+    ReportCache reports;
+    AsyncLogWriter transactionLog;
+    
+    InventoryConfig config;
+    TransactionJournal journal;
+    uint64_t generation = 0;
+    atomic<uint64_t> journalRecords{0};    // records since the last snapshot
+    atomic<bool> journalFailed{false};     // the last append could not be written
+    StockHistory history;                  // folded from the journal at every snapshot
+    
+    LowStockIndex lowStock;
+    Metrics metrics;
+    HoldingsLedger ledger;
+    vector<int> soldierNorms;              // per-soldier allocation norm by item ID
+    ReservationBook reservations;          // guarded by holdLock; not persisted
+    mutex holdLock;
+    ReplenishmentEngine replenishment;     // saved alongside every snapshot
+    bool storeFailed = false;              // the store could not grow; what needed the room was not added
+    bool ready = false;                    // the store opened and holds the initial state
+    
+    // Regional depots and the battalions they supply
+    void initializeBattalions() {
+        int gilgit = addDepot("Gilgit Depot", "Gilgit");
+        int quetta = addDepot("Quetta Depot", "Quetta");
+        int peshawar = addDepot("Peshawar Depot", "Peshawar");
+        addBattalion("1st Northern Light Infantry", "Gilgit", 800, gilgit);
+        addBattalion("6th Baloch Regiment", "Quetta", 750, quetta);
+        addBattalion("11th Frontier Force", "Peshawar", 900, peshawar);
+        addBattalion("17th Punjab Regiment", "Lahore", 850);
+        addBattalion("23rd Sindh Regiment", "Karachi", 700, quetta);
+    }
+    
+    // Initialize central inventory. Standard items are added first so
+    // their IDs match the StandardItem enum.
+    void initializeInventory() {
+        static const int initialStock[kStandardItemCount] = {
+            5000, 3000, 4000, 6000, 8000, 10000, 2000, 3500,
+            1000, 800, 500, 2000, 200, 300, 150
+        };
+        for (int item = 0; item < kStandardItemCount; item++) {
+            addItem(kStandardItemNames[item], initialStock[item]);
+        }
+    }
+    
+    // Points the stock tables, every battalion and every depot at the
+    // store's current layout, and totals the rollups afresh
+    void bindStore() {
+        centralInventory = store.stock();
+        maxQuantities = store.maxQuantities();
+        for (size_t b = 0; b < battalions.size(); b++) {
+            battalions[b].attach(store.battalionRow(b));
+        }
+        for (size_t d = 0; d < depots.size(); d++) {
+            depots[d].attach(store.depotRow(d));
+        }
+        rebuildRollup();
+    }
+    
+    void rebuildRollup() {
+        rollup.reset(store.getItemCapacity(), store.getDepotCapacity());
+        for (int id = 0; id < catalog.size(); id++) {
+            for (size_t d = 0; d < depots.size(); d++) rollup.depotChanged(d, id, depots[d].getHolding(id));
+            for (auto& bat : battalions) rollup.battalionChanged(bat.getDepot(), id, bat.getHolding(id));
+        }
+    }
+    
+    AtomicCounter& holding(Holder holder, int itemId) {
+        switch (holder.kind) {
+            case HolderKind::Depot: return depots[holder.index].holding(itemId);
+            case HolderKind::Battalion: return battalions[holder.index].holding(itemId);
+            default: return centralInventory[itemId];
+        }
+    }
+    
+    // Keeps the rollups in step with a change of a holder's stock
+    void holderChanged(Holder holder, int itemId, int delta) {
+        if (holder.kind == HolderKind::Depot) rollup.depotChanged(holder.index, itemId, delta);
+        if (holder.kind == HolderKind::Battalion) rollup.battalionChanged(battalions[holder.index].getDepot(), itemId, delta);
+    }
+    
+    // Maps the configured store. attached is set if an existing store was
+    // attached, in which case the catalog, stock and battalions come from
+    // it and need no initialization or snapshot. A writer that cannot open,
+    // lock or create its store fails rather than run beside the journal and
+    // snapshot of the process that holds it; a reader falls back to memory.
+    bool openStore(bool& attached) {
+        const uint32_t initialItems = 64, initialBattalions = 16, initialDepots = 8, initialNames = 4096;
+        const string& path = config.storePath;
+        attached = false;
+        if (!path.empty() && ::access(path.c_str(), F_OK) == 0) {
+            if (store.open(path, !config.readOnly) && attachStore()) {
+                attached = true;
+                return true;
+            }
+            if (!config.readOnly) {
+                cerr << "Cannot use state store " << path << ": unreadable, invalid or in use by another process\n";
+                return false;
+            }
+            cerr << "Warning: cannot use state store " << path << ", keeping state in memory\n";
+            if (!store.create("", initialItems, initialBattalions, initialDepots, initialNames)) return false;
+        } else if (!store.create(config.readOnly ? "" : path, initialItems, initialBattalions, initialDepots, initialNames)) {
+            cerr << "Cannot create state store " << path << "\n";
+            return false;
+        }
+        bindStore();
+        return true;
+    }
+    
+    // Makes room in the store for what is about to be added. Returns false,
+    // adding nothing, if a file-backed store could not grow.
+    bool reserveStore(int itemCount, int battalionCount, int depotCount, size_t nameBytes) {
+        StoreGrowth growth = store.reserve(itemCount, battalionCount, depotCount, nameBytes);
+        if (growth == StoreGrowth::Moved) bindStore();
+        if (growth == StoreGrowth::Failed) storeFailed = true;
+        return growth != StoreGrowth::Failed;
+    }
+    
+    bool attachStore() {
+        vector<string> items;
+        vector<pair<string, string>> units, regional;
+        store.forEachName([&](const string& name) { items.push_back(name); },
+                          [&](const string& name, const string& location) { units.push_back({name, location}); },
+                          [&](const string& name, const string& location) { regional.push_back({name, location}); });
+        
+        // Standard item IDs are compiled in, so they must lead the store
+        bool valid = items.size() == store.getItemCount() && units.size() == store.getBattalionCount() &&
+                     regional.size() == store.getDepotCount() && items.size() >= kStandardItemCount;
+        for (int item = 0; item < kStandardItemCount && valid; item++) {
+            valid = items[item] == kStandardItemNames[item];
+        }
+        for (size_t b = 0; b < units.size() && valid; b++) {
+            int supplier = store.battalionRow(b)[1].load();
+            valid = supplier >= 0 && supplier <= (int)regional.size();
+        }
+        if (!valid) return false;
+        
+        for (const string& name : items) catalog.intern(name);
+        for (auto& unit : units) {
+            battalionSearch.insert(unit.first, (int)battalions.size());
+            battalions.emplace_back(move(unit.first), move(unit.second));
+        }
+        for (auto& depot : regional) {
+            depotSearch.insert(depot.first, (int)depots.size());
+            depots.emplace_back(move(depot.first), move(depot.second));
+        }
+        bindStore();
+        lowStock.resize(catalog.size());
+        reservations.resize(catalog.size());
+        replenishment.resize(catalog.size());
+        for (int id = 0; id < catalog.size(); id++) soldierNorms.push_back(defaultNorm(id));
+        return true;
+    }
+    
+    // Battalions are planned to carry the enlisted kit unless told otherwise
+    static int defaultNorm(int itemId) {
+        return itemId < kStandardItemCount ? getEntitlement(Rank::Enlisted, itemId) : 0;
+    }
+    
+    void journalRecord(JournalOp op, int itemId, int quantity, Rank rank, int battalion = -1, uint64_t soldier = 0,
+                       int64_t timestamp = time(0)) {
+        if (!journal.isOpen()) return;
+        bool written = journal.append({timestamp, soldier, itemId, quantity, (int16_t)battalion,
+                                       (uint8_t)rank, (uint8_t)op, 0});
+        journalWritten(written);
+        if (written) journalRecords.fetch_add(1, memory_order_relaxed);
+    }
+    
+    // Warns once when the journal stops taking records and once when it
+    // recovers. Changes made meanwhile reach disk with the next snapshot.
+    void journalWritten(bool written) {
+        if (!written) {
+            int error = errno;
+            if (!journalFailed.exchange(true)) {
+                cerr << "Warning: cannot write journal " << config.journalPath << ": " << strerror(error) << "\n";
+            }
+        } else if (journalFailed.load(memory_order_relaxed) && journalFailed.exchange(false)) {
+            cerr << "Journal " << config.journalPath << " is writable again\n";
+        }
+    }
+    
+    // Keeps the low stock index and the replenishment engine in step with a
+    // change of central stock. Subscribers hear about threshold crossings
+    // from the index; a decrease is demand and may place an order.
+    void centralChanged(int itemId, int before, int after) {
+        lowStock.update(itemId, before, after, centralInventory[itemId]);
+        if (after < before) consumed(itemId, before - after);
+    }
+    
+    void consumed(int itemId, int quantity) {
+        int64_t now = time(0);
+        replenishment.observe(itemId, quantity, now);
+        reorderIfDue(itemId, now);
+    }
+    
+    // Demand that found no stock. A shortfall made only by stock set aside
+    // for holds is not counted, since the holds will take that stock.
+    void unmet(int itemId, int quantity, uint64_t soldier) {
+        if (centralInventory[itemId].load() >= quantity) return;
+        int64_t now = time(0);
+        replenishment.observeUnmet(itemId, quantity, soldier, now);
+        reorderIfDue(itemId, now);
+    }
+    
+    // The batch form of unmet: the item's operations were turned away
+    // together, so the shortfall is judged against their summed demand
+    void unmetBatch(const vector<IssueOperation>& ops, int itemId, int demand) {
+        if (centralInventory[itemId].load() >= demand) return;
+        int64_t now = time(0);
+        for (const IssueOperation& op : ops) {
+            if (op.itemId != itemId) continue;
+            replenishment.observeUnmet(itemId, op.quantity, tracked(op.soldier, op.rank, itemId) ? op.soldier : 0, now);
+        }
+        reorderIfDue(itemId, now);
+    }
+    
+    void reorderIfDue(int itemId, int64_t now) {
+        ReplenishOrder order;
+        if (replenishment.reorder(itemId, centralInventory[itemId], now, order)) {
+            journalRecord(JournalOp::Order, itemId, order.quantity, Rank::FieldMarshall, -1,
+                          ReplenishmentEngine::packOrder(order, now), now);
+        }
+    }
+    
+    // Takes central stock without dipping into what holds have set aside,
+    // apart from ownHold. A hold adds to the held total before it checks the
+    // stock, and a take checks the held total after taking. All four steps
+    // are sequentially consistent, so two racing operations cannot both miss
+    // each other, and whichever notices the other puts its units back.
+    bool takeCentral(int itemId, int quantity, int& before, int ownHold = 0) {
+        if (quantity <= 0) return false;
+        const AtomicCounter& held = reservations.heldCounter(itemId);
+        if (!centralInventory[itemId].tryTake(quantity, before, held.load() - ownHold)) return false;
+        if (before - quantity < held.loadOrdered() - ownHold) {
+            centralInventory[itemId].add(quantity);
+            return false;
+        }
+        return true;
+    }
+    
+    // The other side of takeCentral. Held totals only change under holdLock.
+    bool setAside(int itemId, int quantity) {
+        AtomicCounter& held = reservations.heldCounter(itemId);
+        held.addOrdered(quantity);
+        if (centralInventory[itemId].loadOrdered() < held.load()) {
+            held.add(-quantity);
+            return false;
+        }
+        return true;
+    }
+    
+    // Meets waiting holds in queue order for as long as the free stock
+    // covers the next one. Caller holds holdLock.
+    void serveWaiters(int itemId, int64_t now) {
+        while (Hold* next = reservations.nextWaiter(itemId)) {
+            if (!setAside(itemId, next->quantity)) break;
+            reservations.promote(itemId, now);
+        }
+    }
+    
+    // Stock came back to the central depot; holds waiting for it go first
+    void stockArrived(int itemId) {
+        if (!reservations.hasWaiters(itemId)) return;
+        lock_guard<mutex> guard(holdLock);
+        serveWaiters(itemId, time(0));
+    }
+    
+    // Reserves demand[item] for every touched item. If one cannot be
+    // satisfied, the reservations already made are put back and that item
+    // is returned; -1 means everything was reserved.
+    int reserveAll(const vector<int>& touched, const vector<int>& demand, vector<int>& before) {
+        before.resize(touched.size());
+        for (size_t t = 0; t < touched.size(); t++) {
+            if (!takeCentral(touched[t], demand[touched[t]], before[t])) {
+                for (size_t u = 0; u < t; u++) {
+                    centralInventory[touched[u]].add(demand[touched[u]]);
+                }
+                return touched[t];
+            }
+        }
+        return -1;
+    }
+    
+    template <typename Operation>
+    static int firstOperationFor(const vector<Operation>& ops, int itemId) {
+        for (size_t i = 0; i < ops.size(); i++) {
+            if (ops[i].itemId == itemId) return (int)i;
+        }
+        return -1;
+    }
+    
+    // Reserves ledger headroom for every tracked operation of a batch,
+    // leaving room for the soldier's open holds. On failure the
+    // reservations made so far are undone and the offending operation is
+    // returned; -1 means all fit.
+    int reserveHoldings(const vector<IssueOperation>& ops) {
+        lock_guard<mutex> guard(holdLock);
+        for (size_t i = 0; i < ops.size(); i++) {
+            const IssueOperation& op = ops[i];
+            if (tracked(op.soldier, op.rank, op.itemId) &&
+                !ledger.reserve(op.soldier, op.itemId, op.quantity,
+                                getEntitlement(op.rank, op.itemId) - reservations.soldierHoldUnits(op.soldier, op.itemId))) {
+                releaseHoldings(ops, i);
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+    
+    void releaseHoldings(const vector<IssueOperation>& ops, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (tracked(ops[i].soldier, ops[i].rank, ops[i].itemId)) {
+                ledger.release(ops[i].soldier, ops[i].itemId, ops[i].quantity);
+            }
+        }
+    }
+    
+    static JournalRecord batchHeader() {
+        return {(int64_t)time(0), 0, 0, 0, -1, 0, (uint8_t)JournalOp::Batch, 0};
+    }
+    
+    void commitBatch(vector<JournalRecord>& records) {
+        records[0].quantity = (int32_t)records.size() - 1;
+        if (!journal.isOpen()) return;
+        bool written = journal.appendBatch(records);
+        journalWritten(written);
+        if (written) journalRecords.fetch_add(records.size(), memory_order_relaxed);
+    }
+    
+    // With ledgerOnly set the stock effects are skipped, because an
+    // attached store already holds them.
+    void replayRecord(const JournalRecord& rec, bool ledgerOnly) {
+        if (rec.itemId < 0 || rec.itemId >= catalog.size()) return;
+        if (rec.battalion >= (int)battalions.size()) return;
+        
+        if (rec.soldier != 0 && rec.itemId < kStandardItemCount) {
+            if ((JournalOp)rec.op == JournalOp::Issue) ledger.apply(rec.soldier, rec.itemId, rec.quantity);
+            if ((JournalOp)rec.op == JournalOp::Return) ledger.apply(rec.soldier, rec.itemId, -rec.quantity);
+        }
+        replayDemand(rec);
+        if (ledgerOnly) return;
+        
+        switch ((JournalOp)rec.op) {
+            case JournalOp::Issue:
+                centralInventory[rec.itemId].add(-rec.quantity);
+                break;
+            case JournalOp::Return:
+                centralInventory[rec.itemId].add(rec.quantity);
+                break;
+            case JournalOp::Allocate:
+                if (rec.battalion < 0) return;
+                centralInventory[rec.itemId].add(-rec.quantity);
+                battalions[rec.battalion].addEquipment(rec.itemId, rec.quantity);
+                break;
+            case JournalOp::Deploy:
+                if (rec.battalion < 0) return;
+                battalions[rec.battalion].addSoldiers(rec.quantity);
+                break;
+            case JournalOp::Restock:
+                centralInventory[rec.itemId].add(rec.quantity);
+                maxQuantities[rec.itemId] = max(maxQuantities[rec.itemId], centralInventory[rec.itemId].load());
+                break;
+            case JournalOp::Transfer: {
+                Holder from = Holder::unpack(rec.soldier >> 32), to = Holder::unpack((uint32_t)rec.soldier);
+                if (!isHolder(from) || !isHolder(to)) return;
+                holding(from, rec.itemId).add(-rec.quantity);
+                holding(to, rec.itemId).add(rec.quantity);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    
+    // The replenishment engine is not part of the store, so it relearns the
+    // journal tail and its orders in either case. Unmet requests are not
+    // journaled and are only learned live.
+    void replayDemand(const JournalRecord& rec) {
+        ReplenishOrder order = ReplenishmentEngine::unpackOrder(rec.soldier, rec.timestamp, rec.itemId, rec.quantity);
+        switch ((JournalOp)rec.op) {
+            case JournalOp::Issue:
+            case JournalOp::Allocate:
+                replenishment.observe(rec.itemId, rec.quantity, rec.timestamp);
+                break;
+            case JournalOp::Transfer:
+                if (Holder::unpack(rec.soldier >> 32).kind == HolderKind::Central) {
+                    replenishment.observe(rec.itemId, rec.quantity, rec.timestamp);
+                }
+                break;
+            case JournalOp::Order:
+                replenishment.replayOrder(order);
+                break;
+            case JournalOp::Restock:
+                if (rec.soldier != 0) replenishment.replayReceipt(order.id);
+                break;
+            default:
+                break;
+        }
+    }
+    
+    // Folds the current journal generation and the live stock into the
+    // history, tagged with the generation of the snapshot being written
+    bool foldHistory(uint64_t nextGeneration) {
+        vector<JournalRecord> records;
+        TransactionJournal::replay(config.journalPath, generation, [&](const JournalRecord& rec) { records.push_back(rec); });
+        vector<pair<uint64_t, int>> live;
+        for (int id = 0; id < catalog.size(); id++) {
+            int stock = centralInventory[id].load();
+            if (stock != 0) live.push_back({StockHistory::cellKey({HolderKind::Central, 0}, id), stock});
+            for (size_t d = 0; d < depots.size(); d++) {
+                int held = depots[d].getHolding(id);
+                if (held != 0) live.push_back({StockHistory::cellKey({HolderKind::Depot, (int)d}, id), held});
+            }
+            for (size_t b = 0; b < battalions.size(); b++) {
+                int held = battalions[b].getHolding(id);
+                if (held != 0) live.push_back({StockHistory::cellKey({HolderKind::Battalion, (int)b}, id), held});
+            }
+        }
+        return history.fold(records, move(live), time(0), nextGeneration);
+    }
+    
+    // With ledgerOnly set only the holdings ledger is restored; an attached
+    // store already holds the catalog, stock and battalions.
+    bool loadSnapshot(bool ledgerOnly) {
+        int in = ::open(config.snapshotPath.c_str(), O_RDONLY);
+        if (in < 0) return false;
+        struct stat st;
+        if (::fstat(in, &st) != 0 || st.st_size < (off_t)sizeof(SnapshotHeader)) {
+            ::close(in);
+            return false;
+        }
+        void* mapped = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, in, 0);
+        ::close(in);
+        if (mapped == MAP_FAILED) return false;
+        
+        const char* base = static_cast<const char*>(mapped);
+        SnapshotHeader header;
+        memcpy(&header, base, sizeof(header));
+        size_t stockBytes = (size_t)header.itemCount * 2 * sizeof(int32_t);
+        size_t battalionBytes = (size_t)header.battalionCount * (kBattalionRowHeader + header.itemCount) * sizeof(int32_t);
+        size_t depotBytes = (size_t)header.depotCount * header.itemCount * sizeof(int32_t);
+        size_t tableBytes = stockBytes + battalionBytes + depotBytes;
+        size_t ledgerBytes = (size_t)header.soldierCount * sizeof(HoldingsLedger::Entry);
+        size_t orderBytes = (size_t)header.orderCount * sizeof(ReplenishOrder);
+        bool valid = memcmp(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) == 0 &&
+                     header.battalionCount >= battalions.size() && header.depotCount >= depots.size() &&
+                     sizeof(header) + tableBytes + ledgerBytes + orderBytes + header.namesBytes == (size_t)st.st_size;
+        
+        if (valid && !ledgerOnly) {
+            // Re-intern the names in ID order; standard items keep their IDs
+            const char* names = base + sizeof(header) + tableBytes + ledgerBytes + orderBytes;
+            const char* namesEnd = names + header.namesBytes;
+            for (uint32_t id = 0; id < header.itemCount && valid; id++) {
+                size_t len = strnlen(names, namesEnd - names);
+                valid = names + len < namesEnd && addItem(string(names, len), 0) == (int)id;
+                names += len + 1;
+            }
+            auto nextPair = [&](string& name, string& location) {
+                size_t nameLen = strnlen(names, namesEnd - names);
+                if (names + nameLen >= namesEnd) return false;
+                name.assign(names, nameLen);
+                names += nameLen + 1;
+                size_t locLen = strnlen(names, namesEnd - names);
+                if (names + locLen >= namesEnd) return false;
+                location.assign(names, locLen);
+                names += locLen + 1;
+                return true;
+            };
+            // Existing battalions and depots must match; ones added at runtime are recreated
+            string name, location;
+            for (uint32_t b = 0; b < header.battalionCount && valid; b++) {
+                valid = nextPair(name, location);
+                if (valid && b < battalions.size()) valid = battalions[b].getName() == name;
+                else if (valid) addBattalion(name, location, 0);
+            }
+            for (uint32_t d = 0; d < header.depotCount && valid; d++) {
+                valid = nextPair(name, location);
+                if (valid && d < depots.size()) valid = depots[d].getName() == name;
+                else if (valid) addDepot(name, location);
+            }
+        }
+        
+        if (valid && !ledgerOnly) {
+            const int32_t* stock = reinterpret_cast<const int32_t*>(base + sizeof(header));
+            for (uint32_t id = 0; id < header.itemCount; id++) {
+                centralInventory[id].store(stock[2 * id]);
+                maxQuantities[id] = stock[2 * id + 1];
+            }
+            const int32_t* rows = stock + 2 * header.itemCount;
+            for (uint32_t b = 0; b < header.battalionCount; b++) {
+                int depot = rows[1] >= 0 && rows[1] < (int)header.depotCount ? rows[1] : -1;
+                battalions[b].restoreState(rows[0], depot, rows + kBattalionRowHeader, header.itemCount);
+                rows += kBattalionRowHeader + header.itemCount;
+            }
+            for (uint32_t d = 0; d < header.depotCount; d++) {
+                for (uint32_t id = 0; id < header.itemCount; id++) depots[d].holding(id).store(rows[id]);
+                rows += header.itemCount;
+            }
+        }
+        if (valid) {
+            // Ledger records follow unaligned after the int32 tables
+            const char* records = base + sizeof(header) + tableBytes;
+            for (uint32_t i = 0; i < header.soldierCount; i++) {
+                HoldingsLedger::Entry record;
+                memcpy(&record, records + i * sizeof(record), sizeof(record));
+                ledger.restore(record);
+            }
+            vector<ReplenishOrder> orders(header.orderCount);
+            if (orderBytes > 0) memcpy(orders.data(), records + ledgerBytes, orderBytes);
+            replenishment.restoreOrders(orders, header.nextOrderId);
+            generation = header.generation;
+        }
+        ::munmap(mapped, st.st_size);
+        return valid;
+    }
+    
+public:
+    // Check isReady() before use: a system whose store could not be opened
+    // or grown to hold its initial state must not be used, and touches no
+    // journal or snapshot.
+    explicit InventorySystem(const InventoryConfig& cfg = InventoryConfig())
+        : transactionLog(cfg.log), config(cfg), replenishment(cfg.replenish) {
+        metrics.setSampleInterval(config.metricsSampleInterval);
+        bool attached;
+        if (!openStore(attached)) return;
+        if (!attached) {
+            initializeBattalions();
+            initializeInventory();
+        }
+        if (storeFailed) return;
+        
+        if (!config.journalPath.empty()) {
+            loadSnapshot(attached);
+            if (storeFailed) return;
+            replenishment.load(config.replenish.path);
+            journalRecords = TransactionJournal::replay(config.journalPath, generation,
+                [this, attached](const JournalRecord& rec) { replayRecord(rec, attached); });
+            if (!config.readOnly) journal.open(config.journalPath, generation, config.fsyncJournal);
+            if (!config.historyPath.empty()) history.open(config.historyPath, generation, !config.readOnly);
+        }
+        
+        // Recovery bypasses the index and the rollups, so file every item by
+        // its recovered stock and total the rollups once
+        for (int id = 0; id < catalog.size(); id++) {
+            lowStock.setCapacity(id, maxQuantities[id], centralInventory[id].load());
+        }
+        rebuildRollup();
+        
+        // Items that were left at or below their reorder point are ordered now
+        if (!config.readOnly) {
+            for (int id = 0; id < catalog.size(); id++) reorderIfDue(id, time(0));
+        }
+        
+        // A new history starts from a snapshot of the current stock
+        if (journal.isOpen() && history.isOpen() && history.empty()) saveSnapshot();
+        ready = true;
+    }
+    
+    bool isReady() const { return ready; }
+    
+    ~InventorySystem() {
+        if (journal.isOpen() && journalRecords > 0) {
+            saveSnapshot();
+        }
+        store.sync();
+    }
+    
+    // Takes the periodic snapshot once snapshotInterval journal records have
+    // accumulated. Call from a point where no requests are in flight.
+    void checkpointIfDue() {
+        if (isCheckpointDue()) saveSnapshot();
+    }
+    
+    // Safe to call while requests are in flight
+    bool isCheckpointDue() const {
+        return journalRecords.load(memory_order_relaxed) >= config.snapshotInterval;
+    }
+    
+    // Registers a callback for low stock threshold crossings and returns
+    // the handle that removes it again
+    int subscribeLowStock(LowStockIndex::Subscriber subscriber) {
+        return lowStock.subscribe(move(subscriber));
+    }
+    
+    void unsubscribeLowStock(int subscription) {
+        lowStock.unsubscribe(subscription);
+    }
+    
+    // Overrides the default 50% threshold of an item
+    void setLowStockThreshold(int itemId, int threshold) {
+        lowStock.setThreshold(itemId, threshold, centralInventory[itemId].load());
+        version.bump();
+    }
+    
+    int getLowStockThreshold(int itemId) const { return lowStock.getThreshold(itemId); }
+    vector<int> getLowStockItems() const { return lowStock.belowThreshold(); }
+    
+    vector<int> getMostDepletedItems(int n) const {
+        return lowStock.mostDepleted(n, [this](int id) { return centralInventory[id].load(); });
+    }
+    
+    // Books an open replenishment order into the central depot once an
+    // officer confirms it has physically arrived, handing the stock to
+    // waiting holds first. Returns false if no order with that ID is open.
+    // Call between requests, like checkpointIfDue.
+    bool receiveOrder(uint32_t orderId, Rank rank, ReplenishOrder& order) {
+        if (!replenishment.receive(orderId, order)) return false;
+        int id = order.itemId, after = centralInventory[id].add(order.quantity);
+        if (after > maxQuantities[id]) {
+            maxQuantities[id] = after;
+            lowStock.setCapacity(id, after, after);
+        }
+        centralChanged(id, after - order.quantity, after);
+        stockArrived(id);
+        int64_t now = time(0);
+        journalRecord(JournalOp::Restock, id, order.quantity, rank, -1, ReplenishmentEngine::packOrder(order, now), now);
+        version.bump();
+        return true;
+    }
+    
+    // Changes how long orders of an item take to arrive; the new reorder
+    // point applies at once
+    void setLeadTime(int itemId, int64_t seconds) {
+        replenishment.setLeadTime(itemId, seconds);
+        reorderIfDue(itemId, time(0));
+        saveSnapshot();
+    }
+    
+    ItemForecast getForecast(int itemId, int64_t now = time(0)) { return replenishment.forecast(itemId, now); }
+    vector<ReplenishOrder> getReplenishOrders() const { return replenishment.getOrders(); }
+    int64_t getForecastPeriod() const { return replenishment.getConfig().periodSeconds; }
+    
+    // When the central stock of an item runs out at its learned rate if
+    // nothing arrives; 0 when no demand has been learned
+    int64_t projectDepletion(int itemId, const ItemForecast& forecast, int64_t now = time(0)) const {
+        if (forecast.rate <= 0) return 0;
+        double periods = centralInventory[itemId].load() / forecast.rate;
+        return now + (int64_t)min(periods * getForecastPeriod(), 1e12);
+    }
+    
+    // Writes a compact snapshot of all stock and battalion state, then
+    // restarts the journal. The snapshot is written to a temporary file and
+    // renamed into place, so a crash leaves either the old or the new one.
+    bool saveSnapshot() {
+        if (!journal.isOpen()) return false;
+        
+        string names;
+        for (int id = 0; id < catalog.size(); id++) {
+            names += catalog.getName(id);
+            names += '\0';
+        }
+        for (auto& bat : battalions) {
+            names += bat.getName();
+            names += '\0';
+            names += bat.getLocation();
+            names += '\0';
+        }
+        for (auto& depot : depots) {
+            names += depot.getName();
+            names += '\0';
+            names += depot.getLocation();
+            names += '\0';
+        }
+        SnapshotHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+        header.generation = generation + 1;
+        header.itemCount = catalog.size();
+        header.battalionCount = battalions.size();
+        header.depotCount = depots.size();
+        header.namesBytes = names.size();
+        vector<HoldingsLedger::Entry> soldiers;
+        ledger.collect(soldiers);
+        header.soldierCount = soldiers.size();
+        vector<ReplenishOrder> orders;
+        header.nextOrderId = replenishment.collectOrders(orders);
+        header.orderCount = orders.size();
+        
+        vector<int32_t> body;
+        body.reserve(2 * catalog.size() + battalions.size() * (kBattalionRowHeader + catalog.size()) +
+                     depots.size() * catalog.size());
+        for (int id = 0; id < catalog.size(); id++) {
+            body.push_back(centralInventory[id].load());
+            body.push_back(maxQuantities[id]);
+        }
+        for (auto& bat : battalions) {
+            body.push_back(bat.getSoldierCount());
+            body.push_back(bat.getDepot());
+            for (int id = 0; id < catalog.size(); id++) body.push_back(bat.getHolding(id));
+        }
+        for (auto& depot : depots) {
+            for (int id = 0; id < catalog.size(); id++) body.push_back(depot.getHolding(id));
+        }
+        
+        string tmpPath = config.snapshotPath + ".tmp";
+        int out = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) return false;
+        bool ok = ::write(out, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+                  ::write(out, body.data(), body.size() * sizeof(int32_t)) == (ssize_t)(body.size() * sizeof(int32_t)) &&
+                  ::write(out, soldiers.data(), soldiers.size() * sizeof(HoldingsLedger::Entry)) ==
+                      (ssize_t)(soldiers.size() * sizeof(HoldingsLedger::Entry)) &&
+                  ::write(out, orders.data(), orders.size() * sizeof(ReplenishOrder)) ==
+                      (ssize_t)(orders.size() * sizeof(ReplenishOrder)) &&
+                  ::write(out, names.data(), names.size()) == (ssize_t)names.size() &&
+                  ::fsync(out) == 0;
+        ::close(out);
+        
+        // The journal about to be retired goes into the history first; its
+        // frame is taken back out if the snapshot does not land
+        bool folded = ok && history.isOpen() && foldHistory(header.generation);
+        if (!ok || ::rename(tmpPath.c_str(), config.snapshotPath.c_str()) != 0) {
+            ::unlink(tmpPath.c_str());
+            if (folded) history.rollback();
+            return false;
+        }
+        if (folded) history.commit();
+        replenishment.save(config.replenish.path, header.generation);
+        
+        generation = header.generation;
+        journalRecords = 0;
+        store.sync();
+        journal.restart(generation);
+        return true;
+    }
+    
+    // Adds a battalion supplied by the given depot (-1 for the central
+    // depot) and returns its index, or -1 once kMaxBattalions exist or the
+    // store cannot grow. Like new items, new battalions are captured by a
+    // snapshot rather than by journal records.
+    int addBattalion(const string& name, const string& location, int soldierCount, int depot = -1) {
+        if ((int)battalions.size() >= kMaxBattalions) return -1;
+        if (!reserveStore(catalog.size(), battalions.size() + 1, depots.size(), StateStore::nameBytes(name, &location))) return -1;
+        battalionSearch.insert(name, (int)battalions.size());
+        battalions.emplace_back(name, location);
+        battalions.back().attach(store.battalionRow(store.addBattalion(name, location)));
+        battalions.back().addSoldiers(soldierCount);
+        battalions.back().setDepot(depot >= 0 && depot < (int)depots.size() ? depot : -1);
+        version.bump();
+        saveSnapshot();
+        return (int)battalions.size() - 1;
+    }
+    
+    // Adds an empty regional depot and returns its index, or -1 if the store cannot grow
+    int addDepot(const string& name, const string& location) {
+        if (!reserveStore(catalog.size(), battalions.size(), depots.size() + 1, StateStore::nameBytes(name, &location))) return -1;
+        depotSearch.insert(name, (int)depots.size());
+        depots.emplace_back(name, location);
+        depots.back().attach(store.depotRow(store.addDepot(name, location)));
+        version.bump();
+        saveSnapshot();
+        return (int)depots.size() - 1;
+    }
+    
+    // Moves a battalion under another depot (-1 for the central depot); its
+    // holdings move to the new region's totals. Expects no concurrent mutators.
+    void assignBattalion(int battalionIndex, int depot) {
+        Battalion& battalion = battalions[battalionIndex];
+        int previous = battalion.getDepot();
+        if (previous == depot) return;
+        battalion.setDepot(depot);
+        for (int id = 0; id < catalog.size(); id++) {
+            rollup.battalionMoved(previous, depot, id, battalion.getHolding(id));
+        }
+        version.bump();
+        saveSnapshot();
+    }
+    
+    // Adds a new catalog item (or restocks an existing one) and returns its
+    // ID, or -1 if the store cannot grow. The initial quantity is remembered
+    // as the item's capacity for low inventory alerts.
+    int addItem(const string& item, int quantity) {
+        bool isNew = catalog.find(item) < 0;
+        if (isNew && !reserveStore(catalog.size() + 1, battalions.size(), depots.size(), StateStore::nameBytes(item))) return -1;
+        int id = catalog.intern(item);
+        if (isNew) {
+            store.addItem(item);
+            lowStock.resize(catalog.size());
+            {
+                lock_guard<mutex> guard(holdLock);
+                reservations.resize(catalog.size());
+            }
+            replenishment.resize(catalog.size());
+            soldierNorms.push_back(defaultNorm(id));
+        }
+        int stock = centralInventory[id].add(quantity);
+        maxQuantities[id] = max(maxQuantities[id], stock);
+        lowStock.setCapacity(id, maxQuantities[id], stock);
+        if (quantity > 0) stockArrived(id);
+        version.bump();
+        
+        // Journal records carry only item IDs, so new names go straight into a snapshot
+        if (isNew) {
+            saveSnapshot();
+        } else if (quantity != 0) {
+            journalRecord(JournalOp::Restock, id, quantity, Rank::FieldMarshall);
+        }
+        return id;
+    }
+    
+    // Writes a report, rendering it only if the state changed since the
+    // last time it was written in that format
+    ReportWrite writeReport(ostream& out, ReportKind kind, ReportFormat format) {
+        uint64_t current = version.read();
+        return reports.write(out, kind, format, current, [&](string& buffer) {
+            if (kind == ReportKind::CentralInventory) renderCentralInventory(buffer, format, current);
+            else renderBattalionStatus(buffer, format, current);
+        });
+    }
+    
+    void displayCentralInventory() { writeReport(cout, ReportKind::CentralInventory, ReportFormat::Text); }
+    void displayBattalionStatus() { writeReport(cout, ReportKind::BattalionStatus, ReportFormat::Text); }
+    
+private:
+    // Items in name order, as in the console menus
+    void renderCentralInventory(string& out, ReportFormat format, uint64_t stateVersion) {
+        if (format == ReportFormat::Text) out += "\nCENTRAL INVENTORY:\n";
+        if (format == ReportFormat::Csv) out += "id,item,stock,max,threshold,low_stock\n";
+        if (format == ReportFormat::Json) {
+            out += "{\"version\": ";
+            appendNumber(out, stateVersion);
+            out += ", \"items\": [";
+        }
+        for (int i = 0; i < catalog.size(); i++) {
+            int id = catalog.getSortedId(i);
+            const string& name = catalog.getName(id);
+            bool low = lowStock.isBelow(id);
+            switch (format) {
+                case ReportFormat::Text:
+                    appendNumber(out, i + 1);
+                    out += ". ";
+                    out += name;
+                    out += ": ";
+                    appendNumber(out, centralInventory[id].load());
+                    if (low) out += " (LOW STOCK!)";
+                    out += '\n';
+                    break;
+                case ReportFormat::Csv:
+                    appendNumber(out, id);
+                    out += ',';
+                    appendCsvField(out, name);
+                    out += ',';
+                    appendNumber(out, centralInventory[id].load());
+                    out += ',';
+                    appendNumber(out, maxQuantities[id]);
+                    out += ',';
+                    appendNumber(out, lowStock.getThreshold(id));
+                    out += low ? ",1\n" : ",0\n";
+                    break;
+                case ReportFormat::Json:
+                    out += i == 0 ? "\n  {\"id\": " : ",\n  {\"id\": ";
+                    appendNumber(out, id);
+                    out += ", \"name\": ";
+                    appendJsonString(out, name);
+                    out += ", \"stock\": ";
+                    appendNumber(out, centralInventory[id].load());
+                    out += ", \"max\": ";
+                    appendNumber(out, maxQuantities[id]);
+                    out += ", \"threshold\": ";
+                    appendNumber(out, lowStock.getThreshold(id));
+                    out += low ? ", \"low_stock\": true}" : ", \"low_stock\": false}";
+                    break;
+            }
+        }
+        if (format == ReportFormat::Json) out += "\n]}\n";
+    }
+    
+    // CSV has one row per battalion and held item; a battalion holding
+    // nothing still gets a row with an empty item
+    void renderBattalionStatus(string& out, ReportFormat format, uint64_t stateVersion) {
+        if (format == ReportFormat::Text) {
+            out += "\nBATTALION STATUS:\n";
+            for (const Battalion& bat : battalions) bat.render(out, catalog);
+            return;
+        }
+        if (format == ReportFormat::Csv) out += "battalion,location,depot,soldiers,item,quantity\n";
+        if (format == ReportFormat::Json) {
+            out += "{\"version\": ";
+            appendNumber(out, stateVersion);
+            out += ", \"battalions\": [";
+        }
+        for (size_t b = 0; b < battalions.size(); b++) {
+            const Battalion& bat = battalions[b];
+            const string& depot = holderName({bat.getDepot() < 0 ? HolderKind::Central : HolderKind::Depot, bat.getDepot()});
+            if (format == ReportFormat::Json) {
+                out += b == 0 ? "\n  {\"name\": " : ",\n  {\"name\": ";
+                appendJsonString(out, bat.getName());
+                out += ", \"location\": ";
+                appendJsonString(out, bat.getLocation());
+                out += ", \"depot\": ";
+                appendJsonString(out, depot);
+                out += ", \"soldiers\": ";
+                appendNumber(out, bat.getSoldierCount());
+                out += ", \"holdings\": {";
+            }
+            bool any = false;
+            for (int i = 0; i < catalog.size(); i++) {
+                int id = catalog.getSortedId(i);
+                int quantity = bat.getHolding(id);
+                if (quantity <= 0) continue;
+                if (format == ReportFormat::Csv) {
+                    appendCsvField(out, bat.getName());
+                    out += ',';
+                    appendCsvField(out, bat.getLocation());
+                    out += ',';
+                    appendCsvField(out, depot);
+                    out += ',';
+                    appendNumber(out, bat.getSoldierCount());
+                    out += ',';
+                    appendCsvField(out, catalog.getName(id));
+                    out += ',';
+                    appendNumber(out, quantity);
+                    out += '\n';
+                } else {
+                    if (any) out += ", ";
+                    appendJsonString(out, catalog.getName(id));
+                    out += ": ";
+                    appendNumber(out, quantity);
+                }
+                any = true;
+            }
+            if (format == ReportFormat::Json) {
+                out += "}}";
+            } else if (!any) {
+                appendCsvField(out, bat.getName());
+                out += ',';
+                appendCsvField(out, bat.getLocation());
+                out += ',';
+                appendCsvField(out, depot);
+                out += ',';
+                appendNumber(out, bat.getSoldierCount());
+                out += ",,0\n";
+            }
+        }
+        if (format == ReportFormat::Json) out += "\n]}\n";
+    }
+    
+public:
+    
+    // Console/API boundary: resolves the item name once
+    RequestResult requestItem(const string& item, int quantity, Rank rank, uint64_t soldier = 0) {
+        int itemId = catalog.find(item);
+        if (itemId < 0) return RequestResult::UnknownItem;
+        return requestItem(itemId, quantity, rank, soldier);
+    }
+    
+    // Issues an item to a soldier. With a ledger key (HoldingsLedger::soldierKey)
+    // the rank entitlement caps what the soldier holds in total; without
+    // one it caps this request only.
+    RequestResult requestItem(int itemId, int quantity, Rank rank, uint64_t soldier = 0) {
+        MetricsShard& shard = metrics.local();
+        bool timed = shard.sample(metrics.getSampleInterval());
+        uint64_t start = timed ? Metrics::startTimer() : 0;
+        RequestResult result = issueItem(itemId, quantity, rank, soldier);
+        
+        if (timed) shard.requestLatency.record(Metrics::elapsed(start));
+        MetricsShard::bump(shard.requestOutcomes[(int)result]);
+        if (result == RequestResult::Success) metrics.countIssue(shard, itemId, quantity);
+        return result;
+    }
+    
+    // Transfers stock from the central inventory to a battalion. The central
+    // decrement is a CAS, so concurrent allocations can never overdraw it.
+    bool allocateToBattalion(int battalionIndex, int itemId, int quantity, Rank rank) {
+        MetricsShard& shard = metrics.local();
+        bool timed = shard.sample(metrics.getSampleInterval());
+        uint64_t start = timed ? Metrics::startTimer() : 0;
+        bool allocated = transferToBattalion(battalionIndex, itemId, quantity, rank);
+        
+        if (timed) shard.allocationLatency.record(Metrics::elapsed(start));
+        MetricsShard::bump(allocated ? shard.allocations : shard.allocationFailures);
+        if (allocated) metrics.countAllocation(shard, battalionIndex, quantity);
+        return allocated;
+    }
+    
+    // Checks items back in from a soldier and restocks the central
+    // inventory. A tracked soldier can only return what the ledger says
+    // they hold; high ranks are not tracked and may return anything.
+    RequestResult returnItem(int itemId, int quantity, Rank rank, uint64_t soldier = 0) {
+        if (itemId < 0 || itemId >= catalog.size() || quantity <= 0) return RequestResult::UnknownItem;
+        MetricsShard& shard = metrics.local();
+        if (!isHighRank(rank)) {
+            if (soldier == 0 || itemId >= kStandardItemCount || !ledger.release(soldier, itemId, quantity)) {
+                MetricsShard::bump(shard.requestOutcomes[(int)RequestResult::NotHeld]);
+                return RequestResult::NotHeld;
+            }
+        } else {
+            soldier = 0;
+        }
+        
+        int after = centralInventory[itemId].add(quantity);
+        journalRecord(JournalOp::Return, itemId, quantity, rank, -1, soldier);
+        transactionLog.enqueue({time(0), &catalog.getName(itemId), nullptr, quantity, rank, true});
+        centralChanged(itemId, after - quantity, after);
+        stockArrived(itemId);
+        MetricsShard::bump(shard.returns);
+        version.bump();
+        return RequestResult::Success;
+    }
+    
+    int getHolding(uint64_t soldier, int itemId) const {
+        return itemId < kStandardItemCount ? ledger.holding(soldier, itemId) : 0;
+    }
+    size_t getTrackedSoldiers() const { return ledger.size(); }
+    
+    // Places a hold for a soldier. Stock that is free now is set aside at
+    // once; otherwise the hold waits behind higher ranks and earlier holds
+    // until returns or restocks free enough. A hold lapses ttl seconds after
+    // it was placed or met unless it is collected first.
+    // The soldier's items on hand and in open holds together stay within
+    // the entitlement.
+    HoldResult placeHold(int itemId, int quantity, Rank rank, uint64_t soldier, int ttl = kDefaultHoldSeconds) {
+        if (itemId < 0 || itemId >= catalog.size() || quantity <= 0 || ttl <= 0) return {RequestResult::UnknownItem, 0, false};
+        int limit = getEntitlement(rank, itemId);
+        if (quantity > limit) return {RequestResult::RankLimitExceeded, 0, false};
+        
+        lock_guard<mutex> guard(holdLock);
+        if (tracked(soldier, rank, itemId) &&
+            ledger.holding(soldier, itemId) + reservations.soldierHoldUnits(soldier, itemId) + quantity > limit) {
+            return {RequestResult::HoldingLimitExceeded, 0, false};
+        }
+        int64_t now = time(0);
+        uint32_t id = reservations.add(itemId, quantity, rank, soldier, ttl, now);
+        serveWaiters(itemId, now);
+        return {RequestResult::Success, id, reservations.find(id)->state == HoldState::Waiting};
+    }
+    
+    // Issues a met hold to its owner. NotHeld means the hold is unknown,
+    // belongs to someone else or is still waiting for stock.
+    RequestResult collectHold(uint32_t id, uint64_t soldier) {
+        lock_guard<mutex> guard(holdLock);
+        Hold* hold = reservations.find(id);
+        if (!hold || hold->soldier != soldier || hold->state != HoldState::Held) return RequestResult::NotHeld;
+        
+        int itemId = hold->itemId, quantity = hold->quantity;
+        RequestResult result = issueItem(itemId, quantity, hold->rank, soldier, quantity);
+        MetricsShard& shard = metrics.local();
+        MetricsShard::bump(shard.requestOutcomes[(int)result]);
+        if (result != RequestResult::Success) return result;
+        metrics.countIssue(shard, itemId, quantity);
+        reservations.heldCounter(itemId).add(-quantity);
+        reservations.remove(id);
+        return result;
+    }
+    
+    // Withdraws a soldier's hold; stock it had set aside goes to the next waiter
+    bool cancelHold(uint32_t id, uint64_t soldier) {
+        lock_guard<mutex> guard(holdLock);
+        Hold* hold = reservations.find(id);
+        if (!hold || hold->soldier != soldier) return false;
+        int itemId = hold->itemId, quantity = hold->quantity;
+        bool wasHeld = hold->state == HoldState::Held;
+        reservations.remove(id);
+        if (wasHeld) {
+            reservations.heldCounter(itemId).add(-quantity);
+            serveWaiters(itemId, time(0));
+        }
+        return true;
+    }
+    
+    // Drops the holds whose deadline has passed, handing their stock on to
+    // the next waiters. Called between requests; returns how many lapsed.
+    size_t expireHolds(int64_t now = time(0)) {
+        lock_guard<mutex> guard(holdLock);
+        vector<Hold> expired;
+        reservations.expire(now, expired);
+        for (const Hold& hold : expired) {
+            if (hold.state == HoldState::Held) reservations.heldCounter(hold.itemId).add(-hold.quantity);
+        }
+        for (const Hold& hold : expired) {
+            if (hold.state == HoldState::Held) serveWaiters(hold.itemId, now);
+        }
+        return expired.size();
+    }
+    
+    bool getHold(uint32_t id, Hold& hold) {
+        lock_guard<mutex> guard(holdLock);
+        Hold* found = reservations.find(id);
+        if (found) hold = *found;
+        return found != nullptr;
+    }
+    
+    int getHeldStock(int itemId) const { return reservations.heldUnits(itemId); }
+    
+    int getSoldierHoldUnits(uint64_t soldier, int itemId) {
+        lock_guard<mutex> guard(holdLock);
+        return reservations.soldierHoldUnits(soldier, itemId);
+    }
+    
+    // Central stock not set aside for holds, i.e. what a request can take
+    int getFreeStock(int itemId) const { return max(0, getStock(itemId) - getHeldStock(itemId)); }
+    
+    void getHoldCounts(size_t& waiting, size_t& held) {
+        lock_guard<mutex> guard(holdLock);
+        waiting = reservations.getWaitingCount();
+        held = reservations.getHeldCount();
+    }
+    
+private:
+    // Whether a request counts against the soldier's ledger record
+    static bool tracked(uint64_t soldier, Rank rank, int itemId) {
+        return soldier != 0 && !isHighRank(rank) && itemId < kStandardItemCount;
+    }
+    
+    // ownHold is stock the caller's own hold set aside, which it may take.
+    // A caller passing one already holds holdLock.
+    RequestResult issueItem(int itemId, int quantity, Rank rank, uint64_t soldier, int ownHold = 0) {
+        // Check rank-based quantity restrictions
+        int limit = getEntitlement(rank, itemId);
+        if (quantity > limit) {
+            return RequestResult::RankLimitExceeded;
+        }
+        if (!tracked(soldier, rank, itemId)) {
+            soldier = 0;
+        } else {
+            // The soldier's other open holds count against the entitlement,
+            // as they do in placeHold; holdLock keeps the two checks apart
+            unique_lock<mutex> guard(holdLock, defer_lock);
+            if (ownHold == 0) guard.lock();
+            int otherHolds = reservations.soldierHoldUnits(soldier, itemId) - ownHold;
+            if (!ledger.reserve(soldier, itemId, quantity, limit - otherHolds)) {
+                return RequestResult::HoldingLimitExceeded;
+            }
+        }
+        
+        int before;
+        if (!takeCentral(itemId, quantity, before, ownHold)) {
+            if (soldier != 0) ledger.release(soldier, itemId, quantity);
+            unmet(itemId, quantity, soldier);
+            return RequestResult::OutOfStock;
+        }
+        
+        // Log the transaction
+        journalRecord(JournalOp::Issue, itemId, quantity, rank, -1, soldier);
+        logTransaction(itemId, quantity, rank);
+        centralChanged(itemId, before, before - quantity);
+        version.bump();
+        return RequestResult::Success;
+    }
+    
+    bool transferToBattalion(int battalionIndex, int itemId, int quantity, Rank rank) {
+        int before;
+        if (!takeCentral(itemId, quantity, before)) return false;
+        
+        Battalion& battalion = battalions[battalionIndex];
+        battalion.addEquipment(itemId, quantity);
+        rollup.battalionChanged(battalion.getDepot(), itemId, quantity);
+        journalRecord(JournalOp::Allocate, itemId, quantity, rank, battalionIndex);
+        logTransaction(itemId, quantity, rank, &battalion.getName());
+        centralChanged(itemId, before, before - quantity);
+        version.bump();
+        return true;
+    }
+    
+    void recordBatch(size_t operations, uint64_t start) {
+        MetricsShard& shard = metrics.local();
+        shard.batchLatency.record(Metrics::elapsed(start));
+        MetricsShard::bump(shard.batches);
+        MetricsShard::bump(shard.batchOperations, operations);
+    }
+    
+public:
+    // Returns false, changing nothing, if the battalion's total would pass INT_MAX
+    bool deploySoldiers(int battalionIndex, int count, Rank rank) {
+        if (count < 0 || !battalions[battalionIndex].deploySoldiers(count)) return false;
+        journalRecord(JournalOp::Deploy, 0, count, rank, battalionIndex);
+        version.bump();
+        return true;
+    }
+    
+    // Issues a whole batch of soldier requests. Every operation is checked
+    // against its rank's entitlement and the summed demand per item is
+    // reserved up front, so either all operations succeed or none do.
+    BatchResult requestBatch(const vector<IssueOperation>& ops) {
+        uint64_t start = Metrics::startTimer();
+        vector<int> demand(catalog.size(), 0);
+        vector<int> touched;
+        for (size_t i = 0; i < ops.size(); i++) {
+            const IssueOperation& op = ops[i];
+            if (op.itemId < 0 || op.itemId >= catalog.size() || op.quantity <= 0) {
+                return {RequestResult::UnknownItem, (int)i};
+            }
+            if (op.quantity > getEntitlement(op.rank, op.itemId)) {
+                return {RequestResult::RankLimitExceeded, (int)i};
+            }
+            // A total past INT_MAX is more than any stock can hold
+            if (demand[op.itemId] > numeric_limits<int>::max() - op.quantity) {
+                return {RequestResult::OutOfStock, (int)i};
+            }
+            if (demand[op.itemId] == 0) touched.push_back(op.itemId);
+            demand[op.itemId] += op.quantity;
+        }
+        
+        int failedHolding = reserveHoldings(ops);
+        if (failedHolding >= 0) {
+            return {RequestResult::HoldingLimitExceeded, failedHolding};
+        }
+        vector<int> before;
+        int failedItem = reserveAll(touched, demand, before);
+        if (failedItem >= 0) {
+            releaseHoldings(ops, ops.size());
+            unmetBatch(ops, failedItem, demand[failedItem]);
+            return {RequestResult::OutOfStock, firstOperationFor(ops, failedItem)};
+        }
+        
+        // One journal write per batch. Untracked requests are merged into one
+        // record and log line per rank and item; tracked ones keep their
+        // soldier. A rank's total never exceeds its item's checked demand.
+        vector<JournalRecord> records;
+        records.reserve(touched.size() * kSoldierRankCount + 1);
+        records.push_back(batchHeader());
+        vector<int> rankDemand(catalog.size() * kRankCount, 0);
+        for (const IssueOperation& op : ops) {
+            if (tracked(op.soldier, op.rank, op.itemId)) {
+                records.push_back({(int64_t)time(0), op.soldier, op.itemId, op.quantity, -1, (uint8_t)op.rank,
+                                   (uint8_t)JournalOp::Issue, 0});
+                continue;
+            }
+            int& total = rankDemand[op.itemId * kRankCount + (int)op.rank];
+            if (total == 0) {
+                records.push_back({(int64_t)time(0), 0, op.itemId, 0, -1, (uint8_t)op.rank,
+                                   (uint8_t)JournalOp::Issue, 0});
+            }
+            total += op.quantity;
+        }
+        for (size_t r = 1; r < records.size(); r++) {
+            if (records[r].soldier == 0) {
+                records[r].quantity = rankDemand[records[r].itemId * kRankCount + records[r].rank];
+            }
+            logTransaction(records[r].itemId, records[r].quantity, (Rank)records[r].rank);
+            metrics.countIssue(metrics.local(), records[r].itemId, records[r].quantity);
+        }
+        commitBatch(records);
+        
+        for (size_t t = 0; t < touched.size(); t++) {
+            centralChanged(touched[t], before[t], before[t] - demand[touched[t]]);
+        }
+        recordBatch(ops.size(), start);
+        version.bump();
+        return {RequestResult::Success, -1};
+    }
+    
+    // Allocates a batch of (battalion, item, quantity) transfers with
+    // all-or-nothing semantics
+    BatchResult allocateBatch(const vector<AllocationOperation>& ops, Rank rank) {
+        uint64_t start = Metrics::startTimer();
+        vector<int> demand(catalog.size(), 0);
+        vector<int> touched;
+        for (size_t i = 0; i < ops.size(); i++) {
+            const AllocationOperation& op = ops[i];
+            if (op.itemId < 0 || op.itemId >= catalog.size() || op.quantity <= 0 ||
+                op.battalionIndex < 0 || op.battalionIndex >= (int)battalions.size()) {
+                return {RequestResult::UnknownItem, (int)i};
+            }
+            if (demand[op.itemId] > numeric_limits<int>::max() - op.quantity) {
+                return {RequestResult::OutOfStock, (int)i};
+            }
+            if (demand[op.itemId] == 0) touched.push_back(op.itemId);
+            demand[op.itemId] += op.quantity;
+        }
+        
+        vector<int> before;
+        int failedItem = reserveAll(touched, demand, before);
+        if (failedItem >= 0) {
+            return {RequestResult::OutOfStock, firstOperationFor(ops, failedItem)};
+        }
+        
+        vector<JournalRecord> records;
+        records.reserve(ops.size() + 1);
+        records.push_back(batchHeader());
+        for (const AllocationOperation& op : ops) {
+            Battalion& battalion = battalions[op.battalionIndex];
+            battalion.addEquipment(op.itemId, op.quantity);
+            rollup.battalionChanged(battalion.getDepot(), op.itemId, op.quantity);
+            records.push_back({(int64_t)time(0), 0, op.itemId, op.quantity, (int16_t)op.battalionIndex,
+                               (uint8_t)rank, (uint8_t)JournalOp::Allocate, 0});
+            logTransaction(op.itemId, op.quantity, rank, &battalion.getName());
+            metrics.countAllocation(metrics.local(), op.battalionIndex, op.quantity);
+        }
+        commitBatch(records);
+        
+        for (size_t t = 0; t < touched.size(); t++) {
+            centralChanged(touched[t], before[t], before[t] - demand[touched[t]]);
+        }
+        recordBatch(ops.size(), start);
+        version.bump();
+        return {RequestResult::Success, -1};
+    }
+    
+    // Equips every soldier of a battalion with the full entitlement of the
+    // given rank, as one batch. A kit line of more than INT_MAX units fails
+    // as OutOfStock at that operation, since no stock can cover it.
+    BatchResult equipBattalion(int battalionIndex, Rank soldierRank, Rank officerRank) {
+        const EntitledItems& kit = getAvailableItems(soldierRank);
+        int soldiers = battalions[battalionIndex].getSoldierCount();
+        vector<AllocationOperation> ops;
+        for (int i = 0; i < kit.count && soldiers > 0; i++) {
+            int64_t quantity = (int64_t)soldiers * getEntitlement(soldierRank, kit.items[i]);
+            if (quantity > numeric_limits<int>::max()) return {RequestResult::OutOfStock, i};
+            ops.push_back({battalionIndex, kit.items[i], (int)quantity});
+        }
+        return allocateBatch(ops, officerRank);
+    }
+    
+    bool isHolder(Holder holder) const {
+        switch (holder.kind) {
+            case HolderKind::Central: return true;
+            case HolderKind::Depot: return holder.index >= 0 && holder.index < (int)depots.size();
+            case HolderKind::Battalion: return holder.index >= 0 && holder.index < (int)battalions.size();
+        }
+        return false;
+    }
+    
+    // Moves stock between any two holders: down the hierarchy, back up it,
+    // or sideways between depots or battalions. The source is decremented
+    // with a CAS, so concurrent transfers can never overdraw it, and the
+    // destination is raised with one that refuses to pass INT_MAX
+    // (HolderFull), in which case the source gets its units back.
+    RequestResult transfer(Holder from, Holder to, int itemId, int quantity, Rank rank) {
+        if (itemId < 0 || itemId >= catalog.size() || quantity <= 0) return RequestResult::UnknownItem;
+        if (!isHolder(from) || !isHolder(to)) return RequestResult::UnknownHolder;
+        if (from.kind == to.kind && (from.kind == HolderKind::Central || from.index == to.index)) {
+            return RequestResult::SameHolder;
+        }
+        int before;
+        bool taken = from.kind == HolderKind::Central ? takeCentral(itemId, quantity, before)
+                                                      : holding(from, itemId).tryTake(quantity, before);
+        if (!taken) return RequestResult::OutOfStock;
+        int after;
+        if (!holding(to, itemId).tryAdd(quantity, after)) {
+            holding(from, itemId).add(quantity);
+            return RequestResult::HolderFull;
+        }
+        holderChanged(from, itemId, -quantity);
+        holderChanged(to, itemId, quantity);
+        
+        journalRecord(JournalOp::Transfer, itemId, quantity, rank, -1, (uint64_t)from.pack() << 32 | to.pack());
+        transactionLog.enqueue({time(0), &catalog.getName(itemId), &holderName(to), quantity, rank, false, &holderName(from)});
+        if (from.kind == HolderKind::Central) centralChanged(itemId, before, before - quantity);
+        if (to.kind == HolderKind::Central) {
+            centralChanged(itemId, after - quantity, after);
+            stockArrived(itemId);
+        }
+        version.bump();
+        return RequestResult::Success;
+    }
+    
+    const string& holderName(Holder holder) const {
+        static const string central = "Central Depot";
+        switch (holder.kind) {
+            case HolderKind::Depot: return depots[holder.index].getName();
+            case HolderKind::Battalion: return battalions[holder.index].getName();
+            default: return central;
+        }
+    }
+    
+    // Army-wide holdings of an item: central stock, regional depots and
+    // battalions, read from the rollups in constant time
+    int64_t getDepotTotal(int itemId) const { return rollup.depotTotal(itemId); }
+    int64_t getBattalionTotal(int itemId) const { return rollup.battalionTotal(itemId); }
+    int64_t getArmyTotal(int itemId) const {
+        return centralInventory[itemId].load() + rollup.depotTotal(itemId) + rollup.battalionTotal(itemId);
+    }
+    // A depot's own stock plus what the battalions it supplies hold
+    int64_t getRegionTotal(int depot, int itemId) const { return rollup.regionTotal(depot, itemId); }
+    
+    // Stock of every item at one holder at the end of second when, indexed
+    // by item ID. Returns false if the history does not reach back that far.
+    bool getHoldingsAt(int64_t when, Holder holder, vector<int>& quantities) const {
+        quantities.assign(catalog.size(), 0);
+        return history.visitAt(when, config.journalPath, generation, [&](Holder at, int itemId, int amount) {
+            if (at.kind == holder.kind && at.index == holder.index && itemId < (int)quantities.size()) quantities[itemId] += amount;
+        });
+    }
+    
+    // Central, regional depot and battalion stock of an item at the end of second when
+    bool getItemAt(int64_t when, int itemId, int& central, int& depotTotal, int& battalionTotal) const {
+        central = depotTotal = battalionTotal = 0;
+        return history.visitAt(when, config.journalPath, generation, [&](Holder at, int id, int amount) {
+            if (id != itemId) return;
+            if (at.kind == HolderKind::Central) central += amount;
+            else if (at.kind == HolderKind::Depot) depotTotal += amount;
+            else battalionTotal += amount;
+        });
+    }
+    
+    const StockHistory& getHistory() const { return history; }
+    
+    void displayDepots() {
+        cout << "\nDEPOT HIERARCHY:\n";
+        for (size_t d = 0; d < depots.size(); d++) {
+            cout << "\n" << d + 1 << ". " << depots[d].getName() << " (" << depots[d].getLocation() << ")\nSupplies:";
+            bool any = false;
+            for (auto& bat : battalions) {
+                if (bat.getDepot() != (int)d) continue;
+                cout << (any ? ", " : " ") << bat.getName();
+                any = true;
+            }
+            cout << (any ? "" : " none") << "\nStock (depot / region):\n";
+            for (int i = 0; i < catalog.size(); i++) {
+                int id = catalog.getSortedId(i);
+                if (getRegionTotal(d, id) == 0) continue;
+                cout << "- " << catalog.getName(id) << ": " << depots[d].getHolding(id) << " / " << getRegionTotal(d, id) << "\n";
+            }
+        }
+        cout << "\nARMY-WIDE TOTALS (central + depots + battalions):\n";
+        for (int i = 0; i < catalog.size(); i++) {
+            int id = catalog.getSortedId(i);
+            cout << "- " << catalog.getName(id) << ": " << getStock(id) << " + " << getDepotTotal(id) << " + "
+                 << getBattalionTotal(id) << " = " << getArmyTotal(id) << "\n";
+        }
+    }
+    
+    void setSoldierNorm(int itemId, int perSoldier) { soldierNorms[itemId] = max(0, perSoldier); }
+    int getSoldierNorm(int itemId) const { return soldierNorms[itemId]; }
+    
+    // Computes a fair-share distribution of the current central stock over
+    // all battalions without changing anything. Items are solved in
+    // parallel on up to threads workers (0 = all hardware threads).
+    AllocationPlan planAllocation(AllocationPolicy policy, int threads = 0) const {
+        const int kItemsPerTask = 64;
+        int items = catalog.size();
+        int battalionCount = (int)battalions.size();
+        if (threads <= 0) threads = (int)max(1u, thread::hardware_concurrency());
+        threads = max(1, min(threads, (items + kItemsPerTask - 1) / kItemsPerTask));
+        
+        auto started = chrono::steady_clock::now();
+        vector<int64_t> soldiers(battalionCount);
+        vector<const Battalion*> units(battalionCount);
+        for (int b = 0; b < battalionCount; b++) {
+            soldiers[b] = battalions[b].getSoldierCount();
+            units[b] = &battalions[b];
+        }
+        
+        // Each task fills its own slot, so concatenating the slots keeps item order
+        int tasks = (items + kItemsPerTask - 1) / kItemsPerTask;
+        vector<vector<AllocationOperation>> transfers(tasks);
+        vector<uint64_t> need(threads, 0), planned(threads, 0);
+        atomic<int> nextTask{0};
+        auto work = [&](int worker) {
+            vector<int64_t> itemNeed(battalionCount);
+            vector<int> share(battalionCount), order;
+            for (int task; (task = nextTask.fetch_add(1)) < tasks;) {
+                for (int id = task * kItemsPerTask; id < min(items, (task + 1) * kItemsPerTask); id++) {
+                    if (soldierNorms[id] == 0) continue;
+                    int64_t total = 0;
+                    for (int b = 0; b < battalionCount; b++) {
+                        itemNeed[b] = max<int64_t>(0, soldiers[b] * soldierNorms[id] - units[b]->getHolding(id));
+                        total += itemNeed[b];
+                    }
+                    if (total == 0) continue;
+                    need[worker] += total;
+                    fairShare(policy, itemNeed, max(0, centralInventory[id].load()), share, order);
+                    for (int b = 0; b < battalionCount; b++) {
+                        if (share[b] > 0) {
+                            transfers[task].push_back({b, id, share[b]});
+                            planned[worker] += share[b];
+                        }
+                    }
+                }
+            }
+        };
+        vector<thread> pool;
+        for (int t = 1; t < threads; t++) pool.emplace_back(work, t);
+        work(0);
+        for (auto& worker : pool) worker.join();
+        
+        AllocationPlan plan;
+        size_t transferCount = 0;
+        for (auto& chunk : transfers) transferCount += chunk.size();
+        plan.transfers.reserve(transferCount);
+        for (auto& chunk : transfers) plan.transfers.insert(plan.transfers.end(), chunk.begin(), chunk.end());
+        for (int t = 0; t < threads; t++) {
+            plan.totalNeed += need[t];
+            plan.totalPlanned += planned[t];
+        }
+        plan.solveMillis = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+        return plan;
+    }
+    
+    // Plans and applies a fair-share distribution as one batch. Requests
+    // running concurrently can drain stock between planning and applying;
+    // the plan is then recomputed, up to three times.
+    BatchResult distributeStock(AllocationPolicy policy, Rank rank, AllocationPlan* applied = nullptr) {
+        BatchResult result = {RequestResult::Success, -1};
+        for (int attempt = 0; attempt < 3; attempt++) {
+            AllocationPlan plan = planAllocation(policy);
+            result = plan.transfers.empty() ? BatchResult{RequestResult::Success, -1}
+                                            : allocateBatch(plan.transfers, rank);
+            if (result.status != RequestResult::OutOfStock) {
+                if (applied) *applied = move(plan);
+                break;
+            }
+        }
+        return result;
+    }
+    
+    void logTransaction(int itemId, int quantity, Rank rank, const string* battalion = nullptr) {
+        transactionLog.enqueue({time(0), &catalog.getName(itemId), battalion, quantity, rank});
+    }
+    
+    void displayMetrics() {
+        unique_ptr<MetricsShard> m = metrics.merge(catalog.size(), battalions.size());
+        double tickNanos = metrics.nanosPerTick();
+        auto latency = [](const char* label, const LatencyHistogram& h, double scale) {
+            cout << label << ": count " << h.count() << ", p50 " << (uint64_t)(h.percentile(0.5) * scale)
+                 << " ns, p99 " << (uint64_t)(h.percentile(0.99) * scale)
+                 << " ns, p99.9 " << (uint64_t)(h.percentile(0.999) * scale) << " ns\n";
+        };
+        cout << "\nSYSTEM METRICS:\n";
+        cout << "Requests: " << m->requestOutcomes[(int)RequestResult::Success] << " successful, "
+             << m->requestOutcomes[(int)RequestResult::RankLimitExceeded] << " over rank limit, "
+             << m->requestOutcomes[(int)RequestResult::OutOfStock] << " out of stock, "
+             << m->requestOutcomes[(int)RequestResult::UnknownItem] << " unknown item, "
+             << m->requestOutcomes[(int)RequestResult::HoldingLimitExceeded] << " over holding limit\n";
+        cout << "Returns: " << m->returns << " (" << m->requestOutcomes[(int)RequestResult::NotHeld] << " refused)\n";
+        cout << "Allocations: " << m->allocations << " successful, " << m->allocationFailures << " failed\n";
+        cout << "Batches: " << m->batches << " (" << m->batchOperations << " operations)\n";
+        latency("Request latency", m->requestLatency, tickNanos);
+        latency("Allocation latency", m->allocationLatency, tickNanos);
+        latency("Batch latency", m->batchLatency, tickNanos);
+        latency("Log write latency", transactionLog.getCommitLatency(), 1.0);
+        
+        cout << "Issued per item:\n";
+        for (int i = 0; i < catalog.size(); i++) {
+            int id = catalog.getSortedId(i);
+            if (m->itemRequests[id] > 0) {
+                cout << "- " << catalog.getName(id) << ": " << m->itemUnits[id] << " units in "
+                     << m->itemRequests[id] << " requests\n";
+            }
+        }
+        cout << "Allocated per battalion:\n";
+        for (size_t b = 0; b < battalions.size(); b++) {
+            if (m->battalionUnits[b] > 0) {
+                cout << "- " << battalions[b].getName() << ": " << m->battalionUnits[b] << " units\n";
+            }
+        }
+    }
+    
+    // Writes all metrics in the Prometheus text exposition format
+    bool exportMetrics(const string& path) {
+        unique_ptr<MetricsShard> m = metrics.merge(catalog.size(), battalions.size());
+        double tickSeconds = metrics.nanosPerTick() * 1e-9;
+        auto label = [](const string& value) {
+            string escaped;
+            for (char c : value) {
+                if (c == '\\' || c == '"') escaped += '\\';
+                escaped += c;
+            }
+            return escaped;
+        };
+        auto summary = [](ostream& out, const char* name, const char* help, const LatencyHistogram& h, double scale) {
+            out << "# HELP " << name << " " << help << "\n# TYPE " << name << " summary\n";
+            for (double q : {0.5, 0.9, 0.99, 0.999}) {
+                out << name << "{quantile=\"" << q << "\"} " << h.percentile(q) * scale << "\n";
+            }
+            out << name << "_sum " << h.totalNanos() * scale << "\n" << name << "_count " << h.count() << "\n";
+        };
+        
+        ostringstream out;
+        static const char* outcomes[kRequestResultCount] = {"success", "rank_limit", "out_of_stock", "unknown_item",
+                                                            "holding_limit", "not_held", "unknown_holder", "same_holder",
+                                                            "holder_full"};
+        out << "# HELP mams_requests_total Item requests and refused returns by outcome\n# TYPE mams_requests_total counter\n";
+        for (int i = 0; i < kRequestResultCount; i++) {
+            out << "mams_requests_total{outcome=\"" << outcomes[i] << "\"} " << m->requestOutcomes[i] << "\n";
+        }
+        out << "# HELP mams_allocations_total Battalion allocations by outcome\n# TYPE mams_allocations_total counter\n"
+            << "mams_allocations_total{outcome=\"success\"} " << m->allocations << "\n"
+            << "mams_allocations_total{outcome=\"out_of_stock\"} " << m->allocationFailures << "\n";
+        out << "# HELP mams_returns_total Items checked back in by soldiers\n# TYPE mams_returns_total counter\n"
+            << "mams_returns_total " << m->returns << "\n";
+        out << "# HELP mams_tracked_soldiers Soldiers in the holdings ledger\n# TYPE mams_tracked_soldiers gauge\n"
+            << "mams_tracked_soldiers " << ledger.size() << "\n";
+        out << "# HELP mams_batches_total Batch operations applied\n# TYPE mams_batches_total counter\n"
+            << "mams_batches_total " << m->batches << "\n";
+        summary(out, "mams_request_latency_seconds", "requestItem latency", m->requestLatency, tickSeconds);
+        summary(out, "mams_allocation_latency_seconds", "allocateToBattalion latency", m->allocationLatency, tickSeconds);
+        summary(out, "mams_batch_latency_seconds", "Batch latency", m->batchLatency, tickSeconds);
+        summary(out, "mams_log_write_latency_seconds", "Transaction log batch write latency", transactionLog.getCommitLatency(), 1e-9);
+        
+        out << "# HELP mams_item_issued_units_total Units issued per item\n# TYPE mams_item_issued_units_total counter\n";
+        for (int id = 0; id < catalog.size(); id++) {
+            out << "mams_item_issued_units_total{item=\"" << label(catalog.getName(id)) << "\"} " << m->itemUnits[id] << "\n";
+        }
+        out << "# HELP mams_item_requests_total Successful requests per item\n# TYPE mams_item_requests_total counter\n";
+        for (int id = 0; id < catalog.size(); id++) {
+            out << "mams_item_requests_total{item=\"" << label(catalog.getName(id)) << "\"} " << m->itemRequests[id] << "\n";
+        }
+        out << "# HELP mams_battalion_allocated_units_total Units allocated per battalion\n# TYPE mams_battalion_allocated_units_total counter\n";
+        for (size_t b = 0; b < battalions.size(); b++) {
+            out << "mams_battalion_allocated_units_total{battalion=\"" << label(battalions[b].getName()) << "\"} "
+                << m->battalionUnits[b] << "\n";
+        }
+        out << "# HELP mams_item_stock Current central stock per item\n# TYPE mams_item_stock gauge\n";
+        for (int id = 0; id < catalog.size(); id++) {
+            out << "mams_item_stock{item=\"" << label(catalog.getName(id)) << "\"} " << getStock(id) << "\n";
+        }
+        
+        ofstream file(path, ios::trunc);
+        file << out.str();
+        return (bool)file;
+    }
+    
+    deque<Battalion>& getBattalions() { return battalions; }
+    const deque<Depot>& getDepots() const { return depots; }
+    int getStock(int itemId) const { return centralInventory[itemId].load(); }
+    int getItemCount() const { return catalog.size(); }
+    const ItemCatalog& getCatalog() const { return catalog; }
+    const NameIndex& getBattalionSearch() const { return battalionSearch; }
+    const NameIndex& getDepotSearch() const { return depotSearch; }
+    int getMaxQuantity(int itemId) { return maxQuantities[itemId]; }
+    
+    const EntitledItems& getAvailableItems(Rank rank) {
+        return kEntitledItems[(int)rank];
+    }
+    
+    void displayItemLimits(Rank rank) {
+        const EntitledItems& available = getAvailableItems(rank);
+        if (available.count == 0) return;
+        
+        cout << "\nMAX ALLOWED QUANTITIES:\n";
+        for (int i = 0; i < available.count; i++) {
+            int id = available.items[i];
+            cout << i + 1 << ". " << catalog.getName(id) << " (Max: " << getEntitlement(rank, id) << ")\n";
+        }
+    }
+    
+    // Maps a 1-based menu position (alphabetical order) to an item ID, -1 if out of range
+    int getItemByIndex(int index) {
+        if (index < 1 || index > catalog.size()) return -1;
+        return catalog.getSortedId(index - 1);
+    }
+};
+
+// Identity Index
+// The personnel roster: PAK number -> name, rank and unit. The index file is
+// an open-addressed slot table followed by the text of every record, written
+// once by --import-roster and mapped read-only at startup, so loading costs
+// the same for ten records or ten million and a lookup is one hash probe
+// into the mapping. Without an index file PAK numbers are only checked for
+// their format.
+//
+//   IdentityHeader | slotCount x IdentitySlot | "name\0unit\0" per record
+struct IdentityHeader {
+    char magic[8];
+    uint64_t slotCount;     // power of two, at most 3/4 full
+    uint64_t recordCount;
+    uint64_t textBytes;
+};
+
+struct IdentitySlot {
+    uint64_t number;        // parsePakNumber packing, 0 marks an empty slot
+    uint32_t text;          // offset of the record's name in the text area
+    uint8_t prefix;         // rank the PAK prefix stands for
+    uint8_t rank;           // actual rank; plain PAK numbers may be JCOs or COs
+    uint8_t reserved[2];
+};
+static_assert(sizeof(IdentitySlot) == 16, "identity slots are persisted as-is");
+
+constexpr char kIdentityMagic[8] = {'M', 'A', 'M', 'S', 'I', 'D', 'X', '1'};
+
+struct Identity {
+    const char* name;       // point into the mapped index
+    const char* unit;
+    Rank rank;
+};
+
+inline uint64_t identityHash(uint64_t number, uint8_t prefix) {
+    uint64_t key = number * kRankCount + prefix;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// Collects records in memory and writes them out as an index file
+class IdentityIndexBuilder {
+private:
+    vector<IdentitySlot> records;
+    string text;
+    
+public:
+    // Returns false if pakNumber is malformed, or if rank contradicts an
+    // officer prefix or is an officer rank for a plain PAK number
+    bool add(const string& pakNumber, const string& name, const string& unit, Rank rank) {
+        IdentitySlot slot = {};
+        Rank prefix;
+        if (!parsePakNumber(pakNumber.data(), pakNumber.size(), prefix, slot.number)) return false;
+        if (isHighRank(prefix) ? rank != prefix : isHighRank(rank)) return false;
+        if (text.size() + name.size() + unit.size() + 2 > numeric_limits<uint32_t>::max()) return false;
+        slot.prefix = (uint8_t)prefix;
+        slot.rank = (uint8_t)rank;
+        slot.text = (uint32_t)text.size();
+        text.append(name.c_str(), name.size() + 1);
+        text.append(unit.c_str(), unit.size() + 1);
+        records.push_back(slot);
+        return true;
+    }
+    
+    size_t size() const { return records.size(); }
+    
+    // Writes the index beside path and renames it into place. Later records
+    // with an already present PAK number are dropped and counted.
+    bool write(const string& path, size_t& duplicates) const {
+        size_t slotCount = 16;
+        while (slotCount * 3 < records.size() * 4) slotCount *= 2;
+        vector<IdentitySlot> slots(slotCount, IdentitySlot());
+        duplicates = 0;
+        for (const IdentitySlot& record : records) {
+            for (size_t i = identityHash(record.number, record.prefix) & (slotCount - 1);; i = (i + 1) & (slotCount - 1)) {
+                if (slots[i].number == 0) {
+                    slots[i] = record;
+                    break;
+                }
+                if (slots[i].number == record.number && slots[i].prefix == record.prefix) {
+                    duplicates++;
+                    break;
+                }
+            }
+        }
+        
+        IdentityHeader header = {};
+        memcpy(header.magic, kIdentityMagic, sizeof(kIdentityMagic));
+        header.slotCount = slotCount;
+        header.recordCount = records.size() - duplicates;
+        header.textBytes = text.size();
+        string tmpPath = path + ".tmp";
+        ofstream out(tmpPath, ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(slots.data()), slots.size() * sizeof(IdentitySlot));
+        out.write(text.data(), text.size());
+        out.close();
+        if (!out || ::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            ::unlink(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+class IdentityIndex {
+private:
+    char* base = nullptr;
+    size_t bytes = 0;
+    const IdentityHeader* header = nullptr;
+    const IdentitySlot* slots = nullptr;
+    const char* text = nullptr;
+    
+public:
+    IdentityIndex() = default;
+    IdentityIndex(const IdentityIndex&) = delete;
+    IdentityIndex& operator=(const IdentityIndex&) = delete;
+    ~IdentityIndex() { close(); }
+    
+    // Maps an index file; returns false if it is missing or malformed
+    bool open(const string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(IdentityHeader)) {
+            if (fd >= 0) ::close(fd);
+            return false;
+        }
+        bytes = st.st_size;
+        void* mapped = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) return false;
+        base = static_cast<char*>(mapped);
+        header = reinterpret_cast<const IdentityHeader*>(base);
+        
+        size_t slotCount = header->slotCount;
+        bool valid = memcmp(header->magic, kIdentityMagic, sizeof(kIdentityMagic)) == 0 &&
+                     slotCount >= 16 && (slotCount & (slotCount - 1)) == 0 &&
+                     slotCount <= (bytes - sizeof(IdentityHeader)) / sizeof(IdentitySlot) &&
+                     header->textBytes == bytes - sizeof(IdentityHeader) - slotCount * sizeof(IdentitySlot) &&
+                     header->recordCount < slotCount &&
+                     (header->textBytes == 0 || base[bytes - 1] == '\0');
+        if (!valid) {
+            close();
+            return false;
+        }
+        slots = reinterpret_cast<const IdentitySlot*>(base + sizeof(IdentityHeader));
+        text = reinterpret_cast<const char*>(slots + slotCount);
+        return true;
+    }
+    
+    void close() {
+        if (base) ::munmap(base, bytes);
+        base = nullptr;
+        header = nullptr;
+        slots = nullptr;
+        text = nullptr;
+    }
+    
+    bool isLoaded() const { return base != nullptr; }
+    size_t size() const { return header ? header->recordCount : 0; }
+    
+    bool find(string_view pakNumber, Identity& identity) const {
+        Rank prefix;
+        uint64_t number;
+        return slots && parsePakNumber(pakNumber.data(), pakNumber.size(), prefix, number) &&
+               find(number, prefix, identity);
+    }
+    
+    // The probe stops after slotCount slots, since a damaged file may
+    // have no empty slot to end it
+    bool find(uint64_t number, Rank prefix, Identity& identity) const {
+        size_t mask = header->slotCount - 1;
+        size_t i = identityHash(number, (uint8_t)prefix) & mask;
+        for (size_t probes = 0; probes <= mask; probes++, i = (i + 1) & mask) {
+            const IdentitySlot& slot = slots[i];
+            if (slot.number == 0) return false;
+            if (slot.number == number && slot.prefix == (uint8_t)prefix) {
+                // Offsets come from the file; open() made sure the text ends in a NUL
+                if (slot.text >= header->textBytes || slot.rank >= kRankCount) return false;
+                identity.name = text + slot.text;
+                identity.unit = identity.name + strlen(identity.name) + 1;
+                if (identity.unit >= text + header->textBytes) return false;
+                identity.rank = (Rank)slot.rank;
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // Reads a CSV roster, one "pak,name,unit[,enlisted|jco|co]" record per
+    // line, into a new index file. Blank lines and lines starting with #
+    // are skipped; malformed lines are reported and skipped.
+    static bool importRoster(istream& in, const string& path, ostream& report) {
+        IdentityIndexBuilder builder;
+        string line;
+        size_t lineNumber = 0, rejected = 0;
+        while (getline(in, line)) {
+            lineNumber++;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty() || line[0] == '#') continue;
+            vector<string> fields;
+            stringstream row(line);
+            string field;
+            while (getline(row, field, ',')) fields.push_back(field);
+            
+            Rank rank, prefix;
+            uint64_t number;
+            bool valid = (fields.size() == 3 || fields.size() == 4) &&
+                         parsePakNumber(fields[0].data(), fields[0].size(), prefix, number);
+            if (valid) {
+                rank = prefix;
+                if (fields.size() == 4) {
+                    if (fields[3] == "jco") rank = Rank::JuniorCommissionedOfficer;
+                    else if (fields[3] == "co") rank = Rank::CommissionedOfficer;
+                    else if (fields[3] != "enlisted") valid = false;
+                }
+            }
+            if (!valid || !builder.add(fields[0], fields[1], fields[2], rank)) {
+                report << "Line " << lineNumber << ": skipped malformed record\n";
+                rejected++;
+            }
+        }
+        size_t duplicates;
+        if (!builder.write(path, duplicates)) {
+            report << "Cannot write identity index " << path << "\n";
+            return false;
+        }
+        report << "Imported " << builder.size() - duplicates << " records into " << path;
+        if (duplicates > 0) report << ", dropped " << duplicates << " duplicate PAK numbers";
+        if (rejected > 0) report << ", skipped " << rejected << " malformed lines";
+        report << "\n";
+        return true;
+    }
+};
+
+class AuthenticationSystem {
+private:
+    InventorySystem inventory;
+    const IdentityIndex* roster;   // null or not loaded: PAK numbers are checked for format only
+    int alertSubscription;
+    
+public:
+    explicit AuthenticationSystem(const InventoryConfig& config = InventoryConfig(), const IdentityIndex* identities = nullptr)
+        : inventory(config), roster(identities && identities->isLoaded() ? identities : nullptr) {
+        alertSubscription = inventory.subscribeLowStock([this](int itemId, int, bool below) {
+            if (below) {
+                cout << "ALERT: " << inventory.getCatalog().getName(itemId) << " inventory is now at half capacity!\n";
+            }
+        });
+    }
+    
+    bool isReady() const { return inventory.isReady(); }
+    
+    ~AuthenticationSystem() {
+        inventory.unsubscribeLowStock(alertSubscription);
+    }
+    
+    static bool validatePakNumber(string_view pakNumber, Rank& rank) {
+        uint64_t number;
+        return parsePakNumber(pakNumber.data(), pakNumber.size(), rank, number);
+    }
+    
+private:
+    void displayHoldings(uint64_t soldierKey, const EntitledItems& items) {
+        bool any = false;
+        for (int i = 0; i < items.count; i++) {
+            int held = inventory.getHolding(soldierKey, items.items[i]);
+            if (held == 0) continue;
+            if (!any) cout << "\nCURRENTLY HELD:\n";
+            any = true;
+            cout << "- " << inventory.getCatalog().getName(items.items[i]) << ": " << held << endl;
+        }
+    }
+    
+    int getValidNumberInput(int maxChoice) {
+        int choice;
+        while (true) {
+            cin >> choice;
+            if (cin.fail() || choice < 0 || choice > maxChoice) {
+                cin.clear();
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                cout << "Invalid input. Please enter a number between 0 and " << maxChoice << ": ";
+            } else {
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                return choice;
+            }
+        }
+    }
+    
+    // Reads a menu number or a name and returns the chosen ID, -1 on cancel.
+    // Any unique prefix of a name selects it; an ambiguous one lists the
+    // matching names and asks again.
+    int readSelection(int count, const NameIndex& search, const function<int(int)>& idOf,
+                      const function<const string&(int)>& nameOf) {
+        string line;
+        while (getline(cin, line)) {
+            size_t first = line.find_first_not_of(" \t"), last = line.find_last_not_of(" \t\r");
+            line = first == string::npos ? "" : line.substr(first, last - first + 1);
+            if (line.empty()) continue;
+            
+            if (all_of(line.begin(), line.end(), [](char c) { return isdigit((unsigned char)c); })) {
+                if (line.size() <= 9 && stoi(line) <= count) return stoi(line) == 0 ? -1 : idOf(stoi(line));
+                cout << "Invalid input. Please enter a number between 0 and " << count << " or a name: ";
+                continue;
+            }
+            int id = search.find(line);
+            if (id >= 0) return id;
+            if (id == -1) {
+                cout << "No match for \"" << line << "\". Enter a number or name: ";
+                continue;
+            }
+            pair<int, int> matches = search.range(line);
+            cout << "Several matches:\n";
+            for (int p = matches.first; p < matches.second && p < matches.first + 10; p++) {
+                cout << "- " << nameOf(search.getId(p)) << "\n";
+            }
+            if (matches.second - matches.first > 10) cout << "... and " << matches.second - matches.first - 10 << " more\n";
+            cout << "Enter more of the name: ";
+        }
+        return -1;
+    }
+    
+    // Item ID picked from the central inventory listing by number or name
+    int selectItem() {
+        const ItemCatalog& catalog = inventory.getCatalog();
+        return readSelection(catalog.size(), catalog.getSearch(),
+                             [this](int number) { return inventory.getItemByIndex(number); },
+                             [&catalog](int id) -> const string& { return catalog.getName(id); });
+    }
+    
+    // Lists the battalions and returns the index picked by number or name
+    int selectBattalion(const char* prompt) {
+        deque<Battalion>& battalions = inventory.getBattalions();
+        cout << "\n" << prompt << ":\n";
+        for (size_t i = 0; i < battalions.size(); i++) {
+            cout << i + 1 << ". " << battalions[i].getName() << "\n";
+        }
+        cout << "Enter number or name (0 to cancel): ";
+        return readSelection(battalions.size(), inventory.getBattalionSearch(),
+                             [](int number) { return number - 1; },
+                             [&battalions](int index) -> const string& { return battalions[index].getName(); });
+    }
+    
+    // Lists the central depot, the regional depots and the battalions with
+    // their stock of an item; returns false on cancel
+    bool selectHolder(const char* prompt, int itemId, Holder& holder) {
+        const deque<Depot>& depots = inventory.getDepots();
+        deque<Battalion>& battalions = inventory.getBattalions();
+        cout << "\n" << prompt << ":\n1. Central Depot (" << inventory.getStock(itemId) << ")\n";
+        for (size_t d = 0; d < depots.size(); d++) {
+            cout << d + 2 << ". " << depots[d].getName() << " (" << depots[d].getHolding(itemId) << ")\n";
+        }
+        for (size_t b = 0; b < battalions.size(); b++) {
+            cout << depots.size() + b + 2 << ". " << battalions[b].getName() << " (" << battalions[b].getHolding(itemId) << ")\n";
+        }
+        cout << "Enter choice (0 to cancel): ";
+        int choice = getValidNumberInput(1 + depots.size() + battalions.size());
+        if (choice == 0) return false;
+        if (choice == 1) holder = {HolderKind::Central, 0};
+        else if (choice <= (int)depots.size() + 1) holder = {HolderKind::Depot, choice - 2};
+        else holder = {HolderKind::Battalion, choice - 2 - (int)depots.size()};
+        return true;
+    }
+    
+    // Reads a date, optionally followed by a time of day
+    int64_t getValidTimeInput() {
+        string line;
+        int64_t when;
+        while (getline(cin, line)) {
+            size_t first = line.find_first_not_of(" \t"), last = line.find_last_not_of(" \t\r");
+            line = first == string::npos ? "" : line.substr(first, last - first + 1);
+            if (StockHistory::parseTime(line, when)) return when;
+            cout << "Invalid date. Please enter YYYY-MM-DD or YYYY-MM-DD HH:MM: ";
+        }
+        return time(0);
+    }
+    
+    // Prints what a battalion or the army held of an item at a past point in time
+    void showHistory(int battalion, int itemId) {
+        cout << "Enter date (YYYY-MM-DD, optionally followed by HH:MM): ";
+        int64_t when = getValidTimeInput();
+        const StockHistory& history = inventory.getHistory();
+        bool found;
+        if (battalion >= 0) {
+            vector<int> quantities;
+            found = inventory.getHoldingsAt(when, {HolderKind::Battalion, battalion}, quantities);
+            if (found) {
+                cout << "\n" << inventory.getBattalions()[battalion].getName() << " as of " << StockHistory::formatTime(when) << ":\n";
+                bool any = false;
+                for (size_t id = 0; id < quantities.size(); id++) {
+                    if (quantities[id] == 0) continue;
+                    any = true;
+                    cout << "- " << inventory.getCatalog().getName(id) << ": " << quantities[id] << "\n";
+                }
+                if (!any) cout << "No equipment held.\n";
+            }
+        } else {
+            int central, depotTotal, battalionTotal;
+            found = inventory.getItemAt(when, itemId, central, depotTotal, battalionTotal);
+            if (found) {
+                cout << "\n" << inventory.getCatalog().getName(itemId) << " as of " << StockHistory::formatTime(when) << ":\n"
+                     << "Central Depot: " << central << "\nRegional Depots: " << depotTotal << "\nBattalions: " << battalionTotal << "\n";
+            }
+        }
+        if (found) return;
+        if (history.empty()) cout << "No stock history has been recorded.\n";
+        else cout << "Stock history starts at " << StockHistory::formatTime(history.getStart()) << ".\n";
+    }
+    
+    // Lists the items with learned demand, soonest stockout first, and what
+    // is on order, then offers to change an item's lead time
+    void showReplenishment() {
+        int64_t now = time(0);
+        double perDay = 86400.0 / inventory.getForecastPeriod();
+        vector<pair<int64_t, int>> projected;   // stockout time, item
+        for (int id = 0; id < inventory.getItemCount(); id++) {
+            ItemForecast forecast = inventory.getForecast(id, now);
+            if (forecast.rate > 0) projected.push_back({inventory.projectDepletion(id, forecast, now), id});
+        }
+        sort(projected.begin(), projected.end());
+        
+        cout << "\nREPLENISHMENT FORECAST:\n";
+        if (projected.empty()) cout << "No demand has been learned yet; rates are learned a day at a time.\n";
+        for (size_t i = 0; i < projected.size() && i < 20; i++) {
+            int id = projected[i].second;
+            ItemForecast forecast = inventory.getForecast(id, now);
+            char rate[32];
+            snprintf(rate, sizeof(rate), "%.1f", forecast.rate * perDay);
+            cout << "- " << inventory.getCatalog().getName(id) << ": " << rate << "/day, stock " << inventory.getStock(id)
+                 << ", runs out " << StockHistory::formatTime(projected[i].first);
+            if (forecast.onOrder > 0) {
+                cout << ", " << forecast.onOrder << " on order (" << (forecast.nextDelivery <= now ? "overdue since " : "expected ")
+                     << StockHistory::formatTime(forecast.nextDelivery) << ")";
+            }
+            if (forecast.reorderPoint < 0) cout << " (still learning)";
+            cout << "\n";
+        }
+        if (projected.size() > 20) cout << "... and " << projected.size() - 20 << " more\n";
+        
+        vector<ReplenishOrder> orders = inventory.getReplenishOrders();
+        cout << "\nOpen orders: " << orders.size() << "\n";
+        
+        cout << "\nEnter an item name to change its lead time (0 to skip): ";
+        int itemId = selectItem();
+        if (itemId < 0) return;
+        ItemForecast forecast = inventory.getForecast(itemId, now);
+        cout << "Current lead time: " << forecast.leadSeconds / 86400.0 << " days\nEnter new lead time in days: ";
+        int days = getValidQuantityInput();
+        inventory.setLeadTime(itemId, (int64_t)days * 86400);
+        cout << "Lead time of " << inventory.getCatalog().getName(itemId) << " set to " << days << " days.\n";
+    }
+    
+    // Lists the open orders and books the one the officer confirms has
+    // arrived into the central depot
+    void receiveReplenishment(Rank rank) {
+        vector<ReplenishOrder> orders = inventory.getReplenishOrders();
+        if (orders.empty()) {
+            cout << "No replenishment orders are open.\n";
+            return;
+        }
+        int64_t now = time(0);
+        cout << "\nOPEN ORDERS:\n";
+        for (size_t i = 0; i < orders.size(); i++) {
+            cout << i + 1 << ". Order " << orders[i].id << ": " << orders[i].quantity << " x "
+                 << inventory.getCatalog().getName(orders[i].itemId) << (orders[i].due <= now ? ", overdue since " : ", expected ")
+                 << StockHistory::formatTime(orders[i].due) << "\n";
+        }
+        cout << "Select the order that has arrived (0 to cancel): ";
+        int choice = getValidNumberInput((int)orders.size());
+        if (choice == 0) return;
+        ReplenishOrder order;
+        if (inventory.receiveOrder(orders[choice - 1].id, rank, order)) {
+            cout << order.quantity << " x " << inventory.getCatalog().getName(order.itemId) << " received into the central depot.\n";
+        } else {
+            cout << "That order is no longer open.\n";
+        }
+    }
+    
+    int getValidQuantityInput() {
+        int quantity;
+        while (true) {
+            cin >> quantity;
+            if (cin.fail() || quantity <= 0) {
+                cin.clear();
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                cout << "Invalid input. Please enter an accurate number: ";
+            } else {
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                return quantity;
+            }
+        }
+    }
+    
+public:
+    void soldierPortal() {
+        SessionArena arena;   // declared first, so it outlives everything it holds
+        pmr::string pakNumber(arena.resource()), name(arena.resource());
+        cout << "SOLDIER PORTAL\n";
+        cout << "Enter your PAK Number:";
+        cin >> pakNumber;
+        
+        Rank rank;
+        if (!validatePakNumber(pakNumber, rank)) {
+            cout << "Invalid PAK Number format!\n";
+            return;
+        }
+        
+        if (rank != Rank::Enlisted) {
+            cout << "Please use the Officer Portal for higher ranks.\n";
+            return;
+        }
+        
+        // The roster supplies name and rank; without one they are asked for
+        int rankChoice;
+        Identity identity;
+        if (roster) {
+            if (!roster->find(pakNumber, identity)) {
+                cout << "PAK Number not found in the personnel roster!\n";
+                return;
+            }
+            name = identity.name;
+            rankChoice = (int)identity.rank + 1;
+        } else {
+            cout << "Enter your name: ";
+            cin.ignore();
+            getline(cin, name);
+            cout << "\nSelect your rank:\n1. Enlisted Ranks\n2. Junior Commissioned Officer\n3. Commissioned Officer\n";
+            rankChoice = getValidNumberInput(3);
+        }
+        
+        SessionArena::Ptr<Soldier> soldier;
+        switch(rankChoice) {
+            case 1:
+                soldier = arena.make<EnlistedSoldier>(pakNumber, name);
+                rank = Rank::Enlisted;
+                break;
+            case 2:
+                soldier = arena.make<JuniorCommissionedOfficer>(pakNumber, name);
+                rank = Rank::JuniorCommissionedOfficer;
+                break;
+            case 3:
+                soldier = arena.make<CommissionedOfficer>(pakNumber, name);
+                rank = Rank::CommissionedOfficer;
+                break;
+            default:
+                return;
+        }
+        
+        cout << "\nWelcome ";
+        soldier->displayInfo();
+        uint64_t soldierKey = HoldingsLedger::soldierKey(pakNumber);
+        inventory.expireHolds();
+        
+        const EntitledItems& availableItems = inventory.getAvailableItems(rank);
+        displayHoldings(soldierKey, availableItems);
+        
+        int action;
+        cout << "\n1. Request Item\n2. Return Item\n3. Collect Held Item\n0. Exit\nEnter choice: ";
+        action = getValidNumberInput(3);
+        
+        if (action == 1) {
+            // Inventory request
+            inventory.displayItemLimits(rank);
+            
+            cout << "\nAvailable Items:\n";
+            for (int i = 0; i < availableItems.count; i++) {
+                cout << i+1 << ". " << inventory.getCatalog().getName(availableItems.items[i]) << endl;
+            }
+            
+            int itemChoice;
+            cout << "Select item to request (0 to exit): ";
+            itemChoice = getValidNumberInput(availableItems.count);
+            
+            if (itemChoice > 0 && itemChoice <= availableItems.count) {
+                cout << "Enter quantity: ";
+                int quantity = getValidQuantityInput();
+                
+                int item = availableItems.items[itemChoice-1];
+                RequestResult result = inventory.requestItem(item, quantity, rank, soldierKey);
+                if (result == RequestResult::RankLimitExceeded) {
+                    cout << "Quantity exceeds allowed limit for your rank!\n";
+                }
+                if (result == RequestResult::HoldingLimitExceeded) {
+                    cout << "You already hold your rank's full allowance of this item!\n";
+                }
+                if (result == RequestResult::Success) {
+                    cout << "Request successful!\n";
+                } else if (result == RequestResult::OutOfStock) {
+                    cout << "Not enough items in inventory. Place a hold? Stock is set aside for you as it comes back (1 = yes, 0 = no): ";
+                    if (getValidNumberInput(1) == 1) {
+                        HoldResult placed = inventory.placeHold(item, quantity, rank, soldierKey);
+                        if (placed.result == RequestResult::Success) {
+                            cout << "Hold " << placed.id << (placed.waiting ? " is waiting for stock" : " is ready to collect")
+                                 << ". Collect it within " << kDefaultHoldSeconds / 60 << " minutes of it being met.\n";
+                        } else {
+                            cout << "Hold failed! Your items and open holds already reach your rank's allowance of this item.\n";
+                        }
+                    }
+                } else {
+                    cout << "Request failed! Either not enough items in inventory or quantity exceeds your rank's limit.\n";
+                }
+            }
+        } else if (action == 2) {
+            cout << "\nItems:\n";
+            for (int i = 0; i < availableItems.count; i++) {
+                cout << i+1 << ". " << inventory.getCatalog().getName(availableItems.items[i]) << endl;
+            }
+            cout << "Select item to return (0 to exit): ";
+            int itemChoice = getValidNumberInput(availableItems.count);
+            
+            if (itemChoice > 0) {
+                cout << "Enter quantity: ";
+                int quantity = getValidQuantityInput();
+                
+                if (inventory.returnItem(availableItems.items[itemChoice-1], quantity, rank, soldierKey) == RequestResult::Success) {
+                    cout << "Return successful!\n";
+                } else {
+                    cout << "Return failed! You do not hold that many of this item.\n";
+                }
+            }
+        } else if (action == 3) {
+            cout << "Enter hold number (0 to exit): ";
+            int id = getValidNumberInput(numeric_limits<int>::max());
+            Hold hold;
+            if (id > 0) {
+                if (!inventory.getHold(id, hold) || hold.soldier != soldierKey) {
+                    cout << "No such hold of yours. Holds lapse if they are not collected in time.\n";
+                } else if (hold.state == HoldState::Waiting) {
+                    cout << "Hold " << id << " is still waiting for stock.\n";
+                } else if (inventory.collectHold(id, soldierKey) == RequestResult::Success) {
+                    cout << "Collected " << hold.quantity << " x " << inventory.getCatalog().getName(hold.itemId) << "!\n";
+                } else {
+                    cout << "Collection failed! You already hold your rank's full allowance of this item.\n";
+                }
+            }
+        }
+        inventory.checkpointIfDue();
+    }
+    
+    void officerPortal() {
+        string pakNumber;
+        cout << "OFFICER COMMAND PORTAL\n";
+        cout << "Enter your PAK Number: ";
+        cin >> pakNumber;
+        
+        Rank rank;
+        if (!validatePakNumber(pakNumber, rank)) {
+            cout << "Invalid PAK Number!\n";
+            return;
+        }
+        
+        // Check if it's a high rank
+        if (!isHighRank(rank)) {
+            cout << "Access denied! This portal is for high ranking officers only.\n";
+            return;
+        }
+        
+        Identity identity = {"Officer Name", "", rank};
+        if (roster && !roster->find(pakNumber, identity)) {
+            cout << "PAK Number not found in the personnel roster!\n";
+            return;
+        }
+        
+        cout << "Welcome " << rankName(rank);
+        if (roster) cout << " " << identity.name << ", " << identity.unit;
+        cout << "!\n";
+        
+        HighRankOfficer officer(pakNumber, identity.name, rank);
+        
+        int choice;
+        do {
+            cout << "\nOFFICER MENU\n";
+            cout << "1. View Central Inventory\n";
+            cout << "2. View Battalion Status\n";
+            cout << "3. Deploy Soldiers to Battalion\n";
+            cout << "4. Allocate Equipment to Battalion\n";
+            cout << "5. Equip Battalion with Standard Kit\n";
+            cout << "6. Low Stock Report\n";
+            cout << "7. View System Metrics\n";
+            cout << "8. Export Metrics (metrics.prom)\n";
+            cout << "9. Fair-Share Allocation Plan\n";
+            cout << "10. Transfer Equipment\n";
+            cout << "11. Depot Hierarchy\n";
+            cout << "12. Export Reports (CSV/JSON)\n";
+            cout << "13. Stock History\n";
+            cout << "14. Replenishment Forecast\n";
+            cout << "15. Receive Replenishment Order\n";
+            cout << "0. Exit\n";
+            cout << "Enter choice: ";
+            choice = getValidNumberInput(15);
+            
+            switch(choice) {
+                case 1:
+                    inventory.displayCentralInventory();
+                    break;
+                case 2:
+                    inventory.displayBattalionStatus();
+                    break;
+                case 3: {
+                    int batChoice = selectBattalion("Select battalion to deploy soldiers");
+                    if (batChoice >= 0) {
+                        cout << "Enter number of soldiers to deploy: ";
+                        int soldierCount = getValidQuantityInput();
+                        if (inventory.deploySoldiers(batChoice, soldierCount, rank)) {
+                            cout << "Deployment successful!\n";
+                        } else {
+                            cout << "Deployment failed! The battalion cannot hold that many soldiers.\n";
+                        }
+                    }
+                    break;
+                }
+                case 4: {
+                    inventory.displayCentralInventory();
+                    
+                    cout << "Select item to allocate by number or name (0 to cancel): ";
+                    int selectedItem = selectItem();
+                    if (selectedItem < 0) break;
+                    
+                    int availableQuantity = inventory.getStock(selectedItem);
+                    cout << "Enter quantity (Available: " << availableQuantity << "): ";
+                    int quantity = getValidQuantityInput();
+                    
+                    if (quantity > availableQuantity) {
+                        cout << "Allocation failed! Not enough items.\n";
+                        break;
+                    }
+                    
+                    int batChoice = selectBattalion("Select battalion");
+                    if (batChoice >= 0) {
+                        if (!inventory.allocateToBattalion(batChoice, selectedItem, quantity, rank)) {
+                            cout << "Allocation failed! Not enough items.\n";
+                            break;
+                        }
+                        cout << "Allocation successful!\n";
+                    }
+                    break;
+                }
+                case 5: {
+                    int batChoice = selectBattalion("Select battalion to equip");
+                    if (batChoice < 0) break;
+                    
+                    // Every soldier receives the Enlisted entitlement, all or nothing
+                    BatchResult result = inventory.equipBattalion(batChoice, Rank::Enlisted, rank);
+                    if (result.ok()) {
+                        cout << "Battalion equipped successfully!\n";
+                    } else {
+                        cout << "Equipping failed! Not enough items in central inventory. No equipment was issued.\n";
+                    }
+                    break;
+                }
+                case 6: {
+                    const ItemCatalog& catalog = inventory.getCatalog();
+                    vector<int> low = inventory.getLowStockItems();
+                    cout << "\nITEMS AT OR BELOW THRESHOLD: " << low.size() << "\n";
+                    for (int id : low) {
+                        cout << "- " << catalog.getName(id) << ": " << inventory.getStock(id)
+                             << " (threshold " << inventory.getLowStockThreshold(id) << ")\n";
+                    }
+                    cout << "\nMOST DEPLETED ITEMS:\n";
+                    for (int id : inventory.getMostDepletedItems(5)) {
+                        cout << "- " << catalog.getName(id) << ": " << inventory.getStock(id)
+                             << " of " << inventory.getMaxQuantity(id) << "\n";
+                    }
+                    break;
+                }
+                case 7:
+                    inventory.displayMetrics();
+                    break;
+                case 8:
+                    if (inventory.exportMetrics("metrics.prom")) {
+                        cout << "Metrics written to metrics.prom\n";
+                    } else {
+                        cout << "Could not write metrics.prom\n";
+                    }
+                    break;
+                case 9: {
+                    cout << "\nDistribution policy:\n1. Max-min fair (smallest needs met first)\n2. Proportional to need\n";
+                    int policyChoice = getValidNumberInput(2);
+                    if (policyChoice == 0) break;
+                    AllocationPolicy policy = policyChoice == 1 ? AllocationPolicy::MaxMinFair : AllocationPolicy::Proportional;
+                    
+                    AllocationPlan plan = inventory.planAllocation(policy);
+                    cout << "\nPLAN: " << plan.transfers.size() << " transfers, " << plan.totalPlanned << " of "
+                         << plan.totalNeed << " units needed (" << plan.solveMillis << " ms)\n";
+                    vector<int> planned(inventory.getBattalions().size(), 0);
+                    for (const AllocationOperation& op : plan.transfers) planned[op.battalionIndex] += op.quantity;
+                    for (size_t b = 0; b < planned.size(); b++) {
+                        cout << "- " << inventory.getBattalions()[b].getName() << ": " << planned[b] << " units\n";
+                    }
+                    if (plan.transfers.empty()) break;
+                    
+                    cout << "Apply this plan? (1 = yes, 0 = no): ";
+                    if (getValidNumberInput(1) == 0) break;
+                    // Replanned against the stock at the moment it is applied
+                    BatchResult result = inventory.distributeStock(policy, rank);
+                    if (result.ok()) {
+                        cout << "Distribution applied successfully!\n";
+                    } else {
+                        cout << "Distribution failed! Stock changed while planning. No equipment was issued.\n";
+                    }
+                    break;
+                }
+                case 10: {
+                    inventory.displayCentralInventory();
+                    cout << "Select item to transfer by number or name (0 to cancel): ";
+                    int selectedItem = selectItem();
+                    if (selectedItem < 0) break;
+                    
+                    Holder from, to;
+                    if (!selectHolder("Transfer from", selectedItem, from) || !selectHolder("Transfer to", selectedItem, to)) break;
+                    cout << "Enter quantity: ";
+                    int quantity = getValidQuantityInput();
+                    
+                    RequestResult result = inventory.transfer(from, to, selectedItem, quantity, rank);
+                    if (result == RequestResult::Success) {
+                        cout << "Transfer successful!\n";
+                    } else if (result == RequestResult::OutOfStock) {
+                        cout << "Transfer failed! Not enough items at " << inventory.holderName(from) << ".\n";
+                    } else if (result == RequestResult::SameHolder) {
+                        cout << "Transfer failed! Source and destination are the same.\n";
+                    } else if (result == RequestResult::HolderFull) {
+                        cout << "Transfer failed! " << inventory.holderName(to) << " cannot hold that many.\n";
+                    } else {
+                        cout << "Transfer failed! Invalid item, quantity or holder.\n";
+                    }
+                    break;
+                }
+                case 11:
+                    inventory.displayDepots();
+                    break;
+                case 12: {
+                    cout << "\nReport:\n1. Central Inventory\n2. Battalion Status\n";
+                    int kindChoice = getValidNumberInput(2);
+                    if (kindChoice == 0) break;
+                    cout << "Format:\n1. CSV\n2. JSON\n";
+                    int formatChoice = getValidNumberInput(2);
+                    if (formatChoice == 0) break;
+                    
+                    string path = string(kindChoice == 1 ? "inventory_report" : "battalion_report") +
+                                  (formatChoice == 1 ? ".csv" : ".json");
+                    ofstream file(path, ios::trunc | ios::binary);
+                    inventory.writeReport(file, kindChoice == 1 ? ReportKind::CentralInventory : ReportKind::BattalionStatus,
+                                          formatChoice == 1 ? ReportFormat::Csv : ReportFormat::Json);
+                    cout << (file ? "Report written to " : "Could not write ") << path << "\n";
+                    break;
+                }
+                case 13: {
+                    cout << "\nStock history of:\n1. A Battalion\n2. An Item\n";
+                    int kindChoice = getValidNumberInput(2);
+                    if (kindChoice == 1) {
+                        int batChoice = selectBattalion("Select battalion");
+                        if (batChoice >= 0) showHistory(batChoice, -1);
+                    } else if (kindChoice == 2) {
+                        inventory.displayCentralInventory();
+                        cout << "Select item by number or name (0 to cancel): ";
+                        int selectedItem = selectItem();
+                        if (selectedItem >= 0) showHistory(-1, selectedItem);
+                    }
+                    break;
+                }
+                case 14:
+                    showReplenishment();
+                    break;
+                case 15:
+                    receiveReplenishment(rank);
+                    break;
+            }
+            inventory.expireHolds();
+            inventory.checkpointIfDue();
+        } while (choice != 0);
+    }
+};
+
+// Headless Command Mode
+// Drives an InventorySystem from a line-oriented command stream without any
+// prompts. Each command produces exactly one result line starting with OK
+// or ERR, possibly preceded by ALERT lines for low stock crossings. Names
+// containing spaces are written in double quotes. Items, battalions and
+// depots can also be named by any unique prefix, in any letter case.
+//
+//   login <pak> [enlisted|jco|co]      request <item> <qty>
+//   deploy <battalion> <count>         allocate <item> <qty> <battalion>
+//   equip <battalion>                  query item <item>
+//   query battalion <battalion>        inventory
+//   lowstock [n]                       threshold <item> <qty>
+//   metrics [file]                     return <item> <qty>
+//   holdings                           checkpoint
+//   norm <item> <qty>                  distribute <maxmin|proportional> [dry]
+//   transfer <item> <qty> <from> <to>  assign <battalion> <depot|central>
+//   query depot <depot>                total <item>
+//   report <inventory|battalions> <text|csv|json> <file>
+//   hold <item> <qty> [seconds]        collect <hold>
+//   cancel <hold>                      query hold <hold>
+//   history [central | item <item> | battalion <battalion> | depot <depot>] <when>
+//   forecast <item>                    leadtime <item> <seconds>
+//   orders                             receive <order>
+//   logout
+//
+// Items are referenced by name or #id, battalions and depots by name or
+// 1-based number. Transfer endpoints are central, depot:<depot> or a battalion.
+// A <when> is seconds since the epoch, YYYY-MM-DD for the end of that day, or
+// YYYY-MM-DDTHH:MM[:SS], all in local time.
+// With an identity index only PAK numbers on the roster can log in.
+class CommandProcessor {
+private:
+    InventorySystem& inventory;
+    ostream& out;
+    const IdentityIndex* roster;   // null: PAK numbers are checked for format only
+    int alertSubscription = 0;     // 0 without alerts
+    bool loggedIn = false;
+    string pakNumber;
+    uint64_t soldier = 0;   // holdings ledger key of a soldier login
+    Rank rank = Rank::Enlisted;
+    
+    // Command arguments are views into the line being executed
+    using Args = vector<string_view>;
+    Args tokens;   // reused from line to line
+    
+    void tokenize(string_view line) {
+        tokens.clear();
+        size_t i = 0;
+        while (i < line.size()) {
+            if (isspace((unsigned char)line[i])) { i++; continue; }
+            if (line[i] == '#' && tokens.empty()) break;
+            if (line[i] == '"') {
+                size_t end = line.find('"', i + 1);
+                if (end == string_view::npos) end = line.size();
+                tokens.push_back(line.substr(i + 1, end - i - 1));
+                i = end + 1;
+            } else {
+                size_t start = i;
+                while (i < line.size() && !isspace((unsigned char)line[i])) i++;
+                tokens.push_back(line.substr(start, i - start));
+            }
+        }
+    }
+    
+    static bool parseInt(string_view text, int& value) {
+        if (text.empty() || text.size() > 9) return false;
+        value = 0;
+        for (char c : text) {
+            if (!isdigit((unsigned char)c)) return false;
+            value = value * 10 + (c - '0');
+        }
+        return true;
+    }
+    
+    static string quoted(string_view text) { return "\"" + string(text) + "\""; }
+    
+    // Quotes text straight into the output, for result lines
+    struct InQuotes { string_view text; };
+    friend ostream& operator<<(ostream& os, InQuotes q) { return os << '"' << q.text << '"'; }
+    
+    int findItem(string_view ref) {
+        int id;
+        if (ref.size() > 1 && ref[0] == '#' && parseInt(ref.substr(1), id)) {
+            return id < inventory.getItemCount() ? id : -1;
+        }
+        id = inventory.getCatalog().find(ref);
+        return id >= 0 ? id : max(inventory.getCatalog().getSearch().find(ref), -1);
+    }
+    
+    int findBattalion(string_view ref) {
+        int number;
+        if (parseInt(ref, number)) {
+            return number >= 1 && number <= (int)inventory.getBattalions().size() ? number - 1 : -1;
+        }
+        return max(inventory.getBattalionSearch().find(ref), -1);
+    }
+    
+    int findDepot(string_view ref) {
+        int number;
+        if (parseInt(ref, number)) {
+            return number >= 1 && number <= (int)inventory.getDepots().size() ? number - 1 : -1;
+        }
+        return max(inventory.getDepotSearch().find(ref), -1);
+    }
+    
+    // "central", "depot:<depot>" or a battalion
+    bool findHolder(string_view ref, Holder& holder) {
+        if (ref == "central") {
+            holder = {HolderKind::Central, 0};
+            return true;
+        }
+        if (ref.compare(0, 6, "depot:") == 0) {
+            holder = {HolderKind::Depot, findDepot(ref.substr(6))};
+        } else {
+            holder = {HolderKind::Battalion, findBattalion(ref)};
+        }
+        return holder.index >= 0;
+    }
+    
+    void error(string_view code, string_view message) {
+        out << "ERR " << code << " " << message << "\n";
+    }
+    
+    bool requireOfficer() {
+        if (!loggedIn) {
+            error("NOT_LOGGED_IN", "login required");
+            return false;
+        }
+        if (!isHighRank(rank)) {
+            error("FORBIDDEN", "command requires a high ranking officer");
+            return false;
+        }
+        return true;
+    }
+    
+    void login(const Args& args) {
+        Rank parsed;
+        if (args.size() < 2 || !AuthenticationSystem::validatePakNumber(args[1], parsed)) {
+            error("AUTH", "invalid PAK number");
+            return;
+        }
+        if (args.size() > 2) {
+            if (parsed != Rank::Enlisted) {
+                error("PARSE", "rank selection is only for soldier PAK numbers");
+                return;
+            }
+            if (args[2] == "jco") parsed = Rank::JuniorCommissionedOfficer;
+            else if (args[2] == "co") parsed = Rank::CommissionedOfficer;
+            else if (args[2] != "enlisted") {
+                error("PARSE", "rank must be enlisted, jco or co");
+                return;
+            }
+        }
+        // With a roster the rank is the recorded one; a rank given anyway must match it
+        Identity identity;
+        if (roster) {
+            if (!roster->find(args[1], identity)) {
+                error("AUTH", "PAK number not in roster");
+                return;
+            }
+            if (args.size() > 2 && identity.rank != parsed) {
+                error("AUTH", "rank does not match roster");
+                return;
+            }
+            parsed = identity.rank;
+        }
+        loggedIn = true;
+        pakNumber = args[1];
+        soldier = HoldingsLedger::soldierKey(pakNumber);
+        rank = parsed;
+        out << "OK login " << pakNumber << " " << InQuotes{rankName(rank)} << "\n";
+    }
+    
+    void request(const Args& args) {
+        int quantity;
+        if (args.size() != 3 || !parseInt(args[2], quantity) || quantity <= 0) {
+            error("PARSE", "usage: request <item> <qty>");
+            return;
+        }
+        if (!loggedIn) {
+            error("NOT_LOGGED_IN", "login required");
+            return;
+        }
+        int itemId = findItem(args[1]);
+        if (itemId < 0) {
+            error("UNKNOWN_ITEM", quoted(args[1]));
+            return;
+        }
+        switch (inventory.requestItem(itemId, quantity, rank, soldier)) {
+            case RequestResult::Success:
+                out << "OK request " << itemId << " " << quantity << " " << inventory.getStock(itemId) << "\n";
+                break;
+            case RequestResult::RankLimitExceeded:
+                error("RANK_LIMIT", "max " + to_string(getEntitlement(rank, itemId)));
+                break;
+            case RequestResult::HoldingLimitExceeded:
+                error("HOLDING_LIMIT", "holds " + to_string(inventory.getHolding(soldier, itemId)) +
+                      " reserved " + to_string(inventory.getSoldierHoldUnits(soldier, itemId)) +
+                      " of " + to_string(getEntitlement(rank, itemId)));
+                break;
+            case RequestResult::OutOfStock:
+                error("OUT_OF_STOCK", to_string(inventory.getFreeStock(itemId)));
+                break;
+            case RequestResult::UnknownItem:
+            case RequestResult::NotHeld:
+            case RequestResult::UnknownHolder:
+            case RequestResult::SameHolder:
+            case RequestResult::HolderFull:
+                error("UNKNOWN_ITEM", quoted(args[1]));
+                break;
+        }
+    }
+    
+    void returnItem(const Args& args) {
+        int quantity;
+        if (args.size() != 3 || !parseInt(args[2], quantity) || quantity <= 0) {
+            error("PARSE", "usage: return <item> <qty>");
+            return;
+        }
+        if (!loggedIn) {
+            error("NOT_LOGGED_IN", "login required");
+            return;
+        }
+        int itemId = findItem(args[1]);
+        if (itemId < 0) {
+            error("UNKNOWN_ITEM", quoted(args[1]));
+            return;
+        }
+        if (inventory.returnItem(itemId, quantity, rank, soldier) != RequestResult::Success) {
+            error("NOT_HELD", "holds " + to_string(inventory.getHolding(soldier, itemId)));
+            return;
+        }
+        out << "OK return " << itemId << " " << quantity << " " << inventory.getStock(itemId) << "\n";
+    }
+    
+    // Sets stock aside, or queues for it when there is not enough
+    void hold(const Args& args) {
+        int quantity, seconds = kDefaultHoldSeconds;
+        if (args.size() < 3 || args.size() > 4 || !parseInt(args[2], quantity) || quantity <= 0 ||
+            (args.size() == 4 && (!parseInt(args[3], seconds) || seconds <= 0))) {
+            error("PARSE", "usage: hold <item> <qty> [seconds]");
+            return;
+        }
+        if (!loggedIn) {
+            error("NOT_LOGGED_IN", "login required");
+            return;
+        }
+        int itemId = findItem(args[1]);
+        if (itemId < 0) {
+            error("UNKNOWN_ITEM", quoted(args[1]));
+            return;
+        }
+        HoldResult placed = inventory.placeHold(itemId, quantity, rank, soldier, seconds);
+        switch (placed.result) {
+            case RequestResult::Success:
+                out << "OK hold " << placed.id << " " << (placed.waiting ? "waiting" : "held") << "\n";
+                break;
+            case RequestResult::RankLimitExceeded:
+                error("RANK_LIMIT", "max " + to_string(getEntitlement(rank, itemId)));
+                break;
+            case RequestResult::HoldingLimitExceeded:
+                error("HOLDING_LIMIT", "holds " + to_string(inventory.getHolding(soldier, itemId)) +
+                      " reserved " + to_string(inventory.getSoldierHoldUnits(soldier, itemId)) +
+                      " of " + to_string(getEntitlement(rank, itemId)));
+                break;
+            default:
+                error("UNKNOWN_ITEM", quoted(args[1]));
+                break;
+        }
+    }
+    
+    // Hold IDs of the logged-in soldier; returns false after reporting an error
+    bool ownHold(const Args& args, const char* usage, int& id, Hold& found) {
+        if (args.size() != 2 || !parseInt(args[1], id)) {
+            error("PARSE", usage);
+            return false;
+        }
+        if (!loggedIn) {
+            error("NOT_LOGGED_IN", "login required");
+            return false;
+        }
+        if (!inventory.getHold(id, found) || found.soldier != soldier) {
+            error("UNKNOWN_HOLD", args[1]);
+            return false;
+        }
+        return true;
+    }
+    
+    void collect(const Args& args) {
+        int id;
+        Hold found;
+        if (!ownHold(args, "usage: collect <hold>", id, found)) return;
+        if (found.state == HoldState::Waiting) {
+            error("WAITING", "hold " + string(args[1]) + " is not met yet");
+            return;
+        }
+        RequestResult result = inventory.collectHold(id, soldier);
+        if (result == RequestResult::HoldingLimitExceeded) {
+            error("HOLDING_LIMIT", "holds " + to_string(inventory.getHolding(soldier, found.itemId)) +
+                  " of " + to_string(getEntitlement(found.rank, found.itemId)));
+        } else if (result != RequestResult::Success) {
+            error("UNKNOWN_HOLD", args[1]);
+        } else {
+            out << "OK collect " << id << " " << found.itemId << " " << found.quantity << " "
+                << inventory.getStock(found.itemId) << "\n";
+        }
+    }
+    
+    void cancel(const Args& args) {
+        int id;
+        Hold found;
+        if (!ownHold(args, "usage: cancel <hold>", id, found)) return;
+        if (!inventory.cancelHold(id, soldier)) {
+            error("UNKNOWN_HOLD", args[1]);
+            return;
+        }
+        out << "OK cancel " << id << "\n";
+    }
+    
+    void holdings() {
+        if (!loggedIn) {
+            error("NOT_LOGGED_IN", "login required");
+            return;
+        }
+        out << "OK holdings " << pakNumber;
+        for (int id = 0; id < kStandardItemCount && soldier != 0; id++) {
+            int held = inventory.getHolding(soldier, id);
+            if (held > 0) out << " " << id << "=" << held;
+        }
+        out << "\n";
+    }
+    
+    void deploy(const Args& args) {
+        int count;
+        if (args.size() != 3 || !parseInt(args[2], count) || count <= 0) {
+            error("PARSE", "usage: deploy <battalion> <count>");
+            return;
+        }
+        if (!requireOfficer()) return;
+        int battalion = findBattalion(args[1]);
+        if (battalion < 0) {
+            error("UNKNOWN_BATTALION", quoted(args[1]));
+            return;
+        }
+        if (!inventory.deploySoldiers(battalion, count, rank)) {
+            error("LIMIT", "battalion holds " + to_string(inventory.getBattalions()[battalion].getSoldierCount()) + " soldiers");
+            return;
+        }
+        out << "OK deploy " << battalion + 1 << " " << inventory.getBattalions()[battalion].getSoldierCount() << "\n";
+    }
+    
+    void allocate(const Args& args) {
+        int quantity;
+        if (args.size() != 4 || !parseInt(args[2], quantity) || quantity <= 0) {
+            error("PARSE", "usage: allocate <item> <qty> <battalion>");
+            return;
+        }
+        if (!requireOfficer()) return;
+        int itemId = findItem(args[1]);
+        int battalion = findBattalion(args[3]);
+        if (itemId < 0) {
+            error("UNKNOWN_ITEM", quoted(args[1]));
+        } else if (battalion < 0) {
+            error("UNKNOWN_BATTALION", quoted(args[3]));
+        } else if (!inventory.allocateToBattalion(battalion, itemId, quantity, rank)) {
+            error("OUT_OF_STOCK", to_string(inventory.getFreeStock(itemId)));
+        } else {
+            out << "OK allocate " << itemId << " " << quantity << " " << battalion + 1 << " "
+                << inventory.getStock(itemId) << "\n";
+        }
+    }
+    
+    void transfer(const Args& args) {
+        int quantity;
+        if (args.size() != 5 || !parseInt(args[2], quantity) || quantity <= 0) {
+            error("PARSE", "usage: transfer <item> <qty> <from> <to>");
+            return;
+        }
+        if (!requireOfficer()) return;
+        int itemId = findItem(args[1]);
+        Holder from, to;
+        if (itemId < 0) {
+            error("UNKNOWN_ITEM", quoted(args[1]));
+        } else if (!findHolder(args[3], from)) {
+            error("UNKNOWN_HOLDER", quoted(args[3]));
+        } else if (!findHolder(args[4], to)) {
+            error("UNKNOWN_HOLDER", quoted(args[4]));
+        } else {
+            switch (inventory.transfer(from, to, itemId, quantity, rank)) {
+                case RequestResult::Success:
+                    out << "OK transfer " << itemId << " " << quantity << "\n";
+                    break;
+                case RequestResult::OutOfStock:
+                    error("OUT_OF_STOCK", quoted(args[3]));
+                    break;
+                case RequestResult::SameHolder:
+                    error("SAME_HOLDER", "source and destination are the same");
+                    break;
+                case RequestResult::UnknownHolder:
+                    error("UNKNOWN_HOLDER", quoted(args[3]) + " " + quoted(args[4]));
+                    break;
+                case RequestResult::HolderFull:
+                    error("LIMIT", quoted(args[4]) + " cannot hold that many");
+                    break;
+                case RequestResult::RankLimitExceeded:
+                    error("RANK_LIMIT", "transfer refused for this rank");
+                    break;
+                case RequestResult::HoldingLimitExceeded:
+                case RequestResult::NotHeld:
+                case RequestResult::UnknownItem:
+                    error("UNKNOWN_ITEM", quoted(args[1]));
+                    break;
+            }
+        }
+    }
+    
+    void assign(const Args& args) {
+        if (args.size() != 3) {
+            error("PARSE", "usage: assign <battalion> <depot|central>");
+            return;
+        }
+        if (!requireOfficer()) return;
+        int battalion = findBattalion(args[1]);
+        int depot = args[2] == "central" ? -1 : findDepot(args[2]);
+        if (battalion < 0) {
+            error("UNKNOWN_BATTALION", quoted(args[1]));
+        } else if (depot < 0 && args[2] != "central") {
+            error("UNKNOWN_DEPOT", quoted(args[2]));
+        } else {
+            inventory.assignBattalion(battalion, depot);
+            out << "OK assign " << battalion + 1 << " " << depot + 1 << "\n";
+        }
+    }
+    
+    // Writes a report to a file; the result says whether it came from the cache
+    void report(const Args& args) {
+        ReportKind kind;
+        ReportFormat format;
+        if (args.size() != 4 || !parseReportKind(args[1], kind) || !parseReportFormat(args[2], format)) {
+            error("PARSE", "usage: report <inventory|battalions> <text|csv|json> <file>");
+            return;
+        }
+        ofstream file(string(args[3]), ios::trunc | ios::binary);
+        ReportWrite written = inventory.writeReport(file, kind, format);
+        if (!file) {
+            error("IO", quoted(args[3]));
+            return;
+        }
+        out << "OK report " << written.bytes << " " << (written.cached ? "cached" : "rendered") << "\n";
+    }
+    
+    // Army-wide holdings of an item from the rollups
+    void total(const Args& args) {
+        if (args.size() != 2) {
+            error("PARSE", "usage: total <item>");
+            return;
+        }
+        int itemId = findItem(args[1]);
+        if (itemId < 0) {
+            error("UNKNOWN_ITEM", quoted(args[1]));
+            return;
+        }
+        out << "OK total " << itemId << " " << inventory.getStock(itemId) << " " << inventory.getDepotTotal(itemId)
+            << " " << inventory.getBattalionTotal(itemId) << " " << inventory.getArmyTotal(itemId) << "\n";
+    }
+    
+    void equip(const Args& args) {
+        if (args.size() != 2) {
+            error("PARSE", "usage: equip <battalion>");
+            return;
+        }
+        if (!requireOfficer()) return;
+        int battalion = findBattalion(args[1]);
+        if (battalion < 0) {
+            error("UNKNOWN_BATTALION", quoted(args[1]));
+            return;
+        }
+        if (inventory.getBattalions()[battalion].getSoldierCount() <= 0) {
+            error("NO_SOLDIERS", quoted(args[1]));
+            return;
+        }
+        BatchResult result = inventory.equipBattalion(battalion, Rank::Enlisted, rank);
+        string operation = "batch operation " + to_string(result.failedIndex);
+        switch (result.status) {
+            case RequestResult::Success:
+                out << "OK equip " << battalion + 1 << "\n";
+                break;
+            case RequestResult::OutOfStock:
+                error("OUT_OF_STOCK", operation);
+                break;
+            case RequestResult::RankLimitExceeded:
+                error("RANK_LIMIT", operation);
+                break;
+            case RequestResult::HoldingLimitExceeded:
+                error("HOLDING_LIMIT", operation);
+                break;
+            case RequestResult::UnknownHolder:
+            case RequestResult::SameHolder:
+                error("UNKNOWN_BATTALION", quoted(args[1]));
+                break;
+            case RequestResult::HolderFull:
+                error("LIMIT", operation);
+                break;
+            case RequestResult::UnknownItem:
+            case RequestResult::NotHeld:
+                error("UNKNOWN_ITEM", operation);
+                break;
+        }
+    }
+    
+    void query(const Args& args) {
+        if (args.size() == 3 && args[1] == "item") {
+            int itemId = findItem(args[2]);
+            if (itemId < 0) {
+                error("UNKNOWN_ITEM", quoted(args[2]));
+                return;
+            }
+            out << "OK item " << itemId << " " << InQuotes{inventory.getCatalog().getName(itemId)} << " "
+                << inventory.getStock(itemId) << " " << inventory.getMaxQuantity(itemId) << "\n";
+        } else if (args.size() == 3 && args[1] == "battalion") {
+            int index = findBattalion(args[2]);
+            if (index < 0) {
+                error("UNKNOWN_BATTALION", quoted(args[2]));
+                return;
+            }
+            const Battalion& battalion = inventory.getBattalions()[index];
+            out << "OK battalion " << index + 1 << " " << InQuotes{battalion.getName()} << " "
+                << battalion.getSoldierCount();
+            for (int id = 0; id < inventory.getItemCount(); id++) {
+                int holding = battalion.getHolding(id);
+                if (holding > 0) out << " " << id << "=" << holding;
+            }
+            out << "\n";
+        } else if (args.size() == 3 && args[1] == "depot") {
+            int index = findDepot(args[2]);
+            if (index < 0) {
+                error("UNKNOWN_DEPOT", quoted(args[2]));
+                return;
+            }
+            const Depot& depot = inventory.getDepots()[index];
+            out << "OK depot " << index + 1 << " " << InQuotes{depot.getName()};
+            for (int id = 0; id < inventory.getItemCount(); id++) {
+                int holding = depot.getHolding(id);
+                if (holding > 0) out << " " << id << "=" << holding;
+            }
+            out << "\n";
+        } else if (args.size() == 3 && args[1] == "hold") {
+            int id;
+            Hold found;
+            if (!parseInt(args[2], id) || !inventory.getHold(id, found)) {
+                error("UNKNOWN_HOLD", args[2]);
+                return;
+            }
+            out << "OK hold " << id << " " << found.itemId << " " << found.quantity << " "
+                << (found.state == HoldState::Waiting ? "waiting" : "held") << " "
+                << max<int64_t>(0, found.deadline - time(0)) << "\n";
+        } else {
+            error("PARSE", "usage: query item <item> | query battalion <battalion> | query depot <depot> | query hold <hold>");
+        }
+    }
+    
+    // Stock as it stood at a past point in time. Without arguments, the size
+    // of the history and the time it starts from.
+    void history(const Args& args) {
+        const StockHistory& book = inventory.getHistory();
+        if (args.size() == 1) {
+            out << "OK history " << book.getCheckpointCount() << " " << book.getBytes() << " " << book.getStart() << "\n";
+            return;
+        }
+        int64_t when;
+        bool central = args.size() == 3 && args[1] == "central";
+        if ((!central && args.size() != 4) || !StockHistory::parseTime(string(args.back()), when)) {
+            error("PARSE", "usage: history [central | item <item> | battalion <battalion> | depot <depot>] <when>");
+            return;
+        }
+        
+        Holder holder = {HolderKind::Central, 0};
+        if (args[1] == "item") {
+            int itemId = findItem(args[2]);
+            if (itemId < 0) {
+                error("UNKNOWN_ITEM", quoted(args[2]));
+                return;
+            }
+            int stock, depotTotal, battalionTotal;
+            if (!inventory.getItemAt(when, itemId, stock, depotTotal, battalionTotal)) {
+                error("NO_HISTORY", "history starts at " + to_string(book.getStart()));
+                return;
+            }
+            out << "OK history item " << itemId << " " << when << " " << stock << " " << depotTotal << " " << battalionTotal << "\n";
+            return;
+        } else if (args[1] == "battalion") {
+            holder = {HolderKind::Battalion, findBattalion(args[2])};
+            if (holder.index < 0) {
+                error("UNKNOWN_BATTALION", quoted(args[2]));
+                return;
+            }
+        } else if (args[1] == "depot") {
+            holder = {HolderKind::Depot, findDepot(args[2])};
+            if (holder.index < 0) {
+                error("UNKNOWN_DEPOT", quoted(args[2]));
+                return;
+            }
+        } else if (!central) {
+            error("PARSE", "usage: history [central | item <item> | battalion <battalion> | depot <depot>] <when>");
+            return;
+        }
+        
+        vector<int> quantities;
+        if (!inventory.getHoldingsAt(when, holder, quantities)) {
+            error("NO_HISTORY", "history starts at " + to_string(book.getStart()));
+            return;
+        }
+        out << "OK history " << args[1];
+        if (!central) out << " " << holder.index + 1;
+        out << " " << when;
+        for (size_t id = 0; id < quantities.size(); id++) {
+            if (quantities[id] != 0) out << " " << id << "=" << quantities[id];
+        }
+        out << "\n";
+    }
+    
+    // Items below threshold, then the n most depleted items
+    void lowStockReport(const Args& args) {
+        int n = 5;
+        if (args.size() > 2 || (args.size() == 2 && !parseInt(args[1], n))) {
+            error("PARSE", "usage: lowstock [n]");
+            return;
+        }
+        vector<int> low = inventory.getLowStockItems();
+        sort(low.begin(), low.end());
+        out << "OK lowstock " << low.size();
+        for (int id : low) out << " " << id << "=" << inventory.getStock(id);
+        out << " depleted";
+        for (int id : inventory.getMostDepletedItems(n)) out << " " << id;
+        out << "\n";
+    }
+    
+    void threshold(const Args& args) {
+        int value;
+        if (args.size() != 3 || !parseInt(args[2], value)) {
+            error("PARSE", "usage: threshold <item> <qty>");
+            return;
+        }
+        if (!requireOfficer()) return;
+        int itemId = findItem(args[1]);
+        if (itemId < 0) {
+            error("UNKNOWN_ITEM", quoted(args[1]));
+            return;
+        }
+        inventory.setLowStockThreshold(itemId, value);
+        out << "OK threshold " << itemId << " " << value << "\n";
+    }
+    
+    // Learned demand per period (rate and deviation), reorder point,
+    // order-up-to level, units on order, lead time and projected stockout
+    void forecast(const Args& args) {
+        if (args.size() != 2) {
+            error("PARSE", "usage: forecast <item>");
+            return;
+        }
+        int itemId = findItem(args[1]);
+        if (itemId < 0) {
+            error("UNKNOWN_ITEM", quoted(args[1]));
+            return;
+        }
+        ItemForecast f = inventory.getForecast(itemId);
+        char rates[64];
+        snprintf(rates, sizeof(rates), "%.2f %.2f", f.rate, f.deviation);
+        out << "OK forecast " << itemId << " " << inventory.getStock(itemId) << " " << rates << " " << f.reorderPoint
+            << " " << f.orderUpTo << " " << f.onOrder << " " << f.leadSeconds << " "
+            << inventory.projectDepletion(itemId, f) << "\n";
+    }
+    
+    void leadTime(const Args& args) {
+        int seconds;
+        if (args.size() != 3 || !parseInt(args[2], seconds) || seconds <= 0) {
+            error("PARSE", "usage: leadtime <item> <seconds>");
+            return;
+        }
+        if (!requireOfficer()) return;
+        int itemId = findItem(args[1]);
+        if (itemId < 0) {
+            error("UNKNOWN_ITEM", quoted(args[1]));
+            return;
+        }
+        inventory.setLeadTime(itemId, seconds);
+        out << "OK leadtime " << itemId << " " << seconds << "\n";
+    }
+    
+    // Open replenishment orders as order:item=quantity@due, earliest first.
+    // An order stays open past its due time until it is received.
+    void listOrders() {
+        vector<ReplenishOrder> orders = inventory.getReplenishOrders();
+        out << "OK orders " << orders.size();
+        for (const ReplenishOrder& order : orders) {
+            out << " " << order.id << ":" << order.itemId << "=" << order.quantity << "@" << order.due;
+        }
+        out << "\n";
+    }
+    
+    // Books an order that has physically arrived into the central depot
+    void receive(const Args& args) {
+        int orderId;
+        if (args.size() != 2 || !parseInt(args[1], orderId) || orderId <= 0) {
+            error("PARSE", "usage: receive <order>");
+            return;
+        }
+        if (!requireOfficer()) return;
+        ReplenishOrder order;
+        if (!inventory.receiveOrder((uint32_t)orderId, rank, order)) {
+            error("UNKNOWN_ORDER", string(args[1]));
+            return;
+        }
+        out << "OK receive " << order.id << " " << order.itemId << " " << order.quantity << " "
+            << inventory.getStock(order.itemId) << "\n";
+    }
+    
+    void norm(const Args& args) {
+        int value;
+        if (args.size() != 3 || !parseInt(args[2], value)) {
+            error("PARSE", "usage: norm <item> <qty>");
+            return;
+        }
+        if (!requireOfficer()) return;
+        int itemId = findItem(args[1]);
+        if (itemId < 0) {
+            error("UNKNOWN_ITEM", quoted(args[1]));
+            return;
+        }
+        inventory.setSoldierNorm(itemId, value);
+        out << "OK norm " << itemId << " " << value << "\n";
+    }
+    
+    // Reports transfers, planned units, needed units and solve time in microseconds
+    void distribute(const Args& args) {
+        bool dry = args.size() == 3 && args[2] == "dry";
+        if (args.size() < 2 || args.size() > 3 || (args.size() == 3 && !dry) ||
+            (args[1] != "maxmin" && args[1] != "proportional")) {
+            error("PARSE", "usage: distribute <maxmin|proportional> [dry]");
+            return;
+        }
+        if (!requireOfficer()) return;
+        AllocationPolicy policy = args[1] == "maxmin" ? AllocationPolicy::MaxMinFair : AllocationPolicy::Proportional;
+        
+        AllocationPlan plan;
+        if (dry) {
+            plan = inventory.planAllocation(policy);
+        } else if (!inventory.distributeStock(policy, rank, &plan).ok()) {
+            error("OUT_OF_STOCK", "stock changed while planning");
+            return;
+        }
+        out << "OK distribute " << plan.transfers.size() << " " << plan.totalPlanned << " " << plan.totalNeed
+            << " " << (uint64_t)(plan.solveMillis * 1000) << "\n";
+    }
+    
+    void listInventory() {
+        out << "OK inventory " << inventory.getItemCount();
+        for (int id = 0; id < inventory.getItemCount(); id++) {
+            out << " " << id << "=" << inventory.getStock(id);
+        }
+        out << "\n";
+    }
+    
+public:
+    // With alerts the processor prints low stock crossings to its output
+    // until it is destroyed
+    CommandProcessor(InventorySystem& inv, ostream& output, const IdentityIndex* identities = nullptr, bool alerts = true)
+        : inventory(inv), out(output), roster(identities && identities->isLoaded() ? identities : nullptr) {
+        if (!alerts) return;
+        alertSubscription = inventory.subscribeLowStock([this](int itemId, int stock, bool below) {
+            if (below) out << "ALERT " << InQuotes{inventory.getCatalog().getName(itemId)} << " " << stock << "\n";
+        });
+    }
+    
+    CommandProcessor(const CommandProcessor&) = delete;
+    CommandProcessor& operator=(const CommandProcessor&) = delete;
+    
+    ~CommandProcessor() {
+        if (alertSubscription != 0) inventory.unsubscribeLowStock(alertSubscription);
+    }
+    
+    bool isLoggedIn() const { return loggedIn; }
+    Rank getRank() const { return rank; }
+    uint64_t getSoldier() const { return soldier; }
+    
+    // Executes one command line. Returns false for blank lines and comments.
+    bool execute(string_view line) {
+        tokenize(line);
+        const Args& args = tokens;
+        if (args.empty()) return false;
+        
+        string_view command = args[0];
+        if (command == "login") login(args);
+        else if (command == "logout") {
+            loggedIn = false;
+            out << "OK logout\n";
+        }
+        else if (command == "request") request(args);
+        else if (command == "return") returnItem(args);
+        else if (command == "holdings") holdings();
+        else if (command == "hold") hold(args);
+        else if (command == "collect") collect(args);
+        else if (command == "cancel") cancel(args);
+        else if (command == "deploy") deploy(args);
+        else if (command == "allocate") allocate(args);
+        else if (command == "equip") equip(args);
+        else if (command == "transfer") transfer(args);
+        else if (command == "assign") assign(args);
+        else if (command == "total") total(args);
+        else if (command == "report") report(args);
+        else if (command == "query") query(args);
+        else if (command == "history") history(args);
+        else if (command == "inventory") listInventory();
+        else if (command == "lowstock") lowStockReport(args);
+        else if (command == "threshold") threshold(args);
+        else if (command == "forecast") forecast(args);
+        else if (command == "leadtime") leadTime(args);
+        else if (command == "orders") listOrders();
+        else if (command == "receive") receive(args);
+        else if (command == "norm") norm(args);
+        else if (command == "distribute") distribute(args);
+        else if (command == "metrics") {
+            string path(args.size() > 1 ? args[1] : "metrics.prom");
+            if (inventory.exportMetrics(path)) out << "OK metrics " << InQuotes{path} << "\n";
+            else error("IO", "cannot write " + quoted(path));
+        }
+        else if (command == "checkpoint") {
+            out << (inventory.saveSnapshot() ? "OK checkpoint\n" : "ERR IO snapshot failed\n");
+        }
+        else error("PARSE", "unknown command " + quoted(command));
+        return true;
+    }
+    
+    void run(istream& in) {
+        string line;
+        while (getline(in, line)) {
+            inventory.expireHolds();
+            if (execute(line)) inventory.checkpointIfDue();
+        }
+        out.flush();
+    }
+};
+
+// Wire Protocol
+// Every message is a 12-byte frame header followed by its payload, in host
+// byte order since both ends run on the same machine. A response echoes
+// the tag and opcode of its request, so clients can pipeline requests.
+//
+//   Command  text command line      -> text result lines (headless syntax)
+//   Request  ItemPayload            -> int32 central stock after the call
+//   Return   ItemPayload            -> int32 central stock after the call
+//   Stock    ItemPayload (item)     -> int32 central stock
+enum class WireOp : uint16_t { Command = 1, Request = 2, Return = 3, Stock = 4 };
+
+// The first codes follow RequestResult
+enum class WireStatus : uint16_t { Ok, RankLimit, OutOfStock, UnknownItem, HoldingLimit, NotHeld, NotLoggedIn, BadFrame };
+
+struct FrameHeader {
+    uint32_t length;   // payload bytes
+    uint32_t tag;      // chosen by the client
+    uint16_t op;
+    uint16_t status;   // responses only
+};
+static_assert(sizeof(FrameHeader) == 12, "frame header layout");
+
+struct ItemPayload {
+    int32_t item;
+    int32_t quantity;
+};
+
+constexpr uint32_t kMaxFramePayload = 64 * 1024;
+
+// "tcp:<port>" is a loopback TCP port, anything else a Unix-domain socket path
+inline bool parseTcpAddress(const string& address, uint16_t& port) {
+    if (address.compare(0, 4, "tcp:") != 0 || address.size() == 4 || address.size() > 9) return false;
+    unsigned value = 0;
+    for (size_t i = 4; i < address.size(); i++) {
+        if (!isdigit((unsigned char)address[i])) return false;
+        value = value * 10 + (address[i] - '0');
+    }
+    port = (uint16_t)value;
+    return value > 0 && value < 65536;
+}
+
+// Returns a connected (listen = false) or listening socket, -1 on failure
+inline int openSocket(const string& address, bool listen) {
+    uint16_t port;
+    int fd;
+    int status;
+    if (parseTcpAddress(address, port)) {
+        fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int on = 1;
+        if (listen) {
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+            status = ::bind(fd, (sockaddr*)&addr, sizeof addr);
+        } else {
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+            status = ::connect(fd, (sockaddr*)&addr, sizeof addr);
+        }
+    } else {
+        sockaddr_un addr{};
+        if (address.empty() || address.size() >= sizeof addr.sun_path) return -1;
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, address.c_str(), address.size() + 1);
+        status = ::connect(fd, (sockaddr*)&addr, sizeof addr);
+        if (listen) {
+            // A socket file nobody answers on is left over from a stopped server
+            if (status == 0) {
+                ::close(fd);
+                return -1;
+            }
+            ::unlink(address.c_str());
+            status = ::bind(fd, (sockaddr*)&addr, sizeof addr);
+        }
+    }
+    if (status == 0 && listen) status = ::listen(fd, SOMAXCONN);
+    if (status != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Writes all of data, waiting for the socket to drain when it is full.
+// Used by the client; the server never waits on a socket.
+inline bool sendAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (n > 0) {
+            data += n;
+            size -= n;
+        } else if (n < 0 && errno == EAGAIN) {
+            pollfd wait = {fd, POLLOUT, 0};
+            ::poll(&wait, 1, -1);
+        } else if (n < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline void appendFrame(string& out, WireOp op, uint32_t tag, const void* payload, uint32_t length) {
+    FrameHeader header = {length, tag, (uint16_t)op, 0};
+    out.append((const char*)&header, sizeof header);
+    out.append((const char*)payload, length);
+}
+
+// Request Server
+// Owns one InventorySystem and serves it on a local socket. The main thread
+// waits in epoll and queues readable connections for a pool of workers.
+// Connections are armed one-shot, so only one worker reads a connection at
+// a time and its responses go out in request order. Responses a client is
+// slow to take stay with the connection, which is armed for writing and
+// read again only once they are sent, so no worker waits on a socket.
+// Binary stock requests run concurrently under a shared lock; text commands
+// can add battalions, replan or checkpoint, so they hold the lock exclusively.
+class RequestServer {
+private:
+    struct Connection {
+        int fd;
+        string input;             // received bytes not yet forming a whole frame
+        string output;            // responses not yet taken by the socket
+        bool closing = false;     // the client half-closed; close once output is sent
+        ostringstream text;       // output of the session's text commands
+        CommandProcessor session; // login state of this connection
+        
+        Connection(int socket, InventorySystem& inventory, const IdentityIndex* identities)
+            : fd(socket), session(inventory, text, identities, false) {}
+    };
+    
+    InventorySystem& inventory;
+    const IdentityIndex* identities;
+    shared_mutex stateLock;
+    
+    int epollFd = -1;
+    int listenFd = -1;
+    int signalFd = -1;
+    
+    mutex connectionsLock;
+    unordered_map<int, unique_ptr<Connection>> connections;
+    
+    mutex queueLock;
+    condition_variable queueReady;
+    deque<Connection*> ready;
+    bool stopping = false;
+    
+    atomic<uint64_t> frames{0};
+    atomic<uint64_t> accepted{0};
+    mutex logLock;
+    int alertSubscription;
+    
+    void accept() {
+        while (true) {
+            int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            int on = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);   // fails harmlessly on Unix sockets
+            
+            lock_guard<mutex> guard(connectionsLock);
+            Connection* connection = new Connection(fd, inventory, identities);
+            connections[fd].reset(connection);
+            epoll_event event = {EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, {connection}};
+            ::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+            accepted++;
+        }
+    }
+    
+    void close(Connection* connection) {
+        lock_guard<mutex> guard(connectionsLock);
+        int fd = connection->fd;
+        ::close(fd);
+        connections.erase(fd);
+    }
+    
+    void handle(Connection& c, const FrameHeader& request, const char* payload) {
+        FrameHeader response = {0, request.tag, request.op, (uint16_t)WireStatus::Ok};
+        size_t start = c.output.size();
+        c.output.append(sizeof response, '\0');
+        
+        WireOp op = (WireOp)request.op;
+        if (op == WireOp::Command) {
+            {
+                unique_lock<shared_mutex> exclusive(stateLock);
+                c.session.execute(string(payload, request.length));
+                inventory.checkpointIfDue();
+            }
+            c.output += c.text.str();
+            c.text.str("");
+        } else if (op == WireOp::Request || op == WireOp::Return || op == WireOp::Stock) {
+            ItemPayload item;
+            if (request.length != sizeof item) {
+                response.status = (uint16_t)WireStatus::BadFrame;
+            } else {
+                memcpy(&item, payload, sizeof item);
+                shared_lock<shared_mutex> shared(stateLock);
+                if (item.item < 0 || item.item >= inventory.getItemCount()) {
+                    response.status = (uint16_t)WireStatus::UnknownItem;
+                } else if (op != WireOp::Stock && !c.session.isLoggedIn()) {
+                    response.status = (uint16_t)WireStatus::NotLoggedIn;
+                } else if (op != WireOp::Stock && item.quantity <= 0) {
+                    response.status = (uint16_t)WireStatus::BadFrame;
+                } else {
+                    RequestResult result = RequestResult::Success;
+                    if (op == WireOp::Request) {
+                        result = inventory.requestItem(item.item, item.quantity, c.session.getRank(), c.session.getSoldier());
+                    } else if (op == WireOp::Return) {
+                        result = inventory.returnItem(item.item, item.quantity, c.session.getRank(), c.session.getSoldier());
+                    }
+                    response.status = (uint16_t)result;
+                    int32_t stock = inventory.getStock(item.item);
+                    c.output.append((const char*)&stock, sizeof stock);
+                }
+            }
+        } else {
+            response.status = (uint16_t)WireStatus::BadFrame;
+        }
+        response.length = (uint32_t)(c.output.size() - start - sizeof response);
+        memcpy(&c.output[start], &response, sizeof response);
+        frames++;
+    }
+    
+    // Reads what the connection has sent, answers every whole frame and
+    // returns false once the connection should be closed
+    bool serve(Connection& c) {
+        if (!c.output.empty()) {
+            if (!flush(c)) return false;
+            if (!c.output.empty()) return true;
+            if (c.closing) return false;
+        }
+        
+        char buffer[16384];
+        bool open = true;
+        while (c.input.size() < 4 * kMaxFramePayload) {
+            ssize_t n = ::read(c.fd, buffer, sizeof buffer);
+            if (n > 0) {
+                c.input.append(buffer, n);
+            } else if (n == 0) {
+                open = false;   // answer what arrived before a half-close
+                break;
+            } else if (errno == EAGAIN) {
+                break;
+            } else if (errno != EINTR) {
+                return false;
+            }
+        }
+        
+        size_t offset = 0;
+        while (c.input.size() - offset >= sizeof(FrameHeader)) {
+            FrameHeader header;
+            memcpy(&header, c.input.data() + offset, sizeof header);
+            if (header.length > kMaxFramePayload) return false;
+            if (c.input.size() - offset - sizeof header < header.length) break;
+            handle(c, header, c.input.data() + offset + sizeof header);
+            offset += sizeof header + header.length;
+        }
+        c.input.erase(0, offset);
+        
+        c.closing = !open;
+        return flush(c) && !(c.closing && c.output.empty());
+    }
+    
+    // Sends as much pending output as the socket takes without waiting.
+    // Returns false if the connection failed.
+    static bool flush(Connection& c) {
+        size_t sent = 0;
+        while (sent < c.output.size()) {
+            ssize_t n = ::send(c.fd, c.output.data() + sent, c.output.size() - sent, MSG_NOSIGNAL);
+            if (n > 0) sent += n;
+            else if (n == 0 || errno == EAGAIN) break;
+            else if (errno != EINTR) return false;
+        }
+        c.output.erase(0, sent);
+        return true;
+    }
+    
+    void work() {
+        while (true) {
+            Connection* connection;
+            {
+                unique_lock<mutex> guard(queueLock);
+                queueReady.wait(guard, [this] { return stopping || !ready.empty(); });
+                if (stopping) return;
+                connection = ready.front();
+                ready.pop_front();
+            }
+            if (!serve(*connection)) {
+                close(connection);
+                continue;
+            }
+            uint32_t wanted = connection->output.empty() ? EPOLLIN | EPOLLRDHUP : EPOLLOUT;
+            epoll_event event = {wanted | EPOLLONESHOT, {connection}};
+            ::epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->fd, &event);
+        }
+    }
+    
+public:
+    RequestServer(InventorySystem& inv, const IdentityIndex* roster) : inventory(inv), identities(roster) {
+        alertSubscription = inventory.subscribeLowStock([this](int itemId, int stock, bool below) {
+            if (!below) return;
+            lock_guard<mutex> guard(logLock);
+            cout << "ALERT \"" << inventory.getCatalog().getName(itemId) << "\" " << stock << endl;
+        });
+    }
+    
+    RequestServer(const RequestServer&) = delete;
+    RequestServer& operator=(const RequestServer&) = delete;
+    
+    ~RequestServer() {
+        inventory.unsubscribeLowStock(alertSubscription);
+    }
+    
+    // SIGINT and SIGTERM stop the server through a signalfd. They must be
+    // blocked before any thread starts (the inventory starts its own), since
+    // a thread that does not block them would take the default action.
+    static sigset_t blockStopSignals() {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        return signals;
+    }
+    
+    // Serves until SIGINT or SIGTERM. Returns false if the address cannot be used.
+    bool run(const string& address, int workerCount) {
+        sigset_t signals = blockStopSignals();
+        listenFd = openSocket(address, true);
+        if (listenFd < 0) return false;
+        ::fcntl(listenFd, F_SETFL, O_NONBLOCK);
+        signalFd = ::signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+        epoll_event event = {EPOLLIN, {&listenFd}};
+        ::epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+        event.data.ptr = &signalFd;
+        ::epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &event);
+        
+        vector<thread> workers;
+        for (int i = 0; i < workerCount; i++) workers.emplace_back([this] { work(); });
+        {
+            lock_guard<mutex> guard(logLock);
+            cout << "OK serving " << address << " workers=" << workerCount << endl;
+        }
+        
+        epoll_event events[64];
+        int64_t lastExpiry = 0;
+        bool running = true;
+        while (running) {
+            int count = ::epoll_wait(epollFd, events, 64, 1000);
+            for (int i = 0; i < count; i++) {
+                void* source = events[i].data.ptr;
+                if (source == &listenFd) {
+                    accept();
+                } else if (source == &signalFd) {
+                    running = false;
+                } else {
+                    lock_guard<mutex> guard(queueLock);
+                    ready.push_back((Connection*)source);
+                    queueReady.notify_one();
+                }
+            }
+            // Holds lapse and a due checkpoint is taken once a second
+            // whether or not the server is busy
+            int64_t now = time(0);
+            if (now != lastExpiry) {
+                lastExpiry = now;
+                if (inventory.isCheckpointDue()) {
+                    unique_lock<shared_mutex> exclusive(stateLock);
+                    inventory.checkpointIfDue();
+                }
+                inventory.expireHolds(now);
+            }
+        }
+        
+        {
+            lock_guard<mutex> guard(queueLock);
+            stopping = true;
+        }
+        queueReady.notify_all();
+        for (thread& worker : workers) worker.join();
+        for (auto& entry : connections) ::close(entry.first);
+        connections.clear();
+        ::close(epollFd);
+        ::close(signalFd);
+        ::close(listenFd);
+        uint16_t port;
+        if (!parseTcpAddress(address, port)) ::unlink(address.c_str());
+        cout << "OK stopped frames=" << frames.load() << " connections=" << accepted.load() << endl;
+        return true;
+    }
+};
+
+// Request Client
+// Thin client for the request server. Without options every input line is
+// sent as a text command and the reply printed. The load test opens several
+// connections that log in as soldiers and keep a window of binary
+// request/return frames in flight, timing each frame from send to reply.
+struct LoadConfig {
+    int connections = 4;
+    uint64_t operations = 200000;
+    int depth = 16;   // frames in flight per connection
+    int item = 0;
+    
+    bool parse(const string& arg) {
+        size_t eq = arg.find('=');
+        if (eq == string::npos) return false;
+        string key = arg.substr(0, eq), value = arg.substr(eq + 1);
+        if (value.empty() || !all_of(value.begin(), value.end(), [](char c) { return isdigit((unsigned char)c); })) return false;
+        if (key == "connections") connections = max(1, stoi(value));
+        else if (key == "ops") operations = stoull(value);
+        else if (key == "depth") depth = max(1, stoi(value));
+        else if (key == "item") item = stoi(value);
+        else return false;
+        return true;
+    }
+};
+
+class RequestClient {
+private:
+    int fd = -1;
+    string input;
+    
+public:
+    ~RequestClient() { if (fd >= 0) ::close(fd); }
+    
+    bool connect(const string& address) {
+        fd = openSocket(address, false);
+        return fd >= 0;
+    }
+    
+    bool send(const string& frames) { return sendAll(fd, frames.data(), frames.size()); }
+    
+    // Blocks for the next response frame
+    bool receive(FrameHeader& header, string& payload) {
+        char buffer[16384];
+        while (true) {
+            if (input.size() >= sizeof header) {
+                memcpy(&header, input.data(), sizeof header);
+                if (input.size() - sizeof header >= header.length) break;
+            }
+            ssize_t n = ::read(fd, buffer, sizeof buffer);
+            if (n == 0 || (n < 0 && errno != EINTR)) return false;
+            if (n > 0) input.append(buffer, n);
+        }
+        payload.assign(input, sizeof header, header.length);
+        input.erase(0, sizeof header + header.length);
+        return true;
+    }
+    
+    // Sends a text command and returns its result lines
+    bool command(const string& line, string& result) {
+        string frame;
+        appendFrame(frame, WireOp::Command, 0, line.data(), (uint32_t)line.size());
+        FrameHeader header;
+        return send(frame) && receive(header, result);
+    }
+    
+    bool runCommands(istream& in, ostream& out) {
+        string line, result;
+        while (getline(in, line)) {
+            if (!command(line, result)) return false;
+            out << result << flush;
+        }
+        return true;
+    }
+    
+    static bool runLoad(const string& address, const LoadConfig& config, ostream& out) {
+        vector<unique_ptr<LatencyHistogram>> samples;
+        vector<uint64_t> failures(config.connections, 0);
+        atomic<bool> ok{true};
+        for (int i = 0; i < config.connections; i++) samples.emplace_back(new LatencyHistogram());
+        uint64_t perConnection = config.operations / config.connections;
+        
+        vector<thread> threads;
+        auto start = chrono::steady_clock::now();
+        for (int t = 0; t < config.connections; t++) {
+            threads.emplace_back([&, t] {
+                RequestClient client;
+                string result;
+                if (!client.connect(address) || !client.command("login PAK" + to_string(100000 + t) + " enlisted", result) ||
+                    result.compare(0, 2, "OK") != 0) {
+                    ok = false;
+                    return;
+                }
+                // Requests and returns alternate, so holdings never exceed one
+                vector<chrono::steady_clock::time_point> sentAt(config.depth);
+                uint64_t sent = 0, received = 0;
+                string frames, payload;
+                auto queue = [&] {
+                    ItemPayload item = {config.item, 1};
+                    appendFrame(frames, sent % 2 ? WireOp::Return : WireOp::Request, (uint32_t)sent, &item, sizeof item);
+                    sentAt[sent % config.depth] = chrono::steady_clock::now();
+                    sent++;
+                };
+                while (sent < perConnection && sent < (uint64_t)config.depth) queue();
+                while (received < perConnection) {
+                    if (!frames.empty() && !client.send(frames)) break;
+                    frames.clear();
+                    FrameHeader header;
+                    if (!client.receive(header, payload)) break;
+                    samples[t]->record(chrono::steady_clock::now() - sentAt[header.tag % config.depth]);
+                    if (header.status != (uint16_t)WireStatus::Ok) failures[t]++;
+                    received++;
+                    if (sent < perConnection) queue();
+                }
+                if (received < perConnection) ok = false;
+            });
+        }
+        for (thread& t : threads) t.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        LatencyHistogram merged;
+        for (auto& h : samples) merged.merge(*h);
+        uint64_t failed = 0;
+        for (uint64_t f : failures) failed += f;
+        out << "{\"operation\": \"serverRequestReturn\", \"connections\": " << config.connections
+            << ", \"depth\": " << config.depth << ", \"ops\": " << merged.count()
+            << ", \"throughput_ops_per_sec\": " << fixed << setprecision(1) << (seconds > 0 ? merged.count() / seconds : 0.0)
+            << ", \"p50_ns\": " << merged.percentile(0.50)
+            << ", \"p99_ns\": " << merged.percentile(0.99)
+            << ", \"p999_ns\": " << merged.percentile(0.999)
+            << ", \"failed\": " << failed << "}\n";
+        return ok;
+    }
+};
+
+// Benchmark Harness
+// Generates a synthetic workload and reports throughput and latency
+// percentiles as JSON. Options are key=value pairs, e.g.
+//   --benchmark skus=5000 battalions=300 threads=1,4,8 ops=500000 skew=1.1
+struct BenchmarkConfig {
+    int skus = 1000;                  // catalog size including the standard items
+    int battalions = 100;
+    vector<int> threads = {1, 2, 4};
+    int operations = 200000;          // per thread count, split across the threads
+    int enlistedPercent = 70;         // rank mix of issuance requests, rest is CO
+    int jcoPercent = 20;
+    double skew = 0.99;               // Zipf exponent for item popularity
+    double allocationRatio = 0.1;     // share of operations that are battalion allocations
+    int displayIterations = 200;
+    int planIterations = 10;          // fair-share plans over every SKU and battalion
+    int identities = 1000000;         // roster size for the identity index lookups
+    int holds = 200000;               // pending holds queued on one item
+    int historyChanges = 1000000;     // stock changes folded into the stock history
+    int replenishEvents = 1000000;    // demand events over a simulated year of replenishment
+    bool logging = true;
+    uint64_t seed = 42;
+    
+    bool parse(const string& arg) {
+        size_t eq = arg.find('=');
+        if (eq == string::npos) return false;
+        string key = arg.substr(0, eq), value = arg.substr(eq + 1);
+        try {
+            if (key == "skus") skus = max((int)kStandardItemCount, stoi(value));
+            else if (key == "battalions") battalions = min(max(1, stoi(value)), kMaxBattalions);
+            else if (key == "ops") operations = max(1, stoi(value));
+            else if (key == "enlisted") enlistedPercent = stoi(value);
+            else if (key == "jco") jcoPercent = stoi(value);
+            else if (key == "skew") skew = stod(value);
+            else if (key == "alloc") allocationRatio = stod(value);
+            else if (key == "display") displayIterations = stoi(value);
+            else if (key == "plans") planIterations = stoi(value);
+            else if (key == "identities") identities = max(0, stoi(value));
+            else if (key == "holds") holds = max(0, stoi(value));
+            else if (key == "history") historyChanges = max(0, stoi(value));
+            else if (key == "replenish") replenishEvents = max(0, stoi(value));
+            else if (key == "logging") logging = value != "off" && value != "0";
+            else if (key == "seed") seed = stoull(value);
+            else if (key == "threads") {
+                threads.clear();
+                stringstream list(value);
+                string part;
+                while (getline(list, part, ',')) threads.push_back(max(1, stoi(part)));
+                if (threads.empty()) return false;
+            }
+            else return false;
+        } catch (const exception&) {
+            return false;
+        }
+        return true;
+    }
+};
+
+// Samples from a Zipf distribution over [0, n)
+class ZipfSampler {
+private:
+    vector<double> cdf;
+    
+public:
+    ZipfSampler(int n, double exponent) : cdf(n) {
+        double sum = 0;
+        for (int i = 0; i < n; i++) {
+            sum += 1.0 / pow(i + 1.0, exponent);
+            cdf[i] = sum;
+        }
+        for (double& c : cdf) c /= sum;
+    }
+    
+    template <typename Rng>
+    int operator()(Rng& rng) const {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        int index = (int)(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+        return min(index, (int)cdf.size() - 1);
+    }
+};
+
+// Discards everything written to it; used to time report rendering
+class NullBuffer : public streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    streamsize xsputn(const char*, streamsize n) override { return n; }
+};
+
+class Benchmark {
+private:
+    BenchmarkConfig config;
+    string logPath = "bench_inventory_log.txt";
+    unique_ptr<InventorySystem> inventory;
+    vector<int> issuePopularity[kSoldierRankCount];   // per rank, its entitled items most requested first
+    ostringstream results;
+    bool firstResult = true;
+    size_t historyBytes = 0;          // encoded size of the benchmark's stock history
+    double replenishFillRate = 0;     // share of simulated demand served from stock
+    
+    void setUp() {
+        InventoryConfig cfg;
+        cfg.journalPath = "";
+        cfg.log.path = config.logging ? logPath : "";
+        inventory.reset(new InventorySystem(cfg));
+        
+        // Stock everything generously so the run measures the request path, not rejections
+        const int stock = 1000000000;
+        for (int id = 0; id < kStandardItemCount; id++) {
+            inventory->addItem(kStandardItemNames[id], stock - inventory->getStock(id));
+        }
+        for (int i = kStandardItemCount; i < config.skus; i++) {
+            inventory->addItem("SKU-" + to_string(i), stock);
+        }
+        for (int b = (int)inventory->getBattalions().size(); b < config.battalions; b++) {
+            inventory->addBattalion("Synthetic Battalion " + to_string(b + 1), "Depot " + to_string(b % 20), 800);
+        }
+        
+        const int popularity[] = {AssaultRifle, CombatBoots, Helmet, FirstAidKit, BulletproofVest, Pistol,
+                                  RadioSet, TacticalVest, NightVisionGoggles, MachineGun, SniperRifle};
+        for (int r = 0; r < kSoldierRankCount; r++) {
+            issuePopularity[r].clear();
+            for (int item : popularity) {
+                if (getEntitlement((Rank)r, item) > 0) issuePopularity[r].push_back(item);
+            }
+        }
+    }
+    
+    // Per-thread histograms, merged after the threads finish
+    static vector<unique_ptr<LatencyHistogram>> makeHistograms(int threads) {
+        vector<unique_ptr<LatencyHistogram>> histograms;
+        for (int t = 0; t < threads; t++) histograms.emplace_back(new LatencyHistogram());
+        return histograms;
+    }
+    
+    static unique_ptr<LatencyHistogram> mergeAll(const vector<unique_ptr<LatencyHistogram>>& histograms) {
+        unique_ptr<LatencyHistogram> merged(new LatencyHistogram());
+        for (auto& h : histograms) merged->merge(*h);
+        return merged;
+    }
+    
+    void report(const string& operation, int threads, uint64_t ops, double seconds, const LatencyHistogram& samples) {
+        results << (firstResult ? "\n" : ",\n");
+        firstResult = false;
+        results << "    {\"operation\": \"" << operation << "\", \"threads\": " << threads
+                << ", \"ops\": " << ops
+                << ", \"throughput_ops_per_sec\": " << fixed << setprecision(1) << (seconds > 0 ? ops / seconds : 0.0)
+                << ", \"p50_ns\": " << samples.percentile(0.50)
+                << ", \"p99_ns\": " << samples.percentile(0.99)
+                << ", \"p999_ns\": " << samples.percentile(0.999) << "}";
+    }
+    
+    // Mixed issuance/allocation workload across the given number of threads
+    void runMixed(int threads) {
+        vector<ZipfSampler> issuePickers;
+        for (auto& items : issuePopularity) issuePickers.emplace_back((int)items.size(), config.skew);
+        ZipfSampler allocationPicker(config.skus, config.skew);
+        int perThread = config.operations / threads;
+        
+        auto issueSamples = makeHistograms(threads);
+        auto allocationSamples = makeHistograms(threads);
+        vector<thread> workers;
+        auto start = chrono::steady_clock::now();
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                mt19937_64 rng(config.seed + t);
+                uniform_int_distribution<int> percent(0, 99);
+                uniform_int_distribution<int> battalionPicker(0, config.battalions - 1);
+                bernoulli_distribution isAllocation(config.allocationRatio);
+                
+                for (int i = 0; i < perThread; i++) {
+                    if (isAllocation(rng)) {
+                        int item = allocationPicker(rng);
+                        int battalion = battalionPicker(rng);
+                        auto begin = chrono::steady_clock::now();
+                        inventory->allocateToBattalion(battalion, item, 1, Rank::Brigadier);
+                        allocationSamples[t]->record(chrono::steady_clock::now() - begin);
+                    } else {
+                        int roll = percent(rng);
+                        Rank rank = roll < config.enlistedPercent ? Rank::Enlisted
+                                  : roll < config.enlistedPercent + config.jcoPercent ? Rank::JuniorCommissionedOfficer
+                                  : Rank::CommissionedOfficer;
+                        int item = issuePopularity[(int)rank][issuePickers[(int)rank](rng)];
+                        auto begin = chrono::steady_clock::now();
+                        inventory->requestItem(item, 1, rank);
+                        issueSamples[t]->record(chrono::steady_clock::now() - begin);
+                    }
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        auto issues = mergeAll(issueSamples);
+        auto allocations = mergeAll(allocationSamples);
+        // Both operation types share the wall-clock time of the mixed run
+        report("requestItem", threads, issues->count(), seconds, *issues);
+        report("allocateToBattalion", threads, allocations->count(), seconds, *allocations);
+    }
+    
+    void runLogging(int threads) {
+        int perThread = config.operations / threads;
+        auto samples = makeHistograms(threads);
+        vector<thread> workers;
+        auto start = chrono::steady_clock::now();
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                for (int i = 0; i < perThread; i++) {
+                    auto begin = chrono::steady_clock::now();
+                    inventory->logTransaction(i % config.skus, 1, Rank::Enlisted);
+                    samples[t]->record(chrono::steady_clock::now() - begin);
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        auto merged = mergeAll(samples);
+        report("logTransaction", threads, merged->count(), seconds, *merged);
+    }
+    
+    // Plans against norms that outstrip the stock, so every item goes
+    // through the max-min solver
+    void runPlanner(int threads) {
+        const int scarceNorm = 1000000000 / 800;
+        for (int id = 0; id < config.skus; id++) inventory->setSoldierNorm(id, scarceNorm + id % 3);
+        unique_ptr<LatencyHistogram> samples(new LatencyHistogram());
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < config.planIterations; i++) {
+            auto begin = chrono::steady_clock::now();
+            inventory->planAllocation(AllocationPolicy::MaxMinFair, threads);
+            samples->record(chrono::steady_clock::now() - begin);
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        report("planAllocation", threads, samples->count(), seconds, *samples);
+    }
+    
+    // Builds a roster index file, then times mapping it and looking up logins
+    void runIdentities() {
+        const string indexPath = "bench_identity_index.bin";
+        mt19937_64 rng(config.seed);
+        IdentityIndexBuilder builder;
+        for (int i = 0; i < config.identities; i++) {
+            builder.add("PAK" + to_string(1000000 + i), "Soldier " + to_string(i), "Battalion " + to_string(i % 300), Rank::Enlisted);
+        }
+        size_t duplicates;
+        if (!builder.write(indexPath, duplicates)) return;
+        
+        IdentityIndex index;
+        unique_ptr<LatencyHistogram> samples(new LatencyHistogram());
+        auto begin = chrono::steady_clock::now();
+        index.open(indexPath);
+        samples->record(chrono::steady_clock::now() - begin);
+        report("identityIndexOpen", 1, 1, chrono::duration<double>(chrono::steady_clock::now() - begin).count(), *samples);
+        
+        vector<string> logins(4096);
+        for (string& pak : logins) pak = "PAK" + to_string(1000000 + rng() % (config.identities + config.identities / 10));
+        samples.reset(new LatencyHistogram());
+        Identity identity;
+        uint64_t found = 0;
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < config.operations; i++) {
+            const string& pak = logins[i % logins.size()];
+            auto lookup = chrono::steady_clock::now();
+            found += index.find(pak, identity);
+            samples->record(chrono::steady_clock::now() - lookup);
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        report("identityLookup", 1, samples->count(), seconds, *samples);
+        if (found == 0 && config.identities > 0) cerr << "Warning: no identity lookup succeeded\n";
+        ::unlink(indexPath.c_str());
+    }
+    
+    // Queues holds of mixed officer ranks on an item with no stock, meets half
+    // of them with one restock, cancels a quarter and lets the rest lapse
+    void runHolds() {
+        const string item = "Reserved SKU";
+        int itemId = inventory->addItem(item, 0);
+        mt19937_64 rng(config.seed);
+        vector<uint32_t> ids;
+        ids.reserve(config.holds);
+        
+        unique_ptr<LatencyHistogram> samples(new LatencyHistogram());
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < config.holds; i++) {
+            Rank rank = (Rank)((int)Rank::LieutenantColonel + rng() % 6);
+            auto begin = chrono::steady_clock::now();
+            ids.push_back(inventory->placeHold(itemId, 1, rank, i + 1, 600).id);
+            samples->record(chrono::steady_clock::now() - begin);
+        }
+        report("holdPlace", 1, samples->count(), chrono::duration<double>(chrono::steady_clock::now() - start).count(), *samples);
+        
+        samples.reset(new LatencyHistogram());
+        start = chrono::steady_clock::now();
+        inventory->addItem(item, config.holds / 2);
+        samples->record(chrono::steady_clock::now() - start);
+        report("holdMeet", 1, config.holds / 2, chrono::duration<double>(chrono::steady_clock::now() - start).count(), *samples);
+        
+        samples.reset(new LatencyHistogram());
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < config.holds; i += 4) {
+            auto begin = chrono::steady_clock::now();
+            inventory->cancelHold(ids[i], i + 1);
+            samples->record(chrono::steady_clock::now() - begin);
+        }
+        report("holdCancel", 1, samples->count(), chrono::duration<double>(chrono::steady_clock::now() - start).count(), *samples);
+        
+        samples.reset(new LatencyHistogram());
+        start = chrono::steady_clock::now();
+        size_t expired = inventory->expireHolds(time(0) + 601 + 600);
+        samples->record(chrono::steady_clock::now() - start);
+        report("holdExpire", 1, expired, chrono::duration<double>(chrono::steady_clock::now() - start).count(), *samples);
+    }
+    
+    // Folds synthetic journal generations of allocations and returns into a
+    // history the way snapshots do, one generation per snapshot interval,
+    // then rebuilds a battalion's holdings at random points in time
+    void runHistory() {
+        const int items = inventory->getItemCount(), battalions = (int)inventory->getBattalions().size();
+        const size_t interval = InventoryConfig().snapshotInterval;
+        StockHistory history;
+        mt19937_64 rng(config.seed);
+        vector<int> central(items, 1000000), held((size_t)battalions * items, 0);
+        auto live = [&]() {
+            vector<pair<uint64_t, int>> cells;
+            for (int id = 0; id < items; id++) {
+                cells.push_back({StockHistory::cellKey({HolderKind::Central, 0}, id), central[id]});
+                for (int b = 0; b < battalions; b++) {
+                    int quantity = held[(size_t)b * items + id];
+                    if (quantity != 0) cells.push_back({StockHistory::cellKey({HolderKind::Battalion, b}, id), quantity});
+                }
+            }
+            return cells;
+        };
+        
+        // Ten changes a second from a fixed start, so the history spans a known range
+        const int64_t start = 1700000000;
+        int64_t now = start;
+        history.fold({}, live(), now, 0);
+        history.commit();
+        
+        vector<JournalRecord> records;
+        unique_ptr<LatencyHistogram> samples(new LatencyHistogram());
+        double seconds = 0;
+        for (int i = 0; i < config.historyChanges; i++) {
+            int id = rng() % items, b = rng() % battalions, quantity = 1 + rng() % 10;
+            int& holding = held[(size_t)b * items + id];
+            bool back = holding >= quantity && rng() % 3 == 0;
+            holding += back ? -quantity : quantity;
+            central[id] += back ? quantity : -quantity;
+            if (back) {
+                uint64_t route = (uint64_t)Holder{HolderKind::Battalion, b}.pack() << 32 | Holder{HolderKind::Central, 0}.pack();
+                records.push_back({now, route, id, quantity, -1, (uint8_t)Rank::General, (uint8_t)JournalOp::Transfer, 0});
+            } else {
+                records.push_back({now, 0, id, quantity, (int16_t)b, (uint8_t)Rank::General, (uint8_t)JournalOp::Allocate, 0});
+            }
+            if (i % 10 == 9) now++;
+            if (records.size() < interval && i + 1 < config.historyChanges) continue;
+            
+            auto begin = chrono::steady_clock::now();
+            history.fold(records, live(), now, 0);
+            history.commit();
+            auto elapsed = chrono::steady_clock::now() - begin;
+            samples->record(elapsed);
+            seconds += chrono::duration<double>(elapsed).count();
+            records.clear();
+        }
+        report("historyFold", 1, config.historyChanges, seconds, *samples);
+        
+        samples.reset(new LatencyHistogram());
+        seconds = 0;
+        int64_t total = 0;
+        vector<int> quantities(items);
+        for (int i = 0; i < config.displayIterations; i++) {
+            int64_t when = start + (int64_t)(rng() % (uint64_t)(now - start + 1));
+            int b = rng() % battalions;
+            auto begin = chrono::steady_clock::now();
+            fill(quantities.begin(), quantities.end(), 0);
+            history.visitAt(when, "", 0, [&](Holder at, int id, int amount) {
+                if (at.kind == HolderKind::Battalion && at.index == b) quantities[id] += amount;
+            });
+            auto elapsed = chrono::steady_clock::now() - begin;
+            samples->record(elapsed);
+            seconds += chrono::duration<double>(elapsed).count();
+            for (int quantity : quantities) total += quantity;
+        }
+        report("historyQuery", 1, samples->count(), seconds, *samples);
+        if (total < 0) cerr << "Warning: history rebuilt a negative holding\n";
+        historyBytes = history.getBytes();
+    }
+    
+    // Runs a simulated year of Zipf-distributed demand over every SKU
+    // against a standalone replenishment engine with daily periods and a
+    // week's lead time. Each demand event is one timed update: the engine
+    // learns the demand and checks the item against its reorder point.
+    // Every item opens with about a month of its expected demand. Orders
+    // are received as soon as they fall due, outside the timing.
+    void runReplenishment() {
+        ReplenishConfig cfg;
+        cfg.path = "";
+        ReplenishmentEngine engine(cfg);
+        engine.resize(config.skus);
+        ZipfSampler picker(config.skus, config.skew);
+        mt19937_64 rng(config.seed);
+        const int days = 365, perDay = max(1, config.replenishEvents / days);
+        const int64_t start = 1700000000;
+        
+        double weightSum = 0;
+        for (int i = 0; i < config.skus; i++) weightSum += 1.0 / pow(i + 1.0, config.skew);
+        vector<AtomicCounter> stock(config.skus);
+        for (int i = 0; i < config.skus; i++) {
+            stock[i].store((int)ceil(30 * perDay * 2.0 / pow(i + 1.0, config.skew) / weightSum));
+        }
+        
+        vector<pair<int, int>> events(perDay);   // item, quantity
+        deque<ReplenishOrder> placed;            // due in the order placed, as every lead time is the same
+        uint64_t demanded = 0, served = 0;
+        unique_ptr<LatencyHistogram> samples(new LatencyHistogram());
+        double seconds = 0;
+        for (int day = 0; day < days; day++) {
+            for (auto& event : events) event = {picker(rng), 1 + (int)(rng() % 3)};
+            for (int e = 0; e < perDay; e++) {
+                int64_t now = start + (int64_t)day * 86400 + (int64_t)e * 86400 / perDay;
+                while (!placed.empty() && placed.front().due <= now) {
+                    ReplenishOrder order;
+                    if (engine.receive(placed.front().id, order)) stock[order.itemId].add(order.quantity);
+                    placed.pop_front();
+                }
+                int id = events[e].first, quantity = events[e].second, before;
+                demanded += quantity;
+                if (stock[id].tryTake(quantity, before)) served += quantity;
+                
+                auto begin = chrono::steady_clock::now();
+                ReplenishOrder order;
+                engine.observe(id, quantity, now);
+                bool ordered = engine.reorder(id, stock[id], now, order);
+                auto elapsed = chrono::steady_clock::now() - begin;
+                samples->record(elapsed);
+                seconds += chrono::duration<double>(elapsed).count();
+                if (ordered) placed.push_back(order);
+            }
+        }
+        report("replenishUpdate", 1, samples->count(), seconds, *samples);
+        replenishFillRate = demanded > 0 ? (double)served / demanded : 1.0;
+    }
+    
+    // Resolves item name prefixes of varying length the way menu selection does
+    void runSearch() {
+        const ItemCatalog& catalog = inventory->getCatalog();
+        mt19937_64 rng(config.seed);
+        vector<string> prefixes(4096);
+        for (string& prefix : prefixes) {
+            const string& name = catalog.getName(rng() % catalog.size());
+            prefix = name.substr(0, 1 + rng() % name.size());
+        }
+        unique_ptr<LatencyHistogram> samples(new LatencyHistogram());
+        uint64_t found = 0;
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < config.operations; i++) {
+            auto begin = chrono::steady_clock::now();
+            found += catalog.getSearch().find(prefixes[i % prefixes.size()]) >= 0;
+            samples->record(chrono::steady_clock::now() - begin);
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        report("itemPrefixSearch", 1, samples->count(), seconds, *samples);
+        if (found == 0) cerr << "Warning: no item prefix resolved\n";
+    }
+    
+    // Times each report twice: re-rendered after a change, and served from
+    // the cache while nothing changes
+    void runDisplay() {
+        NullBuffer sink;
+        ostream out(&sink);
+        struct Case {
+            const char* name;
+            ReportKind kind;
+            ReportFormat format;
+        };
+        static const Case cases[] = {
+            {"CentralInventory", ReportKind::CentralInventory, ReportFormat::Text},
+            {"CentralInventoryJson", ReportKind::CentralInventory, ReportFormat::Json},
+            {"BattalionStatus", ReportKind::BattalionStatus, ReportFormat::Text},
+            {"BattalionStatusCsv", ReportKind::BattalionStatus, ReportFormat::Csv},
+        };
+        for (const Case& c : cases) {
+            for (bool changed : {true, false}) {
+                unique_ptr<LatencyHistogram> samples(new LatencyHistogram());
+                double seconds = 0;
+                for (int i = 0; i < config.displayIterations; i++) {
+                    if (changed) inventory->deploySoldiers(0, 0, Rank::General);
+                    auto begin = chrono::steady_clock::now();
+                    inventory->writeReport(out, c.kind, c.format);
+                    auto elapsed = chrono::steady_clock::now() - begin;
+                    samples->record(elapsed);
+                    seconds += chrono::duration<double>(elapsed).count();
+                }
+                report(string(changed ? "render" : "cached") + c.name, 1, samples->count(), seconds, *samples);
+            }
+        }
+    }
+    
+public:
+    explicit Benchmark(const BenchmarkConfig& cfg) : config(cfg) {}
+    
+    ~Benchmark() {
+        inventory.reset();
+        if (config.logging) ::unlink(logPath.c_str());
+    }
+    
+    void run(ostream& out) {
+        setUp();
+        for (int threads : config.threads) {
+            runMixed(threads);
+            if (config.logging) runLogging(threads);
+        }
+        runDisplay();
+        runSearch();
+        if (config.holds > 0) runHolds();
+        if (config.historyChanges > 0) runHistory();
+        if (config.replenishEvents > 0) runReplenishment();
+        for (int threads : config.threads) {
+            if (config.planIterations > 0) runPlanner(threads);
+        }
+        if (config.identities > 0) runIdentities();
+        
+        out << "{\n  \"benchmark\": \"military-assets-management-system\",\n"
+            << "  \"config\": {\"skus\": " << config.skus << ", \"battalions\": " << config.battalions
+            << ", \"ops\": " << config.operations << ", \"enlisted_percent\": " << config.enlistedPercent
+            << ", \"jco_percent\": " << config.jcoPercent << ", \"skew\": " << config.skew
+            << ", \"allocation_ratio\": " << config.allocationRatio
+            << ", \"logging\": " << (config.logging ? "true" : "false")
+            << ", \"seed\": " << config.seed
+            << ", \"hardware_threads\": " << thread::hardware_concurrency() << "},\n"
+            << "  \"history_bytes\": " << historyBytes << ",\n"
+            << "  \"replenish_fill_rate\": " << setprecision(4) << replenishFillRate << ",\n"
+            << "  \"results\": [" << results.str() << "\n  ]\n}\n";
+    }
+};
+
+// Allocation Check
+// Shows that the request and login paths stay off the heap once warm. Each
+// path runs a few times so tables, metrics shards and buffers reach their
+// working size, then the allocations made by this thread are counted over
+// many more iterations. Prints one line per path and fails if any path
+// allocated or a command did not succeed.
+//
+//   --alloc-check [iterations=N]   (needs a -DMAMS_ALLOC_CHECK build)
+#ifdef MAMS_ALLOC_CHECK
+class AllocationCheck {
+private:
+    // Keeps the latest reply of a command in a fixed buffer
+    class ReplyBuffer : public streambuf {
+    private:
+        char line[256];
+    
+    protected:
+        int overflow(int c) override { return c; }
+    
+    public:
+        ReplyBuffer() { reset(); }
+        void reset() { setp(line, line + sizeof(line)); }
+        string_view view() const { return string_view(pbase(), pptr() - pbase()); }
+    };
+    
+    const string prefix = "alloc_check_";
+    int iterations;
+    bool passed = true;
+    
+    // Runs step warm-up times, then counts the allocations of iterations more
+    template <typename Step>
+    void measure(ostream& out, const char* path, Step step) {
+        bool ok = true;
+        for (int i = 0; i < 64; i++) ok = step() && ok;
+        uint64_t before = threadAllocations;
+        for (int i = 0; i < iterations; i++) ok = step() && ok;
+        uint64_t allocations = threadAllocations - before;
+        passed = passed && ok && allocations == 0;
+        out << (ok && allocations == 0 ? "OK " : "FAIL ") << path << " iterations=" << iterations
+            << " allocations=" << allocations << (ok ? "" : " (command failed)") << "\n";
+    }
+    
+public:
+    explicit AllocationCheck(int count) : iterations(count) {}
+    
+    bool run(ostream& out) {
+        InventoryConfig cfg;
+        cfg.journalPath = prefix + "journal.bin";
+        cfg.snapshotPath = prefix + "snapshot.bin";
+        cfg.historyPath = prefix + "history.bin";
+        cfg.replenish.path = prefix + "replenish.bin";
+        cfg.log.path = prefix + "log.txt";
+        {
+            InventorySystem inventory(cfg);
+            inventory.addItem(kStandardItemNames[AssaultRifle], 1000000);
+            uint64_t soldier = HoldingsLedger::soldierKey("PAK5555");
+            
+            measure(out, "requestItem", [&]() {
+                return inventory.requestItem(AssaultRifle, 1, Rank::Enlisted, soldier) == RequestResult::Success &&
+                       inventory.returnItem(AssaultRifle, 1, Rank::Enlisted, soldier) == RequestResult::Success;
+            });
+            measure(out, "transfer", [&]() {
+                Holder central = {HolderKind::Central, 0}, battalion = {HolderKind::Battalion, 1};
+                return inventory.allocateToBattalion(1, Helmet, 1, Rank::General) &&
+                       inventory.transfer(battalion, central, Helmet, 1, Rank::General) == RequestResult::Success;
+            });
+            
+            ReplyBuffer reply;
+            ostream replies(&reply);
+            CommandProcessor processor(inventory, replies, nullptr, false);
+            auto command = [&](const string& line) {
+                reply.reset();
+                processor.execute(line);
+                return reply.view().compare(0, 3, "OK ") == 0;
+            };
+            const string soldierLogin = "login PAK5555 enlisted", jcoLogin = "login PAK5555 jco", officerLogin = "login GPAK1234";
+            const string request = "request \"Assault Rifle\" 1", giveBack = "return \"Assault Rifle\" 1";
+            const string allocate = "allocate \"Night Vision Goggles\" 1 \"6th Baloch Regiment\"";
+            const string transferBack = "transfer \"Night Vision Goggles\" 1 \"6th Baloch Regiment\" central";
+            
+            measure(out, "commandLogin", [&]() { return command(officerLogin) && command(jcoLogin) && command(soldierLogin); });
+            measure(out, "commandRequest", [&]() { return command(request) && command(giveBack); });
+            command(officerLogin);
+            measure(out, "commandTransfer", [&]() { return command(allocate) && command(transferBack); });
+            measure(out, "soldierSession", [&]() {
+                SessionArena arena;
+                pmr::string pakNumber("PAK5555", arena.resource()), name("Muhammad Hassan Khan", arena.resource());
+                auto soldier = arena.make<EnlistedSoldier>(pakNumber, name);
+                return HoldingsLedger::soldierKey(soldier->getPakNumber()) == HoldingsLedger::soldierKey("PAK5555");
+            });
+        }
+        for (const char* file : {"journal.bin", "snapshot.bin", "history.bin", "replenish.bin", "log.txt"}) {
+            ::unlink((prefix + file).c_str());
+        }
+        out << (passed ? "OK" : "FAIL") << " alloc-check\n";
+        return passed;
+    }
+};
+#endif
+
+// Log Analytics
+// Reads inventory_log.txt and its rotated segments back and reports
+// consumption per item, rank and time window, burn rates and projected
+// depletion dates. Every segment is cut into fixed-size byte ranges that
+// worker threads parse independently through one reused buffer each, so
+// memory stays constant however large the logs are. A record spans two
+// lines ("[ctime" then "] Rank verb Item xN [to Battalion]"), and a range
+// owns the records whose first line starts inside it.
+struct AnalyzerConfig {
+    string logPath = "inventory_log.txt";
+    vector<string> files;               // explicit segments instead of logPath and its rotations
+    int threads = 0;                    // 0 uses every hardware thread
+    int64_t windowSeconds = 86400;
+    int windows = 14;                   // most recent windows to report
+    size_t rangeBytes = 64 << 20;
+    
+    bool parse(const string& arg) {
+        size_t eq = arg.find('=');
+        if (eq == string::npos) {
+            files.push_back(arg);
+            return true;
+        }
+        string key = arg.substr(0, eq), value = arg.substr(eq + 1);
+        if (key == "threads") threads = max(1, atoi(value.c_str()));
+        else if (key == "window") {
+            if (value == "hour") windowSeconds = 3600;
+            else if (value == "day") windowSeconds = 86400;
+            else if (value == "week") windowSeconds = 7 * 86400;
+            else windowSeconds = max(1L, atol(value.c_str()));
+        }
+        else if (key == "windows") windows = max(1, atoi(value.c_str()));
+        else if (key == "log") logPath = value;
+        else if (key == "range") rangeBytes = (size_t)max(1L, atol(value.c_str())) << 20;   // MB per work unit
+        else return false;
+        return true;
+    }
+};
+
+// Per-worker totals; merged once all ranges are done
+struct LogTally {
+    struct ItemTally {
+        uint64_t requested = 0;
+        uint64_t allocated = 0;
+        uint64_t returned = 0;
+    };
+    unordered_map<string, int> itemIds;
+    vector<string> itemNames;
+    vector<ItemTally> items;
+    uint64_t rankUnits[kRankCount] = {};
+    map<int64_t, pair<uint64_t, uint64_t>> windows;   // window start -> units out, units returned
+    uint64_t records = 0;
+    uint64_t malformed = 0;
+    int64_t first = numeric_limits<int64_t>::max();
+    int64_t last = numeric_limits<int64_t>::min();
+    string key;                                        // reused lookup buffer
+    int64_t cachedWindow = numeric_limits<int64_t>::min();
+    pair<uint64_t, uint64_t>* cachedSlot = nullptr;
+    
+    // Records of one range are mostly in time order, so the last window is cached
+    pair<uint64_t, uint64_t>& window(int64_t start) {
+        if (start != cachedWindow) {
+            cachedWindow = start;
+            cachedSlot = &windows[start];
+        }
+        return *cachedSlot;
+    }
+    
+    ItemTally& item(const char* name, size_t length) {
+        key.assign(name, length);
+        auto found = itemIds.find(key);
+        if (found != itemIds.end()) return items[found->second];
+        itemIds.emplace(key, (int)items.size());
+        itemNames.push_back(key);
+        items.emplace_back();
+        return items.back();
+    }
+    
+    void merge(const LogTally& other) {
+        for (size_t i = 0; i < other.items.size(); i++) {
+            ItemTally& into = item(other.itemNames[i].data(), other.itemNames[i].size());
+            into.requested += other.items[i].requested;
+            into.allocated += other.items[i].allocated;
+            into.returned += other.items[i].returned;
+        }
+        for (int r = 0; r < kRankCount; r++) rankUnits[r] += other.rankUnits[r];
+        for (auto& window : other.windows) {
+            windows[window.first].first += window.second.first;
+            windows[window.first].second += window.second.second;
+        }
+        records += other.records;
+        malformed += other.malformed;
+        first = min(first, other.first);
+        last = max(last, other.last);
+    }
+};
+
+class LogAnalyzer {
+private:
+    static constexpr size_t kBufferBytes = 1 << 20;
+    
+    struct Range {
+        const string* path;
+        off_t begin;
+        off_t end;
+    };
+    
+    AnalyzerConfig config;
+    
+    // Days since 1970-01-01 of a civil date (proleptic Gregorian)
+    static int64_t daysFromCivil(int64_t y, int m, int d) {
+        y -= m <= 2;
+        int64_t era = (y >= 0 ? y : y - 399) / 400;
+        int64_t yoe = y - era * 400;
+        int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+        int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + doe - 719468;
+    }
+    
+    static string formatTime(int64_t seconds) {
+        int64_t z = (seconds >= 0 ? seconds : seconds - 86399) / 86400 + 719468;
+        int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+        int64_t doe = z - era * 146097;
+        int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        int64_t mp = (5 * doy + 2) / 153;
+        int day = (int)(doy - (153 * mp + 2) / 5 + 1);
+        int month = (int)(mp < 10 ? mp + 3 : mp - 9);
+        int64_t year = yoe + era * 400 + (month <= 2);
+        int64_t secs = seconds - (z - 719468) * 86400;
+        char text[32];
+        snprintf(text, sizeof(text), "%04lld-%02d-%02d %02d:%02d", (long long)year, month, day,
+                 (int)(secs / 3600), (int)(secs / 60 % 60));
+        return text;
+    }
+    
+    static int digits(const char* p, int count) {
+        int value = 0;
+        for (int i = 0; i < count; i++) {
+            if (p[i] == ' ') continue;
+            if (p[i] < '0' || p[i] > '9') return -1;
+            value = value * 10 + (p[i] - '0');
+        }
+        return value;
+    }
+    
+    // Parses "Www Mmm dd hh:mm:ss yyyy" as written by ctime. The result
+    // counts seconds of local clock time, which is all the windows need.
+    static bool parseTimestamp(const char* p, size_t length, int64_t& seconds) {
+        static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+        if (length < 24 || p[3] != ' ' || p[7] != ' ' || p[13] != ':' || p[16] != ':' || p[19] != ' ') return false;
+        int month = 0;
+        while (month < 12 && memcmp(months + 3 * month, p + 4, 3) != 0) month++;
+        int day = digits(p + 8, 2), hour = digits(p + 11, 2), minute = digits(p + 14, 2);
+        int second = digits(p + 17, 2), year = digits(p + 20, 4);
+        if (month == 12 || day < 1 || hour < 0 || minute < 0 || second < 0 || year < 0) return false;
+        seconds = daysFromCivil(year, month + 1, day) * 86400 + hour * 3600 + minute * 60 + second;
+        return true;
+    }
+    
+    // Parses "Rank verb Item xN [to Battalion]" and "Rank transferred Item xN
+    // from A to B". Transfers only move stock around, so they count as
+    // records but not as consumption.
+    bool parseBody(const char* p, const char* end, int64_t timestamp, LogTally& tally) const {
+        int rank = 0;
+        for (; rank < kRankCount; rank++) {
+            size_t length = strlen(kRankNames[rank]);
+            if ((size_t)(end - p) > length && memcmp(p, kRankNames[rank], length) == 0 && p[length] == ' ') {
+                p += length + 1;
+                break;
+            }
+        }
+        if (rank == kRankCount) return false;
+        
+        int verb;
+        static const char* const verbs[4] = {"requested ", "allocated ", "returned ", "transferred "};
+        for (verb = 0; verb < 4; verb++) {
+            size_t length = strlen(verbs[verb]);
+            if ((size_t)(end - p) > length && memcmp(p, verbs[verb], length) == 0) {
+                p += length;
+                break;
+            }
+        }
+        if (verb == 4) return false;
+        
+        // The quantity is the first " x<digits>" that ends the line or precedes " to "
+        for (const char* x = p; x + 2 < end; x++) {
+            if (x[0] != ' ' || x[1] != 'x' || x[2] < '0' || x[2] > '9') continue;
+            const char* q = x + 2;
+            uint64_t quantity = 0;
+            while (q < end && *q >= '0' && *q <= '9') quantity = quantity * 10 + (*q++ - '0');
+            bool allocation = verb == 1;
+            if (verb == 3) {
+                if (end - q <= 6 || memcmp(q, " from ", 6) != 0) continue;
+                tally.records++;
+                tally.first = min(tally.first, timestamp);
+                tally.last = max(tally.last, timestamp);
+                return true;
+            }
+            if (!(q == end || (allocation && end - q > 4 && memcmp(q, " to ", 4) == 0))) continue;
+            
+            LogTally::ItemTally& item = tally.item(p, x - p);
+            if (verb == 2) {
+                item.returned += quantity;
+            } else {
+                (allocation ? item.allocated : item.requested) += quantity;
+                tally.rankUnits[rank] += quantity;
+            }
+            int64_t window = timestamp - ((timestamp % config.windowSeconds) + config.windowSeconds) % config.windowSeconds;
+            (verb == 2 ? tally.window(window).second : tally.window(window).first) += quantity;
+            tally.records++;
+            tally.first = min(tally.first, timestamp);
+            tally.last = max(tally.last, timestamp);
+            return true;
+        }
+        return false;
+    }
+    
+    void scanRange(const Range& range, LogTally& tally) const {
+        int fd = ::open(range.path->c_str(), O_RDONLY);
+        if (fd < 0) return;
+        ::posix_fadvise(fd, range.begin, range.end - range.begin, POSIX_FADV_SEQUENTIAL);
+        
+        vector<char> buffer(kBufferBytes);
+        // Start one byte early: the partial line up to the first newline
+        // belongs to the previous range
+        off_t base = range.begin > 0 ? range.begin - 1 : 0;   // file offset of buffer[0]
+        size_t filled = 0, cursor = 0;
+        bool eof = false, skipLine = range.begin > 0;
+        bool pending = false;                                  // a "[ctime" line awaits its body
+        bool seenRecord = false;                               // body lines before the first record are the previous range's
+        int64_t timestamp = 0;
+        
+        while (true) {
+            const char* start = buffer.data() + cursor;
+            const char* newline = static_cast<const char*>(memchr(start, '\n', filled - cursor));
+            if (!newline && !eof) {
+                // Keep the partial line and read more behind it
+                if (cursor == 0 && filled == buffer.size()) {
+                    // A line longer than the buffer cannot be a record
+                    tally.malformed++;
+                    pending = false;
+                    skipLine = true;
+                    cursor = filled;
+                }
+                memmove(buffer.data(), buffer.data() + cursor, filled - cursor);
+                base += cursor;
+                filled -= cursor;
+                cursor = 0;
+                ssize_t n = ::pread(fd, buffer.data() + filled, buffer.size() - filled, base + filled);
+                if (n <= 0) eof = true;
+                else filled += n;
+                continue;
+            }
+            const char* lineEnd = newline ? newline : buffer.data() + filled;
+            off_t lineOffset = base + cursor;
+            cursor = newline ? newline - buffer.data() + 1 : filled;
+            if (lineEnd == start && !newline) break;   // end of file
+            
+            if (skipLine) {
+                skipLine = false;
+                continue;
+            }
+            if (lineOffset >= range.end && !pending) break;
+            
+            if (lineEnd > start && start[0] == '[') {
+                if (pending) tally.malformed++;
+                if (lineOffset >= range.end) break;
+                seenRecord = true;
+                pending = parseTimestamp(start + 1, lineEnd - start - 1, timestamp);
+                if (!pending) tally.malformed++;
+            } else if (pending && lineEnd - start > 2 && start[0] == ']' && start[1] == ' ') {
+                if (!parseBody(start + 2, lineEnd, timestamp, tally)) tally.malformed++;
+                pending = false;
+            } else if (lineEnd > start && seenRecord) {
+                tally.malformed++;
+                pending = false;
+            }
+            if (!newline) break;
+        }
+        ::close(fd);
+    }
+    
+public:
+    explicit LogAnalyzer(const AnalyzerConfig& cfg) : config(cfg) {}
+    
+    // Runs the analysis. stockOf returns the current stock of an item
+    // name, or -1 when the item is unknown.
+    void run(ostream& out, const function<int(const string&)>& stockOf) {
+        vector<string> files = config.files;
+        if (files.empty()) {
+            for (int segment = 1; ::access(AsyncLogWriter::segmentPath(config.logPath, segment).c_str(), F_OK) == 0; segment++) {
+                files.push_back(AsyncLogWriter::segmentPath(config.logPath, segment));
+            }
+            files.push_back(config.logPath);
+        }
+        
+        vector<Range> ranges;
+        uint64_t totalBytes = 0;
+        int segments = 0;
+        for (const string& file : files) {
+            struct stat st;
+            if (::stat(file.c_str(), &st) != 0) continue;
+            segments++;
+            totalBytes += st.st_size;
+            for (off_t begin = 0; begin < st.st_size; begin += config.rangeBytes) {
+                ranges.push_back({&file, begin, min<off_t>(st.st_size, begin + config.rangeBytes)});
+            }
+        }
+        
+        int threads = config.threads > 0 ? config.threads : max(1u, thread::hardware_concurrency());
+        threads = max(1, min(threads, (int)ranges.size()));
+        vector<LogTally> tallies(threads);
+        atomic<size_t> nextRange{0};
+        auto started = chrono::steady_clock::now();
+        auto work = [&](int worker) {
+            for (size_t r; (r = nextRange.fetch_add(1)) < ranges.size();) scanRange(ranges[r], tallies[worker]);
+        };
+        vector<thread> pool;
+        for (int t = 1; t < threads; t++) pool.emplace_back(work, t);
+        work(0);
+        for (auto& worker : pool) worker.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        
+        LogTally& total = tallies[0];
+        for (int t = 1; t < threads; t++) total.merge(tallies[t]);
+        report(out, total, segments, totalBytes, seconds, threads, stockOf);
+    }
+    
+private:
+    void report(ostream& out, const LogTally& total, int segments, uint64_t bytes, double seconds, int threads,
+                const function<int(const string&)>& stockOf) const {
+        out << fixed << setprecision(1);
+        out << "LOG ANALYTICS\n";
+        out << "Segments: " << segments << " (" << bytes / 1048576.0 << " MB), " << total.records << " records, "
+            << total.malformed << " malformed\n";
+        out << "Throughput: " << (seconds > 0 ? bytes / 1048576.0 / seconds : 0.0) << " MB/s on " << threads << " threads\n";
+        if (total.records == 0) return;
+        
+        double days = max(1.0, (total.last - total.first) / 86400.0);
+        out << "Span: " << formatTime(total.first) << " to " << formatTime(total.last) << " (" << days << " days)\n";
+        
+        vector<int> order(total.items.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = (int)i;
+        auto net = [&](int i) {
+            const LogTally::ItemTally& item = total.items[i];
+            return (int64_t)(item.requested + item.allocated) - (int64_t)item.returned;
+        };
+        sort(order.begin(), order.end(), [&](int a, int b) { return net(a) > net(b); });
+        
+        out << "\nCONSUMPTION PER ITEM:\n";
+        out << left << setw(24) << "Item" << right << setw(11) << "Requested" << setw(11) << "Allocated"
+            << setw(10) << "Returned" << setw(10) << "Per day" << setw(9) << "Stock" << "  Depletes\n";
+        for (int i : order) {
+            const LogTally::ItemTally& item = total.items[i];
+            double burn = net(i) / days;
+            int stock = stockOf(total.itemNames[i]);
+            out << left << setw(24) << total.itemNames[i] << right << setw(11) << item.requested
+                << setw(11) << item.allocated << setw(10) << item.returned << setw(10) << burn;
+            if (stock < 0) {
+                out << setw(9) << "-" << "  -\n";
+            } else if (burn <= 0) {
+                out << setw(9) << stock << "  never\n";
+            } else {
+                out << setw(9) << stock << "  " << formatTime(total.last + (int64_t)(stock / burn * 86400)).substr(0, 10) << "\n";
+            }
+        }
+        
+        out << "\nCONSUMPTION PER RANK:\n";
+        for (int r = 0; r < kRankCount; r++) {
+            if (total.rankUnits[r] > 0) out << "- " << kRankNames[r] << ": " << total.rankUnits[r] << " units\n";
+        }
+        
+        out << "\nCONSUMPTION PER WINDOW (" << config.windowSeconds << " s, most recent " << config.windows << "):\n";
+        auto window = total.windows.begin();
+        if (total.windows.size() > (size_t)config.windows) advance(window, total.windows.size() - config.windows);
+        for (; window != total.windows.end(); ++window) {
+            out << formatTime(window->first) << "  out " << window->second.first << "  returned " << window->second.second << "\n";
+        }
+    }
+};
+
+// Store Viewer
+// Prints the live state of a state store file from another process. The
+// store is mapped read-only and read in place; if the owning process lays
+// the store out anew while we look, the file is simply mapped again.
+class StoreViewer {
+private:
+    StateStore store;
+    string path;
+    
+public:
+    explicit StoreViewer(const string& storePath) : path(storePath) {}
+    
+    bool print(ostream& out) {
+        for (int attempt = 0; attempt < 3; attempt++) {
+            if (!store.open(path, false)) return false;
+            vector<string> items;
+            vector<string> battalions, depots;
+            store.forEachName([&](const string& name) { items.push_back(name); },
+                              [&](const string& name, const string& location) {
+                                  battalions.push_back(name + " (" + location + ")");
+                              },
+                              [&](const string& name, const string& location) {
+                                  depots.push_back(name + " (" + location + ")");
+                              });
+            
+            ostringstream text;
+            text << "CENTRAL INVENTORY:\n";
+            for (size_t id = 0; id < items.size(); id++) {
+                text << items[id] << ": " << store.stock()[id].load() << " / " << store.maxQuantities()[id] << "\n";
+            }
+            text << "\nDEPOTS:\n";
+            for (size_t d = 0; d < depots.size(); d++) {
+                const AtomicCounter* row = store.depotRow(d);
+                text << depots[d] << "\n";
+                for (size_t id = 0; id < items.size(); id++) {
+                    if (row[id].load() > 0) text << "- " << items[id] << ": " << row[id].load() << "\n";
+                }
+            }
+            text << "\nBATTALIONS:\n";
+            for (size_t b = 0; b < battalions.size(); b++) {
+                const AtomicCounter* row = store.battalionRow(b);
+                const AtomicCounter* holdings = row + kBattalionRowHeader;
+                int supplier = row[1].load();
+                text << battalions[b] << ": " << row[0].load() << " soldiers, supplied by "
+                     << (supplier > 0 && supplier <= (int)depots.size() ? depots[supplier - 1] : string("Central Depot")) << "\n";
+                for (size_t id = 0; id < items.size(); id++) {
+                    if (holdings[id].load() > 0) text << "- " << items[id] << ": " << holdings[id].load() << "\n";
+                }
+            }
+            if (!store.isSuperseded()) {
+                out << text.str();
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    // --store <file> keeps the live state in a memory-mapped file, and
+    // --identities <file> moves the roster index that every mode reads and
+    // --import-roster writes
+    InventoryConfig inventoryConfig;
+    string identityPath = "identity_index.bin";
+    int first = 1;
+    while (argc >= first + 2) {
+        string option = argv[first];
+        if (option == "--store") inventoryConfig.storePath = argv[first + 1];
+        else if (option == "--identities") identityPath = argv[first + 1];
+        else break;
+        first += 2;
+    }
+    string mode = argc > first ? argv[first] : "";
+    
+    if (mode == "--import-roster") {
+        if (argc < first + 2) {
+            cerr << "Usage: " << argv[0] << " [--identities <index file>] --import-roster <roster.csv>\n";
+            return 1;
+        }
+        ifstream roster(argv[first + 1]);
+        if (!roster.is_open()) {
+            cerr << "Cannot open roster " << argv[first + 1] << "\n";
+            return 1;
+        }
+        return IdentityIndex::importRoster(roster, identityPath, cout) ? 0 : 1;
+    }
+    
+    if (mode == "--analyze-log") {
+        AnalyzerConfig config;
+        for (int i = first + 1; i < argc; i++) {
+            if (!config.parse(argv[i])) {
+                cerr << "Unknown analyzer option: " << argv[i] << "\n";
+                return 1;
+            }
+        }
+        // Current stock for the depletion projections, recovered without writing anything
+        InventoryConfig stockConfig = inventoryConfig;
+        stockConfig.readOnly = true;
+        stockConfig.log.path = "";
+        InventorySystem inventory(stockConfig);
+        if (!inventory.isReady()) return 1;
+        LogAnalyzer(config).run(cout, [&](const string& item) {
+            int id = inventory.getCatalog().find(item);
+            return id < 0 ? -1 : inventory.getStock(id);
+        });
+        return 0;
+    }
+    
+    // --report <inventory|battalions> [text|csv|json] prints a report of the recovered state
+    if (mode == "--report") {
+        ReportKind kind;
+        ReportFormat format = ReportFormat::Text;
+        if (argc < first + 2 || !parseReportKind(argv[first + 1], kind) ||
+            (argc > first + 2 && !parseReportFormat(argv[first + 2], format))) {
+            cerr << "Usage: " << argv[0] << " --report <inventory|battalions> [text|csv|json]\n";
+            return 1;
+        }
+        InventoryConfig reportConfig = inventoryConfig;
+        reportConfig.readOnly = true;
+        reportConfig.log.path = "";
+        InventorySystem inventory(reportConfig);
+        if (!inventory.isReady()) return 1;
+        inventory.writeReport(cout, kind, format);
+        return 0;
+    }
+    
+    if (mode == "--view") {
+        if (argc < first + 2) {
+            cerr << "Usage: " << argv[0] << " --view <store file>\n";
+            return 1;
+        }
+        if (!StoreViewer(argv[first + 1]).print(cout)) {
+            cerr << "Cannot read state store " << argv[first + 1] << "\n";
+            return 1;
+        }
+        return 0;
+    }
+    
+    if (mode == "--benchmark") {
+        BenchmarkConfig config;
+        for (int i = first + 1; i < argc; i++) {
+            if (!config.parse(argv[i])) {
+                cerr << "Unknown benchmark option: " << argv[i] << "\n";
+                return 1;
+            }
+        }
+        Benchmark(config).run(cout);
+        return 0;
+    }
+    
+    // --alloc-check [iterations=N] counts the heap allocations of warmed-up requests and logins
+    if (mode == "--alloc-check") {
+#ifdef MAMS_ALLOC_CHECK
+        int iterations = 100000;
+        for (int i = first + 1; i < argc; i++) {
+            string arg = argv[i];
+            if (arg.compare(0, 11, "iterations=") != 0 || arg.size() == 11 || arg.size() > 20 ||
+                !all_of(arg.begin() + 11, arg.end(), [](char c) { return isdigit((unsigned char)c); })) {
+                cerr << "Usage: " << argv[0] << " --alloc-check [iterations=N]\n";
+                return 1;
+            }
+            iterations = max(1, stoi(arg.substr(11)));
+        }
+        return AllocationCheck(iterations).run(cout) ? 0 : 1;
+#else
+        cerr << "--alloc-check needs a build with -DMAMS_ALLOC_CHECK\n";
+        return 1;
+#endif
+    }
+    
+    // Headless mode: --headless reads commands from stdin, --script <file> from a file
+    if (mode == "--headless" || mode == "--script") {
+        ios::sync_with_stdio(false);
+        InventorySystem inventory(inventoryConfig);
+        if (!inventory.isReady()) return 1;
+        IdentityIndex identities;
+        identities.open(identityPath);
+        CommandProcessor processor(inventory, cout, &identities);
+        if (mode == "--headless") {
+            processor.run(cin);
+            return 0;
+        }
+        if (argc < first + 2) {
+            cerr << "Usage: " << argv[0] << " --script <file>\n";
+            return 1;
+        }
+        ifstream script(argv[first + 1]);
+        if (!script.is_open()) {
+            cerr << "Cannot open script " << argv[first + 1] << "\n";
+            return 1;
+        }
+        processor.run(script);
+        return 0;
+    }
+    
+    // --serve [address] [workers=N] serves the inventory on a local socket
+    // until SIGINT/SIGTERM; "tcp:<port>" listens on loopback TCP instead
+    if (mode == "--serve") {
+        string address = "inventory.sock";
+        int workers = max(2, (int)thread::hardware_concurrency());
+        for (int i = first + 1; i < argc; i++) {
+            string arg = argv[i];
+            if (arg.compare(0, 8, "workers=") == 0 && arg.size() > 8 && arg.size() < 12 &&
+                all_of(arg.begin() + 8, arg.end(), [](char c) { return isdigit((unsigned char)c); })) {
+                workers = max(1, stoi(arg.substr(8)));
+            } else {
+                address = arg;
+            }
+        }
+        RequestServer::blockStopSignals();
+        InventorySystem inventory(inventoryConfig);
+        if (!inventory.isReady()) return 1;
+        IdentityIndex identities;
+        identities.open(identityPath);
+        RequestServer server(inventory, &identities);
+        if (!server.run(address, workers)) {
+            cerr << "Cannot listen on " << address << "\n";
+            return 1;
+        }
+        return 0;
+    }
+    
+    // --client [address] sends stdin lines as commands;
+    // --client [address] load [connections=N] [ops=N] [depth=N] [item=N] runs a load test
+    if (mode == "--client") {
+        string address = "inventory.sock";
+        int next = first + 1;
+        if (argc > next && string(argv[next]) != "load") address = argv[next++];
+        if (argc > next) {
+            LoadConfig config;
+            bool valid = string(argv[next]) == "load";
+            for (int i = next + 1; i < argc && valid; i++) valid = config.parse(argv[i]);
+            if (!valid) {
+                cerr << "Usage: " << argv[0] << " --client [address] [load connections=N ops=N depth=N item=N]\n";
+                return 1;
+            }
+            return RequestClient::runLoad(address, config, cout) ? 0 : 1;
+        }
+        RequestClient client;
+        if (!client.connect(address)) {
+            cerr << "Cannot connect to " << address << "\n";
+            return 1;
+        }
+        return client.runCommands(cin, cout) ? 0 : 1;
+    }
+    
+    IdentityIndex identities;
+    identities.open(identityPath);
+    AuthenticationSystem authSystem(inventoryConfig, &identities);
+    if (!authSystem.isReady()) return 1;
+    
+    int choice;
+    do {
+        cout << "\nMILITARY ASSETS MANAGEMENT SYSTEM\n";
+        cout << "1. Soldier Portal\n";
+        cout << "2. Officer Command Portal\n";
+        cout << "0. Exit\n";
+        cout << "Enter choice: ";
+        
+        // Input validation for main menu
+        while (!(cin >> choice)) {
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid input. Please enter 0, 1 or 2: ";
+        }
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        
+        switch(choice) {
+            case 1:
+                authSystem.soldierPortal();
+                break;
+            case 2:
+                authSystem.officerPortal();
+                break;
+        }
+    } while (choice != 0);
+    
+    return 0;
+}